@@ -449,6 +449,9 @@ class XS extends XSComponent
 				try {
 					$this->_search = new XSSearch($conns[$i], $this);
 					$this->_search->setCharset($this->getDefaultCharset());
+					if (isset($this->_config['server.shards'])) {
+						$this->_search->setShards($this->_config['server.shards']);
+					}
 					return $this->_search;
 				} catch (XSException $e) {
 					if (($i + 1) === count($conns)) {
@@ -205,6 +205,55 @@ class XSIndex extends XSServer
 		return $this;
 	}
 
+	/**
+	 * 局部更新索引文档的字段值
+	 * 根据主键找到已有文档, 仅替换 $doc 中设置了的字段值 (用于排序/区间/显示), 空字符串表示删除该值,
+	 * 服务端不会重新分词, 字段的索引词也保持不变, 适用于价格、库存等频繁变动的数据
+	 * @param XSDocument $doc 包含主键及要修改的字段值
+	 * @return XSIndex 返回自身对象以支持串接操作
+	 * @throw XSException 出错时抛出异常
+	 * @since 1.4.18
+	 */
+	public function patch(XSDocument $doc)
+	{
+		// before submit
+		if ($doc->beforeSubmit($this) === false) {
+			return $this;
+		}
+
+		// check primary key of document
+		$fid = $this->xs->getFieldId();
+		$key = $doc->f($fid);
+		if ($key === null || $key === '') {
+			throw new XSException('Missing value of primary key (FIELD:' . $fid . ')');
+		}
+
+		// request cmd & value cmds
+		$cmds = array(new XSCommand(XS_CMD_INDEX_REQUEST, XS_CMD_INDEX_REQUEST_PATCH, $fid->vno, $key));
+		foreach ($this->xs->getAllFields() as $field) /* @var $field XSFieldMeta */ {
+			if ($field->name !== $fid->name && ($value = $doc->f($field)) !== null) {
+				$varg = $field->isNumeric() ? XS_CMD_VALUE_FLAG_NUMERIC : 0;
+				$value = $value === '' ? '' : $field->val($value);
+				$cmds[] = new XSCommand(XS_CMD_DOC_VALUE, $varg, $field->vno, $value);
+			}
+		}
+		$cmds[] = new XSCommand(XS_CMD_INDEX_SUBMIT);
+
+		// execute cmd
+		if ($this->_bufSize > 0) {
+			$this->appendBuffer(implode('', $cmds));
+		} else {
+			for ($i = 0; $i < count($cmds) - 1; $i++) {
+				$this->execCommand($cmds[$i]);
+			}
+			$this->execCommand($cmds[$i], XS_CMD_OK_RQST_FINISHED);
+		}
+
+		// after submit
+		$doc->afterSubmit($this);
+		return $this;
+	}
+
 	/**
 	 * 删除索引中的数据
 	 * <pre>
@@ -242,6 +291,38 @@ class XSIndex extends XSServer
 		return $this;
 	}
 
+	/**
+	 * 按字段值区间删除索引中的数据
+	 * 仅作为一条指令提交, 由服务端导入时在当前库 (含归档库) 中找出区间内的全部文档分批删除
+	 * <pre>
+	 * $index->delRange('chrono', null, 1262275200); // 删除 chrono 小于等于 1262275200 的记录
+	 * $index->delRange('date', '20100101', '20101231'); // 删除 2010 年的记录
+	 * </pre>
+	 * @param string $field 字段名称, 数值型字段按数值比较, 其它按字符串比较
+	 * @param mixed $from 起始值(含), 若设为 null 则不限制
+	 * @param mixed $to 结束值(含), 若设为 null 则不限制
+	 * @return XSIndex 返回自身对象以支持串接操作
+	 * @throw XSException 出错时抛出异常
+	 * @since 1.4.18
+	 */
+	public function delRange($field, $from, $to)
+	{
+		$field = $this->xs->getField($field);
+		$from = $from === null ? '' : XS::convert(strval($from), 'UTF-8', $this->xs->getDefaultCharset());
+		$to = $to === null ? '' : XS::convert(strval($to), 'UTF-8', $this->xs->getDefaultCharset());
+		if ($from === '' && $to === '') {
+			return $this;
+		}
+		$arg1 = XS_CMD_INDEX_REMOVE_RANGE | ($field->isNumeric() ? XS_CMD_VALUE_FLAG_NUMERIC : 0);
+		$cmd = new XSCommand(XS_CMD_INDEX_REMOVE, $arg1, $field->vno, $from, $to);
+		if ($this->_bufSize > 0) {
+			$this->appendBuffer(strval($cmd));
+		} else {
+			$this->execCommand($cmd, XS_CMD_OK_RQST_FINISHED);
+		}
+		return $this;
+	}
+
 	/**
 	 * 批量提交索引命令封包数据
 	 * 把多个命令封包内容连续保存为文件或变量, 然后一次性提交以减少网络开销提升性能
@@ -476,6 +557,70 @@ class XSIndex extends XSServer
 		return true;
 	}
 
+	/**
+	 * 在线优化服务端的当前库
+	 * 优化在后台进行, 期间索引请求照常接收, 待优化结束后再导入
+	 * @return bool 开始优化返回 true, 若当前库正忙则返回 false
+	 * @since 1.4.18
+	 */
+	public function optimize()
+	{
+		try {
+			$this->execCommand(XS_CMD_INDEX_OPTIMIZE, XS_CMD_OK_DB_OPTIMIZE);
+		} catch (XSException $e) {
+			if ($e->getCode() === XS_CMD_ERR_BUSY || $e->getCode() === XS_CMD_ERR_RUNNING) {
+				return false;
+			}
+			throw $e;
+		}
+		return true;
+	}
+
+	/**
+	 * 为服务端的当前库创建热备快照
+	 * 快照保存在服务端项目目录的 snapshot/<name> 下, 包含归档库和日志库,
+	 * 在后台压缩拷贝, 期间搜索不受影响, 索引请求照常接收但暂缓导入直至快照完成,
+	 * 可用 {@link isSnapshotDone} 查询是否完成
+	 * @param string $name 快照名称, 仅限字母、数字、下划线及短横线, 默认以当前时间命名
+	 * @return mixed 开始创建返回快照名称, 若当前库正在导入或已有快照正在创建, 或服务端正忙则返回 false
+	 * @throw XSException 名称不合法或快照已存在时抛出异常
+	 * @since 1.4.18
+	 */
+	public function snapshot($name = null)
+	{
+		$cmd = array('cmd' => XS_CMD_INDEX_SNAPSHOT, 'buf' => strval($name));
+		try {
+			$res = $this->execCommand($cmd, XS_CMD_OK_DB_SNAPSHOT);
+		} catch (XSException $e) {
+			if ($e->getCode() === XS_CMD_ERR_BUSY || $e->getCode() === XS_CMD_ERR_RUNNING) {
+				return false;
+			}
+			throw $e;
+		}
+		return $res->buf;
+	}
+
+	/**
+	 * 查询快照是否已完成
+	 * @param string $name 快照名称, 即 {@link snapshot} 的返回值
+	 * @return bool 已完成返回 true, 正在创建返回 false
+	 * @throw XSException 快照失败或不存在时抛出异常
+	 * @since 1.4.18
+	 */
+	public function isSnapshotDone($name)
+	{
+		$cmd = array('cmd' => XS_CMD_INDEX_SNAPSHOT, 'arg1' => 1, 'buf' => strval($name));
+		try {
+			$this->execCommand($cmd, XS_CMD_OK_DB_SNAPSHOT);
+		} catch (XSException $e) {
+			if ($e->getCode() === XS_CMD_ERR_RUNNING) {
+				return false;
+			}
+			throw $e;
+		}
+		return true;
+	}
+
 	/**
 	 * 获取自定义词典内容
 	 * @return string 自定义词库内容
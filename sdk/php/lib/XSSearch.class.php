@@ -19,6 +19,7 @@
  *
  * @property string $query 默认搜索语句
  * @property-read int $dbTotal 数据库内的数据总量
+ * @property-read int $replicaLag 副本的复制延迟秒数
  * @property-read int $lastCount 最近那次搜索的匹配总量估值
  * @property-read array $hotQuery 热门搜索词列表
  * @property-read array $relatedQuery 相关搜索词列表
@@ -35,6 +36,10 @@ class XSSearch extends XSServer
 	 */
 	const PAGE_SIZE = 10;
 	const LOG_DB = 'log_db';
+	/**
+	 * 服务端单次批量搜索的最大数量, 超出时由 {@link searchBatch} 自动分批提交
+	 */
+	const BATCH_SIZE = 32;
 
 	private $_defaultOp = XS_CMD_QUERY_OP_AND;
 	private $_prefix, $_fieldSet, $_resetScheme = false;
@@ -43,7 +48,7 @@ class XSSearch extends XSServer
 	private $_curDb, $_curDbs = array();
 	private $_lastDb, $_lastDbs = array();
 	private $_facets = array();
-	private $_limit = 0, $_offset = 0;
+	private $_limit = 0, $_offset = 0, $_exactCount = false;
 	private $_charset = 'UTF-8';
 
 	/**
@@ -528,6 +533,19 @@ class XSSearch extends XSServer
 		return $this;
 	}
 
+	/**
+	 * 设置下一次搜索精确统计匹配数量
+	 * 匹配数量、搜索结果和分面在同一次检索中得出, 通过 {@link getLastCount} 读取,
+	 * 可以省去额外调用 {@link count} 的开销, 每次调用 {@link search} 后会还原该设置
+	 * @param bool $value 是否精确统计, 默认为 true
+	 * @return XSSearch 返回对象本身以支持串接操作
+	 */
+	public function setExactCount($value = true)
+	{
+		$this->_exactCount = $value === true;
+		return $this;
+	}
+
 	/**
 	 * 设置要搜索的数据库名
 	 * 若未设置, 使用默认数据库, 数据库必须位于服务端用户目录下
@@ -560,6 +578,32 @@ class XSSearch extends XSServer
 		return $this;
 	}
 
+	/**
+	 * 设置远程分片, 在多个分片上同时搜索当前项目
+	 * 每个分片是运行在其它服务器上的 Xapian 远程服务 (如: xapian-tcpsrv --port 8386 db db_a),
+	 * 由搜索服务端合并各分片的结果、分面及数量, 并按全部分片的统计信息计算权重, 调用 setDb 恢复本地搜索
+	 * 若开启了数据压缩, 本地项目目录下须有相应的 zdict_*.dat 字典文件 (可由 xs-replicate 同步)
+	 * @param mixed $shards 分片地址数组, 或以分号分隔的字符串, 格式为 host:port
+	 * @return XSSearch 返回对象本身以支持串接操作
+	 * @since 1.4.18
+	 */
+	public function setShards($shards)
+	{
+		$list = array();
+		foreach ((is_array($shards) ? $shards : explode(';', $shards)) as $shard) {
+			$shard = trim($shard);
+			if ($shard !== '') {
+				$list[] = $shard;
+			}
+		}
+		$this->execCommand(array('cmd' => XS_CMD_SEARCH_SET_SHARDS, 'buf' => implode(';', $list)));
+		$this->_lastDb = $this->_curDb;
+		$this->_lastDbs = $this->_curDbs;
+		$this->_curDb = $list;
+		$this->_curDbs = array();
+		return $this;
+	}
+
 	/**
 	 * 标记字段方案重置
 	 * @see XS::setScheme
@@ -605,20 +649,24 @@ class XSSearch extends XSServer
 	 * @param string $query 搜索语句, 若传入 null 使用默认语句, 调用后会还原默认排序方式
 	 *        如果搜索语句和最近一次 {@link search} 的语句一样, 请改用 {@link getLastCount} 以提升效率
 	 *        最大长度为 80 字节
+	 * @param mixed $exact 是否精确统计, 默认为 false 即估算数值
+	 *        设为 true 则精确统计全部匹配数据, 设为整数则表示估算时至少检查的文档数 (check_at_least)
 	 * @return int 匹配的搜索结果数量, 估算数值
 	 */
-	public function count($query = null)
+	public function count($query = null, $exact = false)
 	{
 		$query = $query === null ? '' : $this->preQueryString($query);
-		if ($query === '' && $this->_count !== null) {
+		if ($query === '' && $this->_count !== null && $exact === false) {
 			return $this->_count;
 		}
 
-		$cmd = new XSCommand(XS_CMD_SEARCH_GET_TOTAL, 0, $this->_defaultOp, $query);
+		$arg1 = $exact === true ? XS_CMD_COUNT_EXACT : XS_CMD_COUNT_ESTIMATED;
+		$buf1 = is_int($exact) ? pack('I', $exact) : '';
+		$cmd = new XSCommand(XS_CMD_SEARCH_GET_TOTAL, $arg1, $this->_defaultOp, $query, $buf1);
 		$res = $this->execCommand($cmd, XS_CMD_OK_SEARCH_TOTAL);
 		$ret = unpack('Icount', $res->buf);
 
-		if ($query === '') {
+		if ($query === '' && $exact === false) {
 			$this->_count = $ret['count'];
 		}
 		return $ret['count'];
@@ -641,55 +689,15 @@ class XSSearch extends XSServer
 		$page = pack('II', $this->_offset, $this->_limit > 0 ? $this->_limit : self::PAGE_SIZE);
 
 		// get result header
-		$cmd = new XSCommand(XS_CMD_SEARCH_GET_RESULT, 0, $this->_defaultOp, $query, $page);
+		$arg1 = $this->_exactCount ? XS_CMD_COUNT_EXACT : XS_CMD_COUNT_ESTIMATED;
+		$cmd = new XSCommand(XS_CMD_SEARCH_GET_RESULT, $arg1, $this->_defaultOp, $query, $page);
 		$res = $this->execCommand($cmd, XS_CMD_OK_RESULT_BEGIN);
 		$tmp = unpack('Icount', $res->buf);
 		$this->_lastCount = $tmp['count'];
 
-		// load vno map to name of fields
-		$ret = $this->_facets = array();
-		$vnoes = $this->xs->getScheme()->getVnoMap();
-
 		// get result documents
-		while (true) {
-			$res = $this->getRespond();
-			if ($res->cmd == XS_CMD_SEARCH_RESULT_FACETS) {
-				$off = 0;
-				while (($off + 6) < strlen($res->buf)) {
-					$tmp = unpack('Cvno/Cvlen/Inum', substr($res->buf, $off, 6));
-					if (isset($vnoes[$tmp['vno']])) {
-						$name = $vnoes[$tmp['vno']];
-						$value = substr($res->buf, $off + 6, $tmp['vlen']);
-						if (!isset($this->_facets[$name])) {
-							$this->_facets[$name] = array();
-						}
-						$this->_facets[$name][$value] = $tmp['num'];
-					}
-					$off += $tmp['vlen'] + 6;
-				}
-			} elseif ($res->cmd == XS_CMD_SEARCH_RESULT_DOC) {
-				// got new doc
-				$doc = new XSDocument($res->buf, $this->_charset);
-				$ret[] = $doc;
-			} elseif ($res->cmd == XS_CMD_SEARCH_RESULT_FIELD) {
-				// fields of doc
-				if (isset($doc)) {
-					$name = isset($vnoes[$res->arg]) ? $vnoes[$res->arg] : $res->arg;
-					$doc->setField($name, $res->buf);
-				}
-			} elseif ($res->cmd == XS_CMD_SEARCH_RESULT_MATCHED) {
-				// matched terms
-				if (isset($doc)) {
-					$doc->setField('matched', explode(' ', $res->buf), true);
-				}
-			} elseif ($res->cmd == XS_CMD_OK && $res->arg == XS_CMD_OK_RESULT_END) {
-				// got the end
-				break;
-			} else {
-				$msg = 'Unexpected respond in search {CMD:' . $res->cmd . ', ARG:' . $res->arg . '}';
-				throw new XSException($msg);
-			}
-		}
+		$this->_facets = array();
+		$ret = $this->readResult();
 
 		if ($query === '') {
 			$this->_count = $this->_lastCount;
@@ -702,9 +710,98 @@ class XSSearch extends XSServer
 			}
 		}
 		$this->_limit = $this->_offset = 0;
+		$this->_exactCount = false;
 		return $ret;
 	}
 
+	/**
+	 * 批量执行多个搜索
+	 * 各搜索在服务端并发执行, 相互独立, 不继承当前对象的排序、区间、数据库等搜索设置
+	 * 每批最多 {@link BATCH_SIZE} 个搜索, 超出时自动拆分为多次请求依次提交
+	 * @param array $queries 搜索语句列表, 元素也可以是数组 array(语句, 数量限制, 偏移量)
+	 * @return array 与 $queries 键名对应的搜索结果,
+	 *         每项为 array('count' => 匹配总数估值, 'docs' => XSDocument 文档列表)
+	 * @throw XSException 任一搜索出错时抛出异常
+	 */
+	public function searchBatch($queries)
+	{
+		if (count($queries) > self::BATCH_SIZE) {
+			$ret = array();
+			foreach (array_chunk($queries, self::BATCH_SIZE, true) as $chunk) {
+				$ret += $this->searchBatch($chunk);
+			}
+			return $ret;
+		}
+
+		$keys = array();
+		$cmds = '';
+		foreach ($queries as $key => $query) {
+			$limit = $offset = 0;
+			if (is_array($query)) {
+				list($query, $limit, $offset) = array_pad(array_values($query), 3, 0);
+			}
+			$cmds .= $this->getSubSearchCommands($query, $limit, $offset);
+			$keys[] = $key;
+		}
+
+		// result blocks are returned in order of completion
+		$cmd = new XSCommand(XS_CMD_SEARCH_BATCH, 0, 0, $cmds);
+		$this->execCommand($cmd, XS_CMD_OK_RESULT_BEGIN);
+		$ret = array();
+		$error = null;
+		while (true) {
+			$res = $this->getRespond();
+			if ($res->cmd == XS_CMD_SEARCH_RESULT_BATCH && isset($keys[$res->arg])) {
+				try {
+					$ret[$keys[$res->arg]] = $this->readResultBlock($res->buf);
+				} catch (XSException $e) {
+					$error = $error === null ? $e : $error;
+				}
+			} elseif ($res->cmd == XS_CMD_OK && $res->arg == XS_CMD_OK_RESULT_END) {
+				break;
+			} else {
+				$msg = 'Unexpected respond in batch search {CMD:' . $res->cmd . ', ARG:' . $res->arg . '}';
+				throw new XSException($msg);
+			}
+		}
+		if ($error !== null) {
+			throw $error;
+		}
+
+		// keep the order of queries
+		$tmp = array();
+		foreach ($keys as $key) {
+			$tmp[$key] = $ret[$key];
+		}
+		return $tmp;
+	}
+
+	/**
+	 * 异步提交搜索请求, 不等待结果
+	 * 需要先调用 {@link setTagged} 启用带请求编号的协议, 多个请求在服务端并发执行
+	 * 与 {@link searchBatch} 一样不继承当前对象的排序、区间、数据库等搜索设置,
+	 * 调用后会还原 setLimit 的设置
+	 * @param string $query 搜索语句
+	 * @return int 请求编号, 用于 {@link fetchAsync} 获取结果
+	 */
+	public function searchAsync($query)
+	{
+		$cmds = $this->getSubSearchCommands($query, $this->_limit, $this->_offset);
+		$this->_limit = $this->_offset = 0;
+		return $this->sendRequest($cmds);
+	}
+
+	/**
+	 * 获取异步搜索请求的结果
+	 * @param int $id 请求编号, 即 {@link searchAsync} 的返回值
+	 * @return array 搜索结果, 格式为 array('count' => 匹配总数估值, 'docs' => XSDocument 文档列表)
+	 * @throw XSException 出错时抛出异常
+	 */
+	public function fetchAsync($id)
+	{
+		return $this->readResultBlock($this->getTaggedRespond($id));
+	}
+
 	/**
 	 * 获取最近那次搜索的匹配总数估值
 	 * @return int 匹配数据量, 如从未搜索则返回 false
@@ -727,6 +824,20 @@ class XSSearch extends XSServer
 		return $tmp['total'];
 	}
 
+	/**
+	 * 获取当前项目在副本服务端的复制延迟
+	 * 副本由 xs-replicate 从索引服务端同步, 延迟为距离最近一次完整同步时的秒数
+	 * @return int 延迟秒数, 若搜索服务端不是副本则返回 -1
+	 * @since 1.4.18
+	 */
+	public function getReplicaLag()
+	{
+		$cmd = new XSCommand(XS_CMD_SEARCH_REPLICA_LAG);
+		$res = $this->execCommand($cmd, XS_CMD_OK_REPLICA_LAG);
+		$tmp = unpack('ilag', $res->buf);
+		return $tmp['lag'];
+	}
+
 	/**
 	 * 获取热门搜索词列表
 	 * @param int $limit 需要返回的热门搜索数量上限, 默认为 6, 最大值为 50
@@ -980,6 +1091,133 @@ class XSSearch extends XSServer
 		$this->addSearchLog($log);
 	}
 
+	/**
+	 * 读取搜索结果文档 (及分面统计) 直到结束
+	 * @param string $buf 批量搜索的结果块内容, 默认为 null 即从服务端读取
+	 * @return XSDocument[] 搜索结果文档列表
+	 */
+	private function readResult($buf = null)
+	{
+		// load vno map to name of fields
+		$ret = array();
+		$vnoes = $this->xs->getScheme()->getVnoMap();
+
+		// get result documents
+		$off = 0;
+		while (true) {
+			$res = $buf === null ? $this->getRespond() : $this->unpackRespond($buf, $off);
+			if ($res->cmd == XS_CMD_SEARCH_RESULT_FACETS) {
+				$pos = 0;
+				while (($pos + 6) < strlen($res->buf)) {
+					$tmp = unpack('Cvno/Cvlen/Inum', substr($res->buf, $pos, 6));
+					if (isset($vnoes[$tmp['vno']])) {
+						$name = $vnoes[$tmp['vno']];
+						$value = substr($res->buf, $pos + 6, $tmp['vlen']);
+						if (!isset($this->_facets[$name])) {
+							$this->_facets[$name] = array();
+						}
+						$this->_facets[$name][$value] = $tmp['num'];
+					}
+					$pos += $tmp['vlen'] + 6;
+				}
+			} elseif ($res->cmd == XS_CMD_SEARCH_RESULT_DOC) {
+				// got new doc
+				$doc = new XSDocument($res->buf, $this->_charset);
+				$ret[] = $doc;
+			} elseif ($res->cmd == XS_CMD_SEARCH_RESULT_FIELD) {
+				// fields of doc
+				if (isset($doc)) {
+					$name = isset($vnoes[$res->arg]) ? $vnoes[$res->arg] : $res->arg;
+					$doc->setField($name, $res->buf);
+				}
+			} elseif ($res->cmd == XS_CMD_SEARCH_RESULT_MATCHED) {
+				// matched terms
+				if (isset($doc)) {
+					$doc->setField('matched', explode(' ', $res->buf), true);
+				}
+			} elseif ($res->cmd == XS_CMD_OK && $res->arg == XS_CMD_OK_RESULT_END) {
+				// got the end
+				break;
+			} else {
+				$msg = 'Unexpected respond in search {CMD:' . $res->cmd . ', ARG:' . $res->arg . '}';
+				throw new XSException($msg);
+			}
+		}
+		return $ret;
+	}
+
+	/**
+	 * 创建获取搜索结果的指令 (用于批量及异步搜索)
+	 * @param string $query 搜索语句
+	 * @param int $limit 数量限制, 0 表示默认值
+	 * @param int $offset 偏移量
+	 * @return XSCommand 搜索指令
+	 */
+	private function getResultCommand($query, $limit = 0, $offset = 0)
+	{
+		$page = pack('II', $offset, $limit > 0 ? $limit : self::PAGE_SIZE);
+		return new XSCommand(XS_CMD_SEARCH_GET_RESULT, XS_CMD_COUNT_ESTIMATED, $this->_defaultOp,
+						$this->preQueryString($query), $page);
+	}
+
+	/**
+	 * 创建独立子搜索的全部指令 (用于批量及异步搜索)
+	 * 子搜索在服务端的新连接上执行, 须附带已登记的字段前缀及字段的裁剪、数值设置
+	 * @param string $query 搜索语句
+	 * @param int $limit 数量限制, 0 表示默认值
+	 * @param int $offset 偏移量
+	 * @return string 打包后的指令
+	 */
+	private function getSubSearchCommands($query, $limit = 0, $offset = 0)
+	{
+		// prefixes of the query are registered here
+		$res = strval($this->getResultCommand($query, $limit, $offset));
+		$cmds = '';
+		foreach ($this->getSpecialFieldCommands() as $cmd) {
+			$cmds .= $cmd;
+		}
+		foreach (array_keys($this->_prefix) as $name) {
+			$cmds .= $this->getPrefixCommand($this->xs->getField($name));
+		}
+		return $cmds . $res;
+	}
+
+	/**
+	 * 解析批量或异步搜索的结果块
+	 * @param string $buf 结果块内容
+	 * @return array 搜索结果, 格式为 array('count' => 匹配总数估值, 'docs' => XSDocument 文档列表)
+	 * @throw XSException 出错时抛出异常
+	 */
+	private function readResultBlock($buf)
+	{
+		$off = 0;
+		$res = $this->unpackRespond($buf, $off);
+		if ($res->cmd == XS_CMD_ERR) {
+			throw new XSException($res->buf, $res->arg);
+		}
+		if ($res->cmd != XS_CMD_OK || $res->arg != XS_CMD_OK_RESULT_BEGIN) {
+			throw new XSException('Unexpected respond {CMD:' . $res->cmd . ', ARG:' . $res->arg . '}');
+		}
+		$tmp = unpack('Icount', $res->buf);
+		return array('count' => $tmp['count'], 'docs' => $this->readResult(substr($buf, $off)));
+	}
+
+	/**
+	 * 从批量搜索的结果块中解析出一个响应指令
+	 * @param string $buf 结果块内容
+	 * @param int $off 解析偏移量, 解析后自动后移
+	 * @return XSCommand 响应指令
+	 */
+	private function unpackRespond($buf, &$off)
+	{
+		$hdr = unpack('Ccmd/Carg1/Carg2/Cblen1/Iblen', substr($buf, $off, 8));
+		$res = new XSCommand($hdr);
+		$res->buf = substr($buf, $off + 8, $hdr['blen']);
+		$res->buf1 = substr($buf, $off + 8 + $hdr['blen'], $hdr['blen1']);
+		$off += 8 + $hdr['blen'] + $hdr['blen1'];
+		return $res;
+	}
+
 	/**
 	 * 清空默认搜索语句
 	 */
@@ -1059,6 +1297,10 @@ class XSSearch extends XSServer
 	{
 		$db = $this->_lastDb;
 		$dbs = $this->_lastDbs;
+		if (is_array($db)) {
+			$this->setShards($db);
+			return;
+		}
 		$this->setDb($db);
 		foreach ($dbs as $name) {
 			$this->addDb($name);
@@ -1147,32 +1389,52 @@ class XSSearch extends XSServer
 		if (!isset($this->_prefix[$name])
 			&& ($field = $this->xs->getField($name, false))
 			&& ($field->vno != XSFieldScheme::MIXED_VNO)) {
-			$type = $field->isBoolIndex() ? XS_CMD_PREFIX_BOOLEAN : XS_CMD_PREFIX_NORMAL;
-			$cmd = new XSCommand(XS_CMD_QUERY_PREFIX, $type, $field->vno, $name);
-			$this->execCommand($cmd);
+			$this->execCommand($this->getPrefixCommand($field));
 			$this->_prefix[$name] = true;
 		}
 	}
 
 	/**
-	 * 设置字符型字段及裁剪长度
+	 * 创建登记字段前缀的指令
+	 * @param XSFieldMeta $field 字段
+	 * @return XSCommand 指令
 	 */
-	private function initSpecialField()
+	private function getPrefixCommand($field)
 	{
-		if ($this->_fieldSet === true) {
-			return;
-		}
+		$type = $field->isBoolIndex() ? XS_CMD_PREFIX_BOOLEAN : XS_CMD_PREFIX_NORMAL;
+		return new XSCommand(XS_CMD_QUERY_PREFIX, $type, $field->vno, $field->name);
+	}
+
+	/**
+	 * 创建设置字符型字段及裁剪长度的指令
+	 * @return array XSCommand 指令列表
+	 */
+	private function getSpecialFieldCommands()
+	{
+		$cmds = array();
 		foreach ($this->xs->getAllFields() as $field) /* @var $field XSFieldMeta */ {
 			if ($field->cutlen != 0) {
 				$len = min(127, ceil($field->cutlen / 10));
-				$cmd = new XSCommand(XS_CMD_SEARCH_SET_CUT, $len, $field->vno);
-				$this->execCommand($cmd);
+				$cmds[] = new XSCommand(XS_CMD_SEARCH_SET_CUT, $len, $field->vno);
 			}
 			if ($field->isNumeric()) {
-				$cmd = new XSCommand(XS_CMD_SEARCH_SET_NUMERIC, 0, $field->vno);
-				$this->execCommand($cmd);
+				$cmds[] = new XSCommand(XS_CMD_SEARCH_SET_NUMERIC, 0, $field->vno);
 			}
 		}
+		return $cmds;
+	}
+
+	/**
+	 * 设置字符型字段及裁剪长度
+	 */
+	private function initSpecialField()
+	{
+		if ($this->_fieldSet === true) {
+			return;
+		}
+		foreach ($this->getSpecialFieldCommands() as $cmd) {
+			$this->execCommand($cmd);
+		}
 		$this->_fieldSet = true;
 	}
 
@@ -125,6 +125,7 @@ class XSServer extends XSComponent
 	 */
 	const FILE = 0x01;
 	const BROKEN = 0x02;
+	const TAGGED = 0x04;
 
 	/**
 	 * @var XS 服务端关联的 XS 对象
@@ -134,6 +135,8 @@ class XSServer extends XSComponent
 	protected $_flag;
 	protected $_project;
 	protected $_sendBuffer;
+	protected $_requestId = 0;
+	protected $_tagged = array();
 
 	/**
 	 * 构造函数, 打开连接
@@ -169,6 +172,7 @@ class XSServer extends XSComponent
 		$this->_flag = self::BROKEN;
 		$this->_sendBuffer = '';
 		$this->_project = null;
+		$this->_tagged = array();
 		$this->connect();
 		$this->_flag ^= self::BROKEN;
 		if ($this->xs instanceof XS) {
@@ -326,6 +330,68 @@ class XSServer extends XSComponent
 		$this->write(strval($cmd));
 	}
 
+	/**
+	 * 设置是否启用带请求编号的协议
+	 * 启用后可通过 {@link sendRequest} 在同一连接上连续提交多个请求, 服务端可能乱序完成
+	 * @param bool $value 是否启用, 默认为 true
+	 * @return XSServer 返回自己, 以便串接操作
+	 * @throw XSException 出错时抛出异常
+	 */
+	public function setTagged($value = true)
+	{
+		$arg = $value === true ? XS_CMD_PROTOCOL_TAGGED : XS_CMD_PROTOCOL_BASIC;
+		$this->execCommand(new XSCommand(XS_CMD_SET_PROTOCOL, 0, $arg), XS_CMD_OK_PROTOCOL_SET);
+		if ($value === true) {
+			$this->_flag |= self::TAGGED;
+		} else {
+			$this->_flag &= ~self::TAGGED;
+		}
+		return $this;
+	}
+
+	/**
+	 * 提交带编号的请求, 不等待响应
+	 * @param string $cmds 请求包含的指令封包字符串, 即多个 XSCommand 字符串连接
+	 * @return int 请求编号, 用于 {@link getTaggedRespond} 读取响应
+	 * @throw XSException 出错时抛出异常
+	 */
+	public function sendRequest($cmds)
+	{
+		if (!($this->_flag & self::TAGGED)) {
+			throw new XSException('Tagged protocol is not enabled');
+		}
+		$id = $this->_requestId = ($this->_requestId + 1) & 0xffff;
+		$cmd = new XSCommand(XS_CMD_REQUEST, $id >> 8, $id & 0xff, $cmds);
+		$buf = $this->_sendBuffer . $cmd;
+		$this->_sendBuffer = '';
+		$this->write($buf);
+		return $id;
+	}
+
+	/**
+	 * 读取指定编号请求的响应
+	 * 先到达的其它请求的响应会被暂存
+	 * @param int $id 请求编号
+	 * @return string 响应内容, 即该请求全部响应指令的封包字符串
+	 * @throw XSException 出错时抛出异常
+	 */
+	public function getTaggedRespond($id)
+	{
+		while (!isset($this->_tagged[$id])) {
+			$res = $this->getRespond();
+			if ($res->cmd === XS_CMD_ERR) {
+				throw new XSException($res->buf, $res->arg);
+			}
+			if ($res->cmd !== XS_CMD_RESPOND_TAGGED) {
+				throw new XSException('Unexpected respond {CMD:' . $res->cmd . ', ARG:' . $res->arg . '}');
+			}
+			$this->_tagged[$res->arg] = $res->buf;
+		}
+		$buf = $this->_tagged[$id];
+		unset($this->_tagged[$id]);
+		return $buf;
+	}
+
 	/**
 	 * 从服务器读取响应指令
 	 * @return XSCommand 成功返回响应指令
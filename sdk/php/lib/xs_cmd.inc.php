@@ -1,5 +1,5 @@
 <?php
-/* Automatically generated at 2022/08/11 20:36 */
+/* Automatically generated at 2026/10/19 08:24 */
 define('XS_CMD_NONE',	0);
 define('XS_CMD_DEFAULT',	XS_CMD_NONE);
 define('XS_CMD_PROTOCOL',	20110707);
@@ -8,6 +8,8 @@ define('XS_CMD_HELLO',	1);
 define('XS_CMD_DEBUG',	2);
 define('XS_CMD_TIMEOUT',	3);
 define('XS_CMD_QUIT',	4);
+define('XS_CMD_SET_PROTOCOL',	5);
+define('XS_CMD_REQUEST',	6);
 define('XS_CMD_INDEX_SET_DB',	32);
 define('XS_CMD_INDEX_GET_DB',	33);
 define('XS_CMD_INDEX_SUBMIT',	34);
@@ -20,6 +22,8 @@ define('XS_CMD_INDEX_REBUILD',	40);
 define('XS_CMD_FLUSH_LOGGING',	41);
 define('XS_CMD_INDEX_SYNONYMS',	42);
 define('XS_CMD_INDEX_USER_DICT',	43);
+define('XS_CMD_INDEX_OPTIMIZE',	44);
+define('XS_CMD_INDEX_SNAPSHOT',	45);
 define('XS_CMD_SEARCH_DB_TOTAL',	64);
 define('XS_CMD_SEARCH_GET_TOTAL',	65);
 define('XS_CMD_SEARCH_GET_RESULT',	66);
@@ -31,16 +35,21 @@ define('XS_CMD_SEARCH_DRAW_TPOOL',	70);
 define('XS_CMD_SEARCH_ADD_LOG',	71);
 define('XS_CMD_SEARCH_GET_SYNONYMS',	72);
 define('XS_CMD_SEARCH_SCWS_GET',	73);
+define('XS_CMD_SEARCH_BATCH',	74);
+define('XS_CMD_SEARCH_REPLICA_LAG',	75);
+define('XS_CMD_SEARCH_SET_SHARDS',	76);
 define('XS_CMD_QUERY_GET_STRING',	96);
 define('XS_CMD_QUERY_GET_TERMS',	97);
 define('XS_CMD_QUERY_GET_CORRECTED',	98);
 define('XS_CMD_QUERY_GET_EXPANDED',	99);
 define('XS_CMD_OK',	128);
 define('XS_CMD_ERR',	129);
+define('XS_CMD_RESPOND_TAGGED',	130);
 define('XS_CMD_SEARCH_RESULT_DOC',	140);
 define('XS_CMD_SEARCH_RESULT_FIELD',	141);
 define('XS_CMD_SEARCH_RESULT_FACETS',	142);
 define('XS_CMD_SEARCH_RESULT_MATCHED',	143);
+define('XS_CMD_SEARCH_RESULT_BATCH',	144);
 define('XS_CMD_DOC_TERM',	160);
 define('XS_CMD_DOC_VALUE',	161);
 define('XS_CMD_DOC_INDEX',	162);
@@ -103,11 +112,18 @@ define('XS_CMD_INDEX_FLAG_CHECKSTEM',	0x80);
 define('XS_CMD_VALUE_FLAG_NUMERIC',	0x80);
 define('XS_CMD_INDEX_REQUEST_ADD',	0);
 define('XS_CMD_INDEX_REQUEST_UPDATE',	1);
+define('XS_CMD_INDEX_REQUEST_PATCH',	2);
 define('XS_CMD_INDEX_SYNONYMS_ADD',	0);
 define('XS_CMD_INDEX_SYNONYMS_DEL',	1);
 define('XS_CMD_SEARCH_MISC_SYN_SCALE',	1);
 define('XS_CMD_SEARCH_MISC_MATCHED_TERM',	2);
 define('XS_CMD_SEARCH_MISC_WEIGHT_SCHEME',	3);
+define('XS_CMD_COUNT_ESTIMATED',	0);
+define('XS_CMD_COUNT_EXACT',	1);
+define('XS_CMD_PROTOCOL_BASIC',	0);
+define('XS_CMD_PROTOCOL_TAGGED',	1);
+define('XS_CMD_INDEX_REMOVE_TERM',	0);
+define('XS_CMD_INDEX_REMOVE_RANGE',	1);
 define('XS_CMD_SCWS_GET_VERSION',	1);
 define('XS_CMD_SCWS_GET_RESULT',	2);
 define('XS_CMD_SCWS_GET_TOPS',	3);
@@ -144,6 +160,9 @@ define('XS_CMD_ERR_STAT',	512);
 define('XS_CMD_ERR_OPEN_FILE',	513);
 define('XS_CMD_ERR_TASK_CANCELED',	514);
 define('XS_CMD_ERR_XAPIAN',	515);
+define('XS_CMD_ERR_EXISTS',	516);
+define('XS_CMD_ERR_SNAPSHOT',	517);
+define('XS_CMD_ERR_DISCARDED',	518);
 define('XS_CMD_OK_INFO',	200);
 define('XS_CMD_OK_PROJECT',	201);
 define('XS_CMD_OK_QUERY_STRING',	202);
@@ -156,6 +175,7 @@ define('XS_CMD_OK_RESULT_END',	207);
 define('XS_CMD_OK_TIMEOUT_SET',	208);
 define('XS_CMD_OK_FINISHED',	209);
 define('XS_CMD_OK_LOGGED',	210);
+define('XS_CMD_OK_PROTOCOL_SET',	211);
 define('XS_CMD_OK_RQST_FINISHED',	250);
 define('XS_CMD_OK_DB_CHANGED',	251);
 define('XS_CMD_OK_DB_INFO',	252);
@@ -166,7 +186,10 @@ define('XS_CMD_OK_DB_COMMITED',	256);
 define('XS_CMD_OK_DB_REBUILD',	257);
 define('XS_CMD_OK_LOG_FLUSHED',	258);
 define('XS_CMD_OK_DICT_SAVED',	259);
+define('XS_CMD_OK_DB_OPTIMIZE',	260);
+define('XS_CMD_OK_DB_SNAPSHOT',	261);
 define('XS_CMD_OK_RESULT_SYNONYMS',	280);
+define('XS_CMD_OK_REPLICA_LAG',	281);
 define('XS_CMD_OK_SCWS_RESULT',	290);
 define('XS_CMD_OK_SCWS_TOPS',	291);
 define('XS_PACKAGE_BUGREPORT',	"http://www.xunsearch.com/bugs");
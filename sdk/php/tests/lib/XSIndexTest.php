@@ -177,6 +177,137 @@ class XSIndexTest extends PHPUnit_Framework_TestCase
 		$this->assertEquals(3, $search->reopen(true)->dbTotal);
 	}
 
+	public function testDelRange()
+	{
+		$search = $this->object->xs->search;
+		$doc = new XSDocument(self::$data);
+		for ($i = 1; $i <= 5; $i++) {
+			$doc->pid = $i;
+			$doc->chrono = $i * 100;
+			$doc->date = '2010010' . $i;
+			$this->object->add($doc);
+		}
+		// numeric range must not compare as string: '1000' < '200'
+		$doc->pid = 6;
+		$doc->chrono = 1000;
+		$doc->date = '20091231';
+		$this->object->add($doc);
+		$this->object->flushIndex();
+		sleep(2);
+		$this->assertEquals(6, $search->reopen(true)->dbTotal);
+
+		$this->object->delRange('chrono', null, 200);
+		$this->object->flushIndex();
+		sleep(2);
+		$this->assertEquals(4, $search->reopen(true)->dbTotal);
+		$this->assertEquals(0, $search->count('pid:2'));
+		$this->assertEquals(1, $search->count('pid:6'));
+
+		$this->object->delRange('date', '20100105', null);
+		$this->object->delRange('chrono', null, null); // ignored
+		$this->object->flushIndex();
+		sleep(2);
+		$this->assertEquals(3, $search->reopen(true)->dbTotal);
+		$this->assertEquals(1, $search->count('pid:3'));
+		$this->assertEquals(1, $search->count('pid:4'));
+		$this->assertEquals(1, $search->count('pid:6'));
+
+		$this->object->delRange('chrono', 250, 350);
+		$this->object->delRange('date', null, '20091231');
+		$this->object->flushIndex();
+		sleep(2);
+		$this->assertEquals(1, $search->reopen(true)->dbTotal);
+		$this->assertEquals(1, $search->count('pid:4'));
+	}
+
+	public function testPatch()
+	{
+		$search = $this->object->xs->search;
+		$doc = new XSDocument(self::$data);
+		$this->object->add($doc);
+		$this->object->flushIndex();
+		sleep(2);
+		$this->assertEquals(1, $search->reopen(true)->count('subject:测试标题'));
+
+		$doc = new XSDocument(array('pid' => 1234, 'chrono' => 5678, 'subject' => 'patched subject'));
+		$this->object->patch($doc);
+		$doc = new XSDocument(array('pid' => 9999, 'chrono' => 1));
+		$this->object->patch($doc); // not found
+		$this->object->flushIndex();
+		sleep(2);
+		$this->assertEquals(1, $search->reopen(true)->dbTotal);
+		$docs = $search->search('pid:1234');
+		$this->assertEquals(5678, $docs[0]->chrono);
+		$this->assertEquals('patched subject', $docs[0]->subject);
+		$this->assertEquals(self::$data['message'], $docs[0]->message);
+		// terms are not changed
+		$this->assertEquals(1, $search->count('subject:测试标题'));
+		$this->assertEquals(0, $search->count('subject:patched'));
+	}
+
+	public function testOptimize()
+	{
+		$search = $this->object->xs->search;
+		$doc = new XSDocument(self::$data_gbk);
+		$this->object->add($doc);
+		$this->object->add($doc);
+		$this->object->flushIndex();
+		sleep(2);
+		$this->assertEquals(2, $search->reopen(true)->dbTotal);
+
+		$this->assertTrue($this->object->optimize());
+		$this->assertFalse($this->object->optimize()); // running (false)
+		$this->object->add($doc);
+		sleep(3);
+		$this->assertEquals(2, $search->reopen(true)->dbTotal);
+		$this->assertEquals(2, $search->count('pid:1234'));
+
+		$this->object->flushIndex();
+		sleep(2);
+		$this->assertEquals(3, $search->reopen(true)->dbTotal);
+	}
+
+	public function testSnapshot()
+	{
+		$doc = new XSDocument(self::$data_gbk);
+		$this->object->add($doc);
+		$this->object->flushIndex();
+		sleep(2);
+
+		$name = 'test-' . uniqid();
+		$this->assertEquals($name, $this->object->snapshot($name));
+		for ($i = 0; $i < 10 && !$this->object->isSnapshotDone($name); $i++) {
+			sleep(1);
+		}
+		$this->assertTrue($this->object->isSnapshotDone($name));
+		try {
+			$e1 = null;
+			$this->object->snapshot($name);
+		} catch (XSException $e1) {
+
+		}
+		$this->assertInstanceOf('XSException', $e1);
+		$this->assertEquals(XS_CMD_ERR_EXISTS, $e1->getCode());
+
+		try {
+			$e1 = null;
+			$this->object->snapshot('t/1');
+		} catch (XSException $e1) {
+
+		}
+		$this->assertInstanceOf('XSException', $e1);
+		$this->assertEquals(XS_CMD_ERR_INVALIDCHAR, $e1->getCode());
+
+		try {
+			$e1 = null;
+			$this->object->isSnapshotDone($name . '-none');
+		} catch (XSException $e1) {
+
+		}
+		$this->assertInstanceOf('XSException', $e1);
+		$this->assertEquals(XS_CMD_ERR_SNAPSHOT, $e1->getCode());
+	}
+
 	public function testSynonyms($buffer = false)
 	{
 		$index = $this->object;
@@ -147,6 +147,18 @@ class XSSearchTest extends PHPUnit_Framework_TestCase
 
 	}
 
+	public function testExactCountWithFacets()
+	{
+		$search = self::$xs->search;
+		$docs = $search->setQuery('subject:测试')->setFacets('other')->setLimit(1)->setExactCount()->search();
+
+		$this->assertEquals(1, count($docs));
+		$this->assertEquals(3, $search->getLastCount());
+		$facets = $search->getFacets('other');
+		$this->assertEquals($facets['master'], 2);
+		$this->assertEquals(3, $search->count());
+	}
+
 	public function testCharset()
 	{
 		$xs = self::$xs;
@@ -400,6 +412,16 @@ class XSSearchTest extends PHPUnit_Framework_TestCase
 		$this->assertEquals(1, $search->count());
 	}
 
+	public function testCountExact()
+	{
+		$search = self::$xs->search;
+
+		$this->assertEquals(3, $search->count('subject:测试', true));
+		$this->assertEquals(1, $search->count('测试', true));
+		$this->assertEquals(3, $search->count('subject:测试', 10));
+		$this->assertEquals(3, $search->count('', true));
+	}
+
 	public function testSearch()
 	{
 		$search = self::$xs->search;
@@ -409,6 +431,53 @@ class XSSearchTest extends PHPUnit_Framework_TestCase
 		$this->assertEquals(3, $docs[0]->pid);
 	}
 
+	public function testSearchBatch()
+	{
+		$search = self::$xs->search;
+
+		// field prefixes & numeric setting are sent with each sub search
+		$ret = $search->searchBatch(array('demo' => 'subject:DEMO', 'test' => array('subject:测试', 2), 'none' => 'subject:有意思'));
+		$this->assertEquals(array('demo', 'test', 'none'), array_keys($ret));
+		$this->assertEquals(1, $ret['demo']['count']);
+		$this->assertEquals(3, $ret['demo']['docs'][0]->pid);
+		$this->assertEquals(214336158, $ret['demo']['docs'][0]->chrono);
+		$this->assertEquals(0, $ret['none']['count']);
+		$this->assertEquals(1, $search->count('有意思'));
+		$this->assertEquals(3, $ret['test']['count']);
+		$this->assertEquals(2, count($ret['test']['docs']));
+
+		// more than one batch
+		$queries = array();
+		for ($i = 0; $i < XSSearch::BATCH_SIZE + 8; $i++) {
+			$queries['q' . $i] = ($i & 1) ? 'subject:DEMO' : array('subject:测试', 2);
+		}
+		$ret = $search->searchBatch($queries);
+		$this->assertEquals(array_keys($queries), array_keys($ret));
+		$this->assertEquals(1, $ret['q' . (XSSearch::BATCH_SIZE + 7)]['count']);
+		$this->assertEquals(3, $ret['q' . (XSSearch::BATCH_SIZE + 6)]['count']);
+		$this->assertEquals(2, count($ret['q' . (XSSearch::BATCH_SIZE + 6)]['docs']));
+	}
+
+	public function testSearchAsync()
+	{
+		$search = self::$xs->search;
+
+		$search->setTagged();
+		$id1 = $search->setLimit(2)->searchAsync('subject:测试');
+		$id2 = $search->searchAsync('subject:DEMO');
+		$id3 = $search->searchAsync('subject:有意思');
+		$ret = $search->fetchAsync($id2);
+		$this->assertEquals(1, $ret['count']);
+		$this->assertEquals(3, $ret['docs'][0]->pid);
+		$this->assertEquals(214336158, $ret['docs'][0]->chrono);
+		$ret = $search->fetchAsync($id3);
+		$this->assertEquals(0, $ret['count']);
+		$ret = $search->fetchAsync($id1);
+		$this->assertEquals(3, $ret['count']);
+		$this->assertEquals(2, count($ret['docs']));
+		$search->setTagged(false);
+	}
+
 	public function testHotQuery()
 	{
 		$search = self::$xs->search;
@@ -681,4 +750,32 @@ EOF;
 		$search->addQueryTerm('subject', array('管理+制度', '测测看', '对不对'));
 		$this->assertEquals('Query((B管理+制度 AND B测测看 AND B对不对))', $search->query);
 	}
+
+	public function testReplicaLag()
+	{
+		// not replicated from index server
+		$this->assertEquals(-1, self::$xs->search->getReplicaLag());
+		$this->assertEquals(-1, self::$xs->search->replicaLag);
+	}
+
+	public function testSetShards()
+	{
+		$search = self::$xs->search;
+		try {
+			$e1 = null;
+			$search->setShards('localhost');
+		} catch (XSException $e1) {
+			// port missing
+		}
+		try {
+			$e2 = null;
+			$search->setShards(' ; ');
+		} catch (XSException $e2) {
+			// empty list
+		}
+		$this->assertInstanceOf('XSException', $e1);
+		$this->assertEquals(XS_CMD_ERR_WRONGFORMAT, $e1->getCode());
+		$this->assertInstanceOf('XSException', $e2);
+		$this->assertEquals(XS_CMD_ERR_EMPTY, $e2->getCode());
+	}
 }
@@ -35,6 +35,9 @@ struct xs_server
 	int flag; // server flag
 	struct event listen_ev;
 	struct event pipe_ev;
+	struct event timer_ev;
+	struct event watch_ev;
+	int watch_fd; // extra fd to watch readable (-1: none)
 	struct timeval tv; // timeout of listening socket
 	unsigned int max_accept; // max accept number for the server
 	unsigned int num_accept; // current accepted socket number
@@ -46,6 +49,8 @@ struct xs_server
 	zcmd_exec_t zcmd_handler; // called to execute zcmd
 	void (*pause_handler)(XS_CONN *); // called to run external task
 	void (*timeout_handler)(); // called when listening socket timeout
+	void (*timer_handler)(); // called when the one-shot timer expired
+	void (*watch_handler)(int); // called when watch_fd is readable
 };
 
 static struct xs_server conn_server;
@@ -86,6 +91,48 @@ void conn_free_cmds(XS_CONN *conn)
 	conn->ztail = conn->zhead;
 }
 
+/**
+ * Free captured output of connection
+ * @param conn
+ */
+void conn_free_iobufs(XS_CONN *conn)
+{
+	XS_IOBUF *io;
+
+	while ((io = conn->io_head) != NULL) {
+		conn->io_head = io->next;
+		debug_free(io);
+	}
+	conn->io_tail = conn->io_head;
+}
+
+/**
+ * Save output data into captured chain of connection
+ * @return zero on success or -1 on failure
+ */
+static int conn_data_capture(XS_CONN *conn, void *buf, int size)
+{
+	XS_IOBUF *io;
+
+	debug_malloc(io, sizeof(XS_IOBUF) + size, XS_IOBUF);
+	if (io == NULL) {
+		log_error_conn("failed to allocate memory for captured output (SIZE:%d)", size);
+		return -1;
+	}
+	io->buf = (char *) io + sizeof(XS_IOBUF);
+	io->size = size;
+	io->off = 0;
+	io->next = NULL;
+	memcpy(io->buf, buf, size);
+	if (conn->io_tail == NULL) {
+		conn->io_head = io;
+	} else {
+		conn->io_tail->next = io;
+	}
+	conn->io_tail = io;
+	return 0;
+}
+
 /**
  * Write data to connection socket (Equivalent to blocking mode)
  * @return zero on success or -1 on failure
@@ -120,6 +167,10 @@ int conn_data_send(XS_CONN *conn, void *buf, int size)
 
 	// TODO: HERE may cause blocking, replaced with EV_WRITE events in future
 send_try:
+	// captured connection, never write to socket
+	if (conn->flag & CONN_FLAG_CAPTURE) {
+		return conn_data_capture(conn, buf, size);
+	}
 	if ((n = send(CONN_FD(), buf, size, 0)) != size) {
 		if (n > 0) {
 			size -= n;
@@ -168,6 +219,38 @@ int conn_respond(XS_CONN *conn, int cmd, int arg, const char *buf, int len)
 	return CMD_RES_CONT;
 }
 
+/**
+ * Send captured output of connection as buffer of respond command
+ * XS_CMD = { cmd, arg>>8&0xff, arg&0xff, 0, len } + io_head...
+ * @return CMD_RES_CONT | CMD_RES_IOERR
+ */
+int conn_respond_captured(XS_CONN *conn, int cmd, int arg, XS_CONN *src)
+{
+	int rc = CMD_RES_CONT;
+	XS_CMD xcmd;
+	XS_IOBUF *io;
+
+	xcmd.cmd = cmd;
+	xcmd.blen1 = 0;
+	xcmd.blen = 0;
+	XS_CMD_SET_ARG(&xcmd, arg);
+	for (io = src->io_head; io != NULL; io = io->next) {
+		xcmd.blen += io->size;
+	}
+
+	// send cmd header & captured buffers
+	if (conn_data_send(conn, &xcmd, sizeof(XS_CMD)) != 0) {
+		rc = CMD_RES_IOERR;
+	}
+	for (io = src->io_head; io != NULL && rc == CMD_RES_CONT; io = io->next) {
+		if (conn_data_send(conn, io->buf, io->size) != 0) {
+			rc = CMD_RES_IOERR;
+		}
+	}
+	conn_free_iobufs(src);
+	return rc;
+}
+
 /**
  * Quit connection
  * @return CMD_RES_QUIT
@@ -391,6 +474,57 @@ static int conn_zcmd_last(XS_CONN *conn)
 	return rc;
 }
 
+/**
+ * Execute tagged request in place (for single thread server)
+ * Commands are executed one by one as received, respond is captured and sent with request id
+ * @return CMD_RES_xxx
+ */
+static int conn_zcmd_tagged(XS_CONN *conn)
+{
+	int off, size, rc = CMD_RES_CONT, rc2;
+	unsigned short flag;
+	XS_CMD *cmd = conn->zcmd, *zcmd;
+
+	if (CONN_FLUSH() != 0) {
+		return CMD_RES_IOERR;
+	}
+
+	// keep ZMALLOC flag of the request itself
+	flag = conn->flag & CONN_FLAG_ZMALLOC;
+	conn->flag = (conn->flag & ~CONN_FLAG_ZMALLOC) | CONN_FLAG_CAPTURE;
+	for (off = 0; off < XS_CMD_BLEN(cmd) && rc == CMD_RES_CONT; off += size) {
+		if ((XS_CMD_BLEN(cmd) - off) < sizeof(XS_CMD)) {
+			rc = CONN_RES_ERR(WRONGFORMAT);
+			break;
+		}
+		zcmd = (XS_CMD *) (XS_CMD_BUF(cmd) + off);
+		size = XS_CMD_SIZE(zcmd);
+		if (size > (XS_CMD_BLEN(cmd) - off) || zcmd->cmd == CMD_REQUEST) {
+			rc = CONN_RES_ERR(WRONGFORMAT);
+			break;
+		}
+
+		// copy it to make sure the alignment
+		debug_malloc(conn->zcmd, size, XS_CMD);
+		if (conn->zcmd == NULL) {
+			log_error_conn("failed to allocate memory for ZCMD (CMD:%d, SIZE:%d)", zcmd->cmd, size);
+			rc = CMD_RES_NOMEM;
+			break;
+		}
+		memcpy(conn->zcmd, zcmd, size);
+		conn->flag |= CONN_FLAG_ZMALLOC;
+		rc = conn_zcmd_exec(conn, NULL);
+	}
+	CONN_FLUSH();
+	conn->flag = (conn->flag & ~CONN_FLAG_CAPTURE) | flag;
+	conn->zcmd = cmd;
+
+	// send respond with request id
+	log_debug_conn("tagged request executed (ID:%d, RET:0x%04x)", XS_CMD_ARG(cmd), rc);
+	rc2 = conn_respond_captured(conn, CMD_RESPOND_TAGGED, XS_CMD_ARG(cmd), conn);
+	return rc2 != CMD_RES_CONT ? rc2 : rc;
+}
+
 /**
  * Global code of zcmd handler
  * @return CMD_RES_xxx 
@@ -401,7 +535,8 @@ static int conn_zcmd_first(XS_CONN *conn)
 	XS_CMD *cmd = conn->zcmd;
 
 	// check project
-	if (conn->user == NULL && cmd->cmd != CMD_USE && cmd->cmd != CMD_QUIT && cmd->cmd != CMD_TIMEOUT) {
+	if (conn->user == NULL && cmd->cmd != CMD_USE && cmd->cmd != CMD_QUIT && cmd->cmd != CMD_TIMEOUT
+			&& cmd->cmd != CMD_SET_PROTOCOL && cmd->cmd != CMD_REQUEST) {
 		log_warning_conn("project not specified (CMD:%d)", cmd->cmd);
 		return XS_CMD_DONT_ANS(cmd) ? CMD_RES_CONT : CONN_RES_ERR(NOPROJECT);
 	}
@@ -449,6 +584,27 @@ static int conn_zcmd_first(XS_CONN *conn)
 		conn->tv.tv_sec = XS_CMD_ARG(cmd);
 		rc = CONN_RES_OK(TIMEOUT_SET);
 		log_debug_conn("adjust timeout (SEC:%d)", conn->tv.tv_sec);
+	} else if (cmd->cmd == CMD_SET_PROTOCOL) {
+		// negotiate protocol revision
+		int proto = CMD_PROTOCOL;
+		if (XS_CMD_ARG(cmd) == CMD_PROTOCOL_TAGGED) {
+			conn->flag |= CONN_FLAG_TAGGED;
+		} else if (XS_CMD_ARG(cmd) == CMD_PROTOCOL_BASIC) {
+			conn->flag &= ~CONN_FLAG_TAGGED;
+		} else {
+			return CONN_RES_ERR(UNIMP);
+		}
+		rc = CONN_RES_OK3(PROTOCOL_SET, (char *) &proto, sizeof(int));
+		log_debug_conn("protocol revision changed (REV:%d)", XS_CMD_ARG(cmd));
+	} else if (cmd->cmd == CMD_REQUEST) {
+		// tagged request, multi-threads server should handle it by self
+		if (!(conn->flag & CONN_FLAG_TAGGED)) {
+			rc = CONN_RES_ERR(WRONGPLACE);
+		} else if (!(conn_server.flag & CONN_SERVER_THREADS)) {
+			rc = conn_zcmd_tagged(conn);
+		} else if (conn->user == NULL) {
+			rc = CONN_RES_ERR(NOPROJECT);
+		}
 	}
 	return rc;
 }
@@ -667,7 +823,9 @@ ev_try:
 			case CMD_RES_PAUSE:
 				// task should start safely from HERE
 				log_debug_conn("connection paused to run other async task");
-				(*conn_server.pause_handler)(conn);
+				if (conn_server.pause_handler != NULL) {
+					(*conn_server.pause_handler)(conn);
+				}
 				return;
 			default:
 				// CMD_RES_QUIT,CMD_RES_CLOSED, CMD_RES_IOERR
@@ -774,6 +932,26 @@ static void pipe_ev_cb(int fd, short event, void *arg)
 	}
 }
 
+/**
+ * Timer callback (one-shot)
+ */
+static void timer_ev_cb(int fd, short event, void *arg)
+{
+	log_debug("run timer event callback (CALLBACK:%p)", conn_server.timer_handler);
+	if (conn_server.timer_handler != NULL) {
+		(*conn_server.timer_handler)();
+	}
+}
+
+/**
+ * Watch callback (extra fd readable)
+ */
+static void watch_ev_cb(int fd, short event, void *arg)
+{
+	log_debug("run watch event callback (FD:%d, EVENT:0x%04x)", fd, event);
+	(*conn_server.watch_handler)(fd);
+}
+
 /**
  * init the global conn server (called before starting server)
  */
@@ -782,6 +960,7 @@ void conn_server_init()
 	memset(&conn_server, 0, sizeof(conn_server));
 	conn_server.zcmd_handler = NULL;
 	conn_server.tv.tv_sec = (CONN_TIMEOUT << 2);
+	conn_server.watch_fd = -1;
 	time(&conn_server.uptime);
 }
 
@@ -794,6 +973,12 @@ void conn_server_shutdown()
 	conn_server.flag |= CONN_SERVER_STOPPED;
 	event_del(&conn_server.listen_ev);
 	event_del(&conn_server.pipe_ev);
+	if (conn_server.timer_handler != NULL) {
+		event_del(&conn_server.timer_ev);
+	}
+	if (conn_server.watch_fd >= 0) {
+		event_del(&conn_server.watch_ev);
+	}
 	close(event_get_fd(&conn_server.listen_ev));
 }
 
@@ -821,6 +1006,52 @@ void conn_server_set_timeout_handler(void (*func)())
 	conn_server.timeout_handler = func;
 }
 
+/**
+ * set timer handler, called when the timer added by conn_server_add_timer() expired
+ */
+void conn_server_set_timer_handler(void (*func)())
+{
+	conn_server.timer_handler = func;
+}
+
+/**
+ * set handler to be called when the fd is readable (called before starting server)
+ * NOTE: only one fd supported, it is not closed by server, pass -1 to stop watching
+ */
+void conn_server_set_watch(int fd, void (*func)(int))
+{
+	if (conn_server.watch_fd >= 0 && event_initialized(&conn_server.watch_ev)) {
+		event_del(&conn_server.watch_ev);
+	}
+	conn_server.watch_fd = fd;
+	conn_server.watch_handler = func;
+}
+
+/**
+ * Schedule the timer handler to be called after msec (0 -> next loop)
+ * NOTE: an earlier pending schedule is kept
+ */
+void conn_server_add_timer(int msec)
+{
+	struct timeval tv, tv2;
+
+	if (conn_server.timer_handler == NULL || (conn_server.flag & CONN_SERVER_STOPPED)) {
+		return;
+	}
+	tv.tv_sec = msec / 1000;
+	tv.tv_usec = (msec % 1000) * 1000;
+	if (evtimer_pending(&conn_server.timer_ev, &tv2)) {
+		struct timeval now;
+
+		gettimeofday(&now, NULL);
+		timeradd(&now, &tv, &now);
+		if (!timercmp(&now, &tv2, <)) {
+			return;
+		}
+	}
+	evtimer_add(&conn_server.timer_ev, &tv);
+}
+
 /** 
  * set timeout in seconds
  */
@@ -865,6 +1096,30 @@ void conn_server_add_num_task(int num)
 	//	pthread_mutex_unlock(&pipe_mutex);
 }
 
+/**
+ * Resume paused connection in listening thread
+ * Flush the output, then parse commands left in rcv_buf before waiting for new data
+ */
+void conn_server_resume(XS_CONN *conn)
+{
+	int rc = CONN_FLUSH() != 0 ? CMD_RES_IOERR : conn_cmds_parse(conn, NULL);
+
+	log_debug_conn("resume paused connection (RET:0x%04x, RCV_SIZE:%d)", rc, conn->rcv_size);
+	switch (rc) {
+		case CMD_RES_CONT:
+			CONN_EVENT_ADD();
+			break;
+		case CMD_RES_PAUSE:
+			if (conn_server.pause_handler != NULL) {
+				(*conn_server.pause_handler)(conn);
+			}
+			break;
+		default:
+			conn_quit(conn, rc);
+			break;
+	}
+}
+
 /**
  * Push back connection to listening thread
  * Called in sub-threads!
@@ -1028,6 +1283,16 @@ void conn_server_start(int listen_sock)
 	fcntl(pipe_fd[0], F_SETFL, O_NONBLOCK);
 	event_assign(&conn_server.pipe_ev, base, pipe_fd[0], EV_READ | EV_PERSIST, pipe_ev_cb, NULL);
 
+	// timer event
+	evtimer_assign(&conn_server.timer_ev, base, timer_ev_cb, NULL);
+
+	// watch event
+	if (conn_server.watch_fd >= 0) {
+		fcntl(conn_server.watch_fd, F_SETFL, O_NONBLOCK);
+		event_assign(&conn_server.watch_ev, base, conn_server.watch_fd, EV_READ | EV_PERSIST, watch_ev_cb, NULL);
+		event_add(&conn_server.watch_ev, NULL);
+	}
+
 	// thread mutex
 	if (conn_server.flag & CONN_SERVER_THREADS) {
 		pthread_mutex_init(&pipe_mutex, NULL);
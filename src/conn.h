@@ -59,6 +59,7 @@ typedef struct xs_conn
 	XS_USER *user; // the CONN associated with a user?
 	XS_DB *wdb; // current writable db
 	void *zarg; // arg for zcmd_exec
+	XS_IOBUF *io_head, *io_tail; // captured output (CONN_FLAG_CAPTURE)
 } XS_CONN;
 
 /* 
@@ -88,12 +89,18 @@ typedef struct zcmd_exec_tab
 /* free cmds list of connection */
 void conn_free_cmds(XS_CONN *conn);
 
+/* free captured output of connection */
+void conn_free_iobufs(XS_CONN *conn);
+
 /* send data on conn? -1 ERROR, 0->OK (this is same to blocking mode) */
 int conn_data_send(XS_CONN *conn, void *buf, int len);
 
 /* return CMD_RES_CONT on sucess, or CMD_RES_IOERR or ioerror */
 int conn_respond(XS_CONN *conn, int cmd, int arg, const char *buf, int len);
 
+/* send captured output of src as buffer of one respond command, the output is freed */
+int conn_respond_captured(XS_CONN *conn, int cmd, int arg, XS_CONN *src);
+
 /* void conn_quit */
 int conn_quit(XS_CONN *conn, int res);
 
@@ -134,6 +141,15 @@ void conn_server_set_pause_handler(void (*func)(XS_CONN *));
 /* set timeout handler */
 void conn_server_set_timeout_handler(void (*func)());
 
+/* set timer handler, called when the timer added by conn_server_add_timer() expired */
+void conn_server_set_timer_handler(void (*func)());
+
+/* schedule the timer handler to be called after msec, an earlier pending one is kept */
+void conn_server_add_timer(int msec);
+
+/* set handler to be called when the fd is readable */
+void conn_server_set_watch(int fd, void (*func)(int));
+
 /* set timeout in seconds */
 void conn_server_set_timeout(int sec);
 
@@ -149,6 +165,9 @@ void conn_server_set_max_accept(int max_accept);
 /* increase num task of server */
 void conn_server_add_num_task(int num);
 
+/* resume paused connection in listening thread, parse the left commands first */
+void conn_server_resume(XS_CONN *conn);
+
 /* push-back the conn event to listening thread */
 void conn_server_push_back(XS_CONN *conn);
 
@@ -168,6 +187,9 @@ void conn_server_start(int listen_sock);
 #define	CONN_FLAG_EXACT_FACETS	0x40	// exact facets search
 #define	CONN_FLAG_ON_SCWS		0x80	// for scws only
 #define	CONN_FLAG_MATCHED_TERM	0x100	// append matched terms in result doc
+#define	CONN_FLAG_CH_CUTOFF		0x200	// percent/weight cutoff specified
+#define	CONN_FLAG_CAPTURE		0x400	// capture output into io_head instead of sending
+#define	CONN_FLAG_TAGGED		0x800	// CMD_PROTOCOL_TAGGED negotiated
 
 /* server flag */
 #define	CONN_SERVER_THREADS	1		// multi-threads server flag
@@ -0,0 +1,51 @@
+/**
+ * CRC32C (Castagnoli, reflected polynomial 0x82F63B78)
+ * Table driven, the table is generated on the first call
+ *
+ * $Id$
+ */
+
+#include "crc32c.h"
+
+#define	CRC32C_POLY		0x82f63b78
+
+static unsigned int crc_table[256];
+static int crc_inited = 0;
+
+/**
+ * Generate the crc table
+ */
+static void crc32c_init()
+{
+	unsigned int i, j, crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++) {
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : (crc >> 1);
+		}
+		crc_table[i] = crc;
+	}
+	crc_inited = 1;
+}
+
+/**
+ * Calculate crc of buffer
+ * @param crc previous crc value, 0 for the first block
+ * @param buf
+ * @param len
+ * @return new crc value
+ */
+unsigned int crc32c(unsigned int crc, const void *buf, int len)
+{
+	const unsigned char *p = (const unsigned char *) buf;
+
+	if (!crc_inited) {
+		crc32c_init();
+	}
+	crc = ~crc;
+	while (len-- > 0) {
+		crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
@@ -0,0 +1,21 @@
+/**
+ * CRC32C (Castagnoli)
+ *
+ * $Id$
+ */
+
+#ifndef __XS_CRC32C_20261019_H__
+#define	__XS_CRC32C_20261019_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* crc of (buf, len) continued from crc (0 for the first block) */
+unsigned int crc32c(unsigned int crc, const void *buf, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __XS_CRC32C_20261019_H__ */
@@ -17,6 +17,14 @@
 #define	DEFAULT_BACKLOG		63			// default backlog for listen()
 #define	MAX_EXPAND_LEN		15
 #define DEFAULT_SCWS_MULTI	3			// default scws multi level
+#define	SYNONYMS_REV_KEY	"xs:synonyms"	// metadata key, updated on changing synonyms
+#define	DELTA_DB_NAME		DEFAULT_DB_NAME "_d"	// near-real-time delta of default db
+#define	SHADOW_KEY_PREFIX	"xs:shadow:"	// metadata key of delta db, ID term updated or removed
+#define	ARCHIVE_DB_NAME		DEFAULT_DB_NAME "_a"	// archive of default db, stub file of segments db_a<num>
+#define	ZDICT_FILE			"zdict"		// dictionary to compress document data, symbol link of zdict_<id>.dat
+#define	REPLICA_STATE_FILE	"replica.sync"	// time of master state replicated last (on replica only)
+#define	SNAPSHOT_DIR		"snapshot"	// snapshots of project databases, snapshot/<name>
+#define	SNAPSHOT_DONE_FILE	".done"		// saved into snapshot/<name> when it is finished
 
 #ifdef HAVE_MM
 
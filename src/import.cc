@@ -11,21 +11,32 @@
 
 #include <stdio.h>
 #include <signal.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <dirent.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <map>
+#include <vector>
+#include <algorithm>
 #include <xapian.h>
 #include <xapian/unicode.h>
 #include <scws/scws.h>
 
+#include "crc32c.h"
 #include "flock.h"
 #include "pcntl.h"
 #include "log.h"
 #include "xs_cmd.h"
 #include "import.h"
+#include "stemcache.h"
+#include "zdata.h"
 #include "global.h"
 
 /* global flag settings */
@@ -39,6 +50,18 @@
 #define	FLAG_HEADER_ONLY	0x80	// only show the header
 #define	FLAG_ARCHIVE		0x100	// there is archive database
 #define	FLAG_DEFAULT_DB		0x200	// is the dbname equal to db
+#define	FLAG_RECORD			0x400	// file saved as checksummed records (version 1)
+#define	FLAG_READ_END		0x800	// no more documents to read
+#define	FLAG_SHARD			0x1000	// child process to import a sub-database
+#define	FLAG_MERGE			0x2000	// merge sub-databases
+#define	FLAG_DELTA			0x4000	// import committed data of rcvfile into delta db, keep the file
+#define	FLAG_WORKER			0x8000	// warm worker to fork import processes for indexd
+#define	FLAG_ARCHIVE_MERGE	0x10000	// merge segments of archive db
+#define	FLAG_OPTIMIZE		0x20000	// compact the database online
+#define	FLAG_ZDICT			0x40000	// train dictionary to compress document data
+#define	FLAG_BULK			0x80000	// bulk mode for initial loading
+#define	FLAG_UNIQUE			0x100000	// IDs of input are unique, updates are added directly
+#define	FLAG_SNAPSHOT		0x200000	// take a snapshot of the project databases
 
 /* fetch result type */
 #define	FETCH_ABORT			-1		// error break
@@ -48,21 +71,63 @@
 #define	FETCH_DELETE		3		// delete
 #define	FETCH_SKIP			4		// number limit
 #define	FETCH_SYNONYMS		5		// synonyms
+#define	FETCH_SHARD			6		// belongs to other sub-database
+#define	FETCH_COALESCE		7		// superseded by later update/delete in the same batch
+#define	FETCH_PATCH			8		// patch values of existing document
+#define	FETCH_PURGE			9		// remove documents by range of value
 
 #define	HAVE_SYNONYMS_STEM	1		// support stemmer in synonyms
 
 /* local global variables */
 static char *prog_name;
-static int flag, fd, num_skip, bytes_read;
-static int total, total_update, total_delete, total_add, archive_delete;
-static int total_synonyms;
-
-static Xapian::WritableDatabase database, archive, *syn_db;
+static int flag, fd, num_skip, bytes_read, total_read;
+static int total, total_update, total_delete, total_add, archive_delete, total_patch;
+static int total_synonyms, saved_synonyms;
+static int coalesce_batch, coalesce_end, total_coalesce;
+static struct xs_import_hdr hdr;
+
+/* read-ahead buffer */
+static char *rd_buf;
+static int rd_size, rd_pos, rd_len;
+static off_t rd_off, rd_limit;
+
+/* current record (version 1), rec_buf points to read-ahead buffer */
+static char *rec_buf;
+static unsigned int rec_size, rec_pos;
+static int rec_total, app_rec_total;
+static off_t rec_off, app_rec_off;
+
+/* pipeline: documents are built by worker threads, applied in order by main thread */
+static pthread_t *workers;
+static int num_workers, job_num, job_max, pipe_stopped;
+static struct doc_job *job_head, *job_tail, *work_head, *work_tail, *job_pool;
+static pthread_mutex_t job_mutex;
+static pthread_cond_t work_cond, done_cond;
+
+/* sub-databases (shards) */
+static int shard_num, shard_id, shard_left, shard_failed;
+static pid_t *shard_pids;
+static struct stat input_st;
+
+static Xapian::WritableDatabase database, *syn_db;
+static std::vector<Xapian::WritableDatabase> archives; // segments of archive db
+static int archive_seq; // sequence number of next archive segment
 static Xapian::TermGenerator indexer;
 static Xapian::Stem stemmer;
+static const char *stem_lang;
+static CachedStem *stem_cache; // used by main thread
+static unsigned long stem_hits, stem_lookups; // summary of worker threads
+#ifdef HAVE_ZSTD
+static ZSTD_CDict *zcdict; // dictionary to compress data & long values (NULL: disabled)
+#endif
 static Xapian::SimpleStopper stopper;
+static scws_t base_scws; // loaded by warm worker, inherited by children
 using std::string;
 
+// ID term -> index of its last update/delete in the scanned batch
+static std::map<string, int> coalesce_map;
+static string coalesce_key;
+
 /* xapian try block */
 #define	__TRY_FETCH_BEGIN__	try {
 #define	__TRY_FETCH_END__	} catch (const Xapian::Error &e) { \
@@ -70,6 +135,22 @@ using std::string;
 	rc = FETCH_DIRTY; \
 }
 
+/**
+ * Load scws object with system dictionaries
+ */
+static scws_t load_base_scws()
+{
+	scws_t s = scws_new();
+
+	scws_set_charset(s, "utf8");
+	scws_set_ignore(s, SCWS_NA);
+	scws_set_duality(s, SCWS_YEA);
+	scws_set_rule(s, SCWS_ETCDIR "/rules.utf8.ini");
+	scws_set_dict(s, SCWS_ETCDIR "/dict.utf8.xdb", SCWS_XDICT_MEM);
+	scws_add_dict(s, SCWS_ETCDIR "/" CUSTOM_DICT_FILE, SCWS_XDICT_TXT);
+	return s;
+}
+
 /**
  * Load user-defined scws object
  */
@@ -84,13 +165,7 @@ static scws_t load_user_scws(int multi, char *dbpath)
 		sprintf(fpath, "%.*s/" CUSTOM_DICT_FILE, (int) (ptr - dbpath), dbpath);
 		ptr = fpath;
 	}
-	s = scws_new();
-	scws_set_charset(s, "utf8");
-	scws_set_ignore(s, SCWS_NA);
-	scws_set_duality(s, SCWS_YEA);
-	scws_set_rule(s, SCWS_ETCDIR "/rules.utf8.ini");
-	scws_set_dict(s, SCWS_ETCDIR "/dict.utf8.xdb", SCWS_XDICT_MEM);
-	scws_add_dict(s, SCWS_ETCDIR "/" CUSTOM_DICT_FILE, SCWS_XDICT_TXT);
+	s = base_scws != NULL ? base_scws : load_base_scws();
 	scws_add_dict(s, ptr, SCWS_XDICT_TXT);
 	scws_set_multi(s, (multi << 12) & SCWS_MULTI_MASK);
 	return s;
@@ -115,12 +190,24 @@ static void show_usage()
 
 	printf("Usage: %s [options] [DB_dir] [Input_file]\n", prog_name);
 	printf("  -H               Display header of input file only\n");
+	printf("  -A               Merge segments of archive database by size tier, <DB> should be default db\n");
+	printf("  -B               Bulk mode: no transaction, large batches, no archiving, compact <DB> if it was empty\n");
+	printf("  -I               IDs of input are unique, add updated documents without checking (and archive)\n");
+	printf("  -M               Merge sub-databases <DB>_<num> into <DB> and remove them\n");
 	printf("  -N               Do not use transaction\n");
+	printf("  -O               Optimize <DB> online, compact it into <DB>.opt then swap them\n");
+	printf("  -X <dir>         Take a snapshot of <DB> (with archive), logging db and dicts into <dir>\n");
 	printf("  -Q               Completely quiet mode, not output any information\n");
+	printf("  -R               Import committed data of rcvfile into delta database, keep the file\n");
 	printf("  -S               Enable saving information for spelling correction\n");
+	printf("  -U               Do not coalesce updates/deletes of the same document within a batch\n");
+	printf("  -Z               Train dictionary by documents of <DB>, then compress data of the project\n");
 	printf("  -V               Verbose mode, show insert/update message for each document\n");
+	printf("  -w               Run as warm worker of indexd, read import arguments from <stdin>\n");
 	printf("  -d <DB>          Specify the path of the writable database\n");
 	printf("  -f <file>        Specify the path of the import file (binary)\n");
+	printf("  -j <num>         Set the number of threads to build documents, 0 to disable\n");
+	printf("                   Default: number of CPUs - 1, (max: %d)\n", MAX_IMPORT_THREADS);
 	printf("  -k <num>         Set the number of documents to be skipped\n");
 	printf("                   Default: read from file header (CMD_IMPORT_HEADER)\n");
 	printf("  -l <num>         Set the maximum documents to be imported (Not include skipped)\n");
@@ -129,6 +216,9 @@ static void show_usage()
 	printf("                   1|2|4|8 = short|duality|zmain|zall, refer to scws documents.\n");
 	printf("  -n <num>         Set the batch number of each transaction or progress report\n");
 	printf("                   Default: %d\n", DEFAULT_COMMIT_NUMBER);
+	printf("  -P <num>         Import into sub-databases <DB>_<num> in parallel processes, (max: %d)\n",
+			MAX_IMPORT_SHARDS);
+	printf("                   Documents are dispatched by ID, merge them later with `-M'\n");
 	printf("  -s <stopfile>    Specify the path of stop words file\n");
 	printf("                   Default: none, refer to etc/stopwords.txt under install directory\n");
 	printf("  -t <stemmer>     Specify the stemmer language, (default: " DEFAULT_STEMMER ")\n");
@@ -152,9 +242,30 @@ static inline void batch_committed(int reopen)
 {
 	flag |= FLAG_COMMITTING;
 	try {
+		// mark synonyms revision, searchd flushes cached queries on changing
+		if (total_synonyms > saved_synonyms) {
+			char rev[32];
+			sprintf(rev, "%ld", strtol(syn_db->get_metadata(SYNONYMS_REV_KEY).data(), NULL, 10) + 1);
+			syn_db->set_metadata(SYNONYMS_REV_KEY, rev);
+			saved_synonyms = total_synonyms;
+		}
 		// FIXME: empty committion may cause XAPIAN internal error
 		if (reopen == 0 && (flag & FLAG_ARCHIVE) && (archive_delete > 0 || total_synonyms > 0)) {
-			archive.commit();
+			for (size_t i = 0; i < archives.size(); i++) {
+				archives[i].commit();
+			}
+		}
+		// save progress of sub/delta database in itself
+		// <ino>:<eff_size>:<proc_num>:<proc_off>:<proc_skip>, sub-database cleaned after finished
+		if (flag & (FLAG_SHARD | FLAG_DELTA)) {
+			if ((flag & FLAG_SHARD) && (flag & FLAG_READ_END) && job_num == 0) {
+				database.set_metadata(IMPORT_PROGRESS_KEY, "");
+			} else if (total > num_skip) {
+				char buf[128];
+				sprintf(buf, "%lu:%lld:%d:%lld:%d", (unsigned long) input_st.st_ino, (long long) hdr.eff_size,
+						total, (long long) ((flag & FLAG_RECORD) ? app_rec_off : 0), total - app_rec_total);
+				database.set_metadata(IMPORT_PROGRESS_KEY, buf);
+			}
 		}
 		if (flag & FLAG_TRANSACTION) {
 			database.commit_transaction();
@@ -165,12 +276,14 @@ static inline void batch_committed(int reopen)
 			database.commit();
 		}
 
-		// save new number of skip
-		if ((flag & FLAG_HEADER) && total > num_skip) {
-			off_t off = lseek(fd, 0, SEEK_CUR);
-			lseek(fd, sizeof(XS_CMD) + offsetof(struct xs_import_hdr, proc_num), SEEK_SET);
-			write(fd, &total, sizeof(total));
-			lseek(fd, off, SEEK_SET);
+		// save new number of skip, and the exact offset to resume for records
+		if ((flag & (FLAG_HEADER | FLAG_SHARD | FLAG_DELTA)) == FLAG_HEADER && total > num_skip) {
+			hdr.proc_num = total;
+			if (flag & FLAG_RECORD) {
+				hdr.proc_off = app_rec_off;
+				hdr.proc_skip = total - app_rec_total;
+			}
+			pwrite(fd, &hdr, sizeof(hdr), sizeof(XS_CMD));
 		}
 	} catch (const Xapian::Error &e) {
 		log_error("xapian exception (ERROR:%s)", e.get_msg().data());
@@ -179,6 +292,21 @@ static inline void batch_committed(int reopen)
 	flag ^= FLAG_COMMITTING;
 }
 
+/**
+ * Terminate all running shard processes
+ */
+static void shard_kill()
+{
+	int i;
+
+	flag |= FLAG_TERMINATED;
+	for (i = 0; i < shard_num; i++) {
+		if (shard_pids[i] > 0) {
+			kill(shard_pids[i], SIGTERM);
+		}
+	}
+}
+
 /**
  * Signal handlers should be compiled in C-style
  */
@@ -191,9 +319,21 @@ extern "C" {
  */
 int signal_term(int sig)
 {
+	if (flag & FLAG_WORKER) {
+		log_notice("caught signal[%d], import worker quit", sig);
+		return 0;
+	}
+	if (flag & (FLAG_MERGE | FLAG_ARCHIVE_MERGE | FLAG_OPTIMIZE)) {
+		log_alert("caught signal[%d], merging aborted", sig);
+		return -1;
+	}
 	log_alert("caught %ssignal[%d], try to save uncommitted data",
 			(sig == SIGTERM ? "" : "exceptional "), sig);
-	if (flag & FLAG_COMMITTING) {
+	if (shard_pids != NULL && shard_id < 0) {
+		// parent of shards: forward to children, wait for them to save data
+		shard_kill();
+		return sig == SIGTERM ? SIGNAL_TERM_LATER : -1;
+	} else if (flag & FLAG_COMMITTING) {
 		log_info("signal received during committing, waiting for the end");
 		flag |= FLAG_TERMINATED;
 		return SIGNAL_TERM_LATER;
@@ -216,7 +356,28 @@ int signal_term(int sig)
  */
 void signal_child(pid_t pid, int status)
 {
+	int i;
+
 	log_info("child process exit (PID:%d, STATUS:%d)", pid, status);
+	if (flag & FLAG_WORKER) {
+		char buf[32];
+
+		// report to indexd: -<pid> <status>
+		i = sprintf(buf, "-%d %d\n", pid, status);
+		write(STDIN_FILENO, buf, i);
+		return;
+	}
+	for (i = 0; i < shard_num && shard_pids != NULL; i++) {
+		if (shard_pids[i] == pid) {
+			shard_pids[i] = 0;
+			shard_left--;
+			if (status != 0) {
+				shard_failed++;
+				log_error("failed to import sub-database (SHARD:%d, PID:%d, STATUS:%d)", i, pid, status);
+			}
+			break;
+		}
+	}
 }
 
 /**
@@ -243,50 +404,54 @@ void signal_reload(int sig)
 #endif
 
 /**
- * Unicode range for CJK characters
- */
-#define	UNICODE_CJK(x)	(((x)>=0x2e80 && (x)<=0x2eff)				\
-    || ((x)>=0x3000 && (x)<=0xa71f)	|| ((x)>=0xac00 && (x)<=0xd7af)	\
-    || ((x)>=0xf900 && (x)<=0xfaff)	|| ((x)>=0xff00 && (x)<=0xffef)	\
-    || ((x)>=0x20000 && (x)<=0x2a6df) || ((x)>=0x2f800 && (x)<=0x2fa1f))
-
-/**
- * check requirement of stemmer
- * @param term
- * @return 
- */
-static inline bool should_stem(const string &term)
-{
-	const unsigned int SHOULD_STEM_MASK =
-			(1 << Xapian::Unicode::LOWERCASE_LETTER) |
-			(1 << Xapian::Unicode::TITLECASE_LETTER) |
-			(1 << Xapian::Unicode::MODIFIER_LETTER) |
-			(1 << Xapian::Unicode::OTHER_LETTER);
-	Xapian::Utf8Iterator u(term);
-	bool should = (!UNICODE_CJK(*u) && ((SHOULD_STEM_MASK >> Xapian::Unicode::get_category(*u)) & 1));
-	return should;
-}
-
-/**
- * read input data from fd(maybe <stdin>)
+ * Fill the read-ahead buffer to make sure len bytes available from rd_pos
  * @return integer Upon successful completion, returns zero. Otherwise, -1 is returned.
  */
-static int data_read(void *buf, int len)
+static int raw_fill(int len)
 {
 	int n, retry = 5;
-	bytes_read += len; // Add byte first, len maybe changed later
+
+	// move left data to the front, enlarge buffer for large command
+	if (rd_pos > 0) {
+		rd_len -= rd_pos;
+		rd_off += rd_pos;
+		if (rd_len > 0) {
+			memmove(rd_buf, rd_buf + rd_pos, rd_len);
+		}
+		rd_pos = 0;
+	}
+	if (len > rd_size || rd_buf == NULL) {
+		int size = rd_size > 0 ? rd_size : READ_BUFFER_SIZE;
+		char *buf;
+
+		while (size < len) {
+			size <<= 1;
+		}
+		if ((buf = (char *) realloc(rd_buf, size)) == NULL) {
+			log_error("failed to allocate memory for read buffer (SIZE:%d)", size);
+			return -1;
+		}
+		rd_buf = buf;
+		rd_size = size;
+	}
+
+	// read as much as possible (not beyond the limit)
 	do {
-		n = read(fd, buf, len);
-		if (n >= len) {
-			break;
+		n = rd_size - rd_len;
+		if (rd_limit > 0 && (rd_off + rd_len + n) > rd_limit) {
+			n = rd_limit > (rd_off + rd_len) ? (int) (rd_limit - rd_off - rd_len) : 0;
+		}
+		n = n > 0 ? read(fd, rd_buf + rd_len, n) : 0;
+		if (n > 0) {
+			rd_len += n;
+			if (rd_len >= len) {
+				break;
+			}
+			continue;
 		}
 		if (n == 0) {
-			log_notice("reach the end of file (EXPECTED:%d, ACTUAL:0)", len);
+			log_notice("reach the end of file (EXPECTED:%d, ACTUAL:%d)", len, rd_len);
 			return -1;
-		} else if (n > 0) {
-			buf = (char *) buf + n;
-			len -= n;
-			continue;
 		} else if ((errno != EINTR && errno != EAGAIN) || (flag & FLAG_TERMINATED)) {
 			retry = 0;
 			break;
@@ -298,7 +463,166 @@ static int data_read(void *buf, int len)
 		log_error("failed to read data (ERROR:%s)", strerror(errno));
 		return -1;
 	}
+	return 0;
+}
+
+/**
+ * Get pointer of raw data in read-ahead buffer, parsed in place without copying
+ * NOTE: the pointer is valid until next reading
+ * @return pointer to the data or NULL on failure
+ */
+static char *raw_ptr(int len)
+{
+	char *ptr;
+
+	if ((rd_len - rd_pos) < len && raw_fill(len) < 0) {
+		return NULL;
+	}
+	ptr = rd_buf + rd_pos;
+	rd_pos += len;
+	return ptr;
+}
+
+/**
+ * Get current offset of input data
+ */
+static inline off_t raw_tell()
+{
+	return rd_off + rd_pos;
+}
+
+/**
+ * Move to the offset of input file, drop the read-ahead buffer
+ */
+static void raw_seek(off_t off)
+{
+	lseek(fd, off, SEEK_SET);
+	rd_off = off;
+	rd_pos = rd_len = 0;
+}
+
+/**
+ * Scan forward from offset for the sync marker (magic) of next record
+ * Searched in the read-ahead buffer, refilled only when it runs out
+ * @return integer Upon successful completion, returns zero. Otherwise, -1 is returned.
+ */
+static int record_scan(off_t off)
+{
+	unsigned int magic = XS_IMPORT_REC_MAGIC;
+	char *ptr;
+
+	// data before rd_pos may be dropped by refilling
+	if (off < rd_off || off > (rd_off + rd_len)) {
+		raw_seek(off);
+	} else {
+		rd_pos = (int) (off - rd_off);
+	}
+	while (true) {
+		if ((rd_len - rd_pos) < (int) sizeof(magic) && raw_fill(sizeof(magic)) < 0) {
+			return -1;
+		}
+		ptr = (char *) memmem(rd_buf + rd_pos, rd_len - rd_pos, &magic, sizeof(magic));
+		if (ptr != NULL) {
+			rd_pos = ptr - rd_buf;
+			return 0;
+		}
+		// keep the tail which may be the beginning of magic
+		rd_pos = rd_len - (sizeof(magic) - 1);
+	}
+}
+
+/**
+ * Load next record of import file (version 1)
+ * Broken record is skipped by scanning forward to the next sync marker (magic)
+ * @return integer Upon successful completion, returns zero. Otherwise, -1 is returned.
+ */
+static int record_load()
+{
+	struct xs_import_rec rec;
+	off_t off = raw_tell(), end = rd_limit;
+	char *ptr;
+	bool broken = false;
+
+	// size of record is checked against the end of input before reading
+	if (end == 0) {
+		struct stat st;
+		end = fstat(fd, &st) == 0 ? st.st_size : 0;
+	}
+	while (true) {
+		if ((ptr = raw_ptr(sizeof(rec))) == NULL) {
+			return -1;
+		}
+		memcpy(&rec, ptr, sizeof(rec));
+		if (rec.magic == XS_IMPORT_REC_MAGIC && rec.size > 0 && rec.size <= MAX_RECORD_SIZE
+				&& (end == 0 || (off_t) rec.size <= (end - raw_tell()))) {
+			if ((rec_buf = raw_ptr(rec.size)) == NULL) {
+				return -1;
+			}
+			if (crc32c(0, rec_buf, rec.size) == rec.crc) {
+				break;
+			}
+		}
+		if (!broken) {
+			log_warning("broken record, scan for next record (OFF:%lld, SIZE:%u)", off, rec.size);
+			broken = true;
+		}
+		if (record_scan(off + 1) < 0) {
+			return -1;
+		}
+		off = raw_tell();
+	}
+	if (broken) {
+		log_notice("found next valid record (OFF:%lld, SIZE:%u)", off, rec.size);
+	}
+
+	rec_off = off;
+	rec_total = total_read;
+	rec_size = rec.size;
+	rec_pos = 0;
+	return 0;
+}
+
+/**
+ * Get pointer of input data from raw stream or records
+ * NOTE: the pointer is valid until next reading
+ * @return pointer to the data or NULL on failure
+ */
+static char *data_ptr(int len)
+{
+	char *ptr;
+
+	bytes_read += len;
+	if (!(flag & FLAG_RECORD)) {
+		return raw_ptr(len);
+	}
+	// commands never cross records
+	while (rec_pos == rec_size) {
+		if (record_load() < 0) {
+			return NULL;
+		}
+	}
+	if ((rec_size - rec_pos) < len) {
+		log_error("incomplete command in record (OFF:%lld, SIZE:%u, POS:%u, EXPECTED:%d)",
+				rec_off, rec_size, rec_pos, len);
+		return NULL;
+	}
+	ptr = rec_buf + rec_pos;
+	rec_pos += len;
+	return ptr;
+}
+
+/**
+ * read input data into buffer
+ * @return integer Upon successful completion, returns zero. Otherwise, -1 is returned.
+ */
+static int data_read(void *buf, int len)
+{
+	char *ptr = data_ptr(len);
 
+	if (ptr == NULL) {
+		return -1;
+	}
+	memcpy(buf, ptr, len);
 	return 0;
 }
 
@@ -319,7 +643,7 @@ static int header_read(struct xs_import_hdr *hdr)
 	}
 
 	if (cmd.cmd != CMD_IMPORT_HEADER) {
-		lseek(fd, 0, SEEK_SET);
+		raw_seek(0);
 	} else {
 		char *buf;
 		int size = XS_CMD_BUFSIZE(&cmd);
@@ -339,301 +663,1814 @@ static int header_read(struct xs_import_hdr *hdr)
 		memcpy(hdr, buf, size);
 		free(buf);
 
-		flag |= FLAG_HEADER;
-		log_notice("get import header (PROC_NUM:%d, EFF_SIZE:%lld)", hdr->proc_num, hdr->eff_size);
+		flag |= FLAG_HEADER;
+		log_notice("get import header (PROC_NUM:%d, EFF_SIZE:%lld)", hdr->proc_num, hdr->eff_size);
+	}
+
+	return 0;
+}
+
+/**
+ * Document job in the pipeline
+ * Read & applied in original order by main thread, built by worker threads
+ */
+struct doc_job
+{
+	XS_CMD cmd; // first command: CMD_INDEX_REQUEST|CMD_INDEX_REMOVE|CMD_INDEX_SYNONYMS
+	int rc; // fetch result type, decided on reading
+	bool failed; // failed to build the document
+	volatile bool done; // document built
+	char *term; // prefixed term of first command (id, synonym), point to tbuf or NULL
+	char *data; // commands of the document (CMD_INDEX_REQUEST only)
+	char *tbuf; // buffer of term
+	int size, rec_total;
+	int tsize, dsize; // allocated size of tbuf & data
+	off_t rec_off; // record where the document begins
+	Xapian::Document doc;
+	struct doc_job *next, *wnext;
+};
+
+/**
+ * Reusable buffers to build terms, owned by each thread
+ */
+struct term_buffer
+{
+	string term, word, stem, value;
+#ifdef HAVE_ZSTD
+	string zbuf;
+	ZSTD_CCtx *zctx;
+#endif
+};
+static struct term_buffer main_tb; // used if documents are built in main thread
+
+/**
+ * Get a document job, recycled one is preferred to reuse its buffers
+ * NOTE: jobs are allocated & freed in main thread only
+ */
+static struct doc_job *doc_job_alloc()
+{
+	struct doc_job *job;
+
+	if ((job = job_pool) != NULL) {
+		job_pool = job->next;
+		job->doc = Xapian::Document();
+	} else {
+		job = new struct doc_job;
+		job->tbuf = job->data = NULL;
+		job->tsize = job->dsize = 0;
+	}
+	job->failed = job->done = false;
+	job->term = NULL;
+	job->size = 0;
+	job->next = job->wnext = NULL;
+	return job;
+}
+
+/**
+ * Reserve the term buffer of job
+ * @return pointer of the buffer or NULL on failure
+ */
+static char *doc_job_tbuf(struct doc_job *job, int size)
+{
+	char *buf;
+
+	if (size > job->tsize) {
+		if ((buf = (char *) realloc(job->tbuf, size)) == NULL) {
+			return NULL;
+		}
+		job->tbuf = buf;
+		job->tsize = size;
+	}
+	return job->tbuf;
+}
+
+/**
+ * Destroy a document job
+ */
+static void doc_job_destroy(struct doc_job *job)
+{
+	if (job->tbuf != NULL) {
+		free(job->tbuf);
+	}
+	if (job->data != NULL) {
+		free(job->data);
+	}
+	delete job;
+}
+
+/**
+ * Free a document job, put it into pool for reusing
+ */
+static void doc_job_free(struct doc_job *job)
+{
+	// too large buffers are not kept
+	if (job->tsize > PIPE_JOB_BUFFER_KEEP) {
+		free(job->tbuf);
+		job->tbuf = NULL;
+		job->tsize = 0;
+	}
+	if (job->dsize > PIPE_JOB_BUFFER_KEEP) {
+		free(job->data);
+		job->data = NULL;
+		job->dsize = 0;
+	}
+	job->next = job_pool;
+	job_pool = job;
+}
+
+/**
+ * Hash of the document ID to select sub-database (FNV-1a)
+ */
+static inline int shard_of(const char *term)
+{
+	unsigned int h = 2166136261U;
+
+	while (*term != '\0') {
+		h ^= (unsigned char) *term++;
+		h *= 16777619U;
+	}
+	return (int) (h % shard_num);
+}
+
+/**
+ * Dispatch the document to sub-database
+ * Added documents are balanced in turn, updated are owned by ID hash and deleted from others,
+ * removing is applied to all, synonyms are saved in the first one only.
+ */
+static void shard_route(struct doc_job *job)
+{
+	switch (job->rc) {
+		case FETCH_ADD:
+			if ((total_read % shard_num) != shard_id) {
+				job->rc = FETCH_SHARD;
+			}
+			break;
+		case FETCH_UPDATE:
+			if (shard_of(job->term) != shard_id) {
+				job->rc = FETCH_DELETE;
+			}
+			break;
+		case FETCH_SYNONYMS:
+			if (shard_id != 0) {
+				job->rc = FETCH_SHARD;
+			}
+			break;
+	}
+}
+
+/**
+ * Scan ID terms of the rest documents in current batch, then restore the reading position
+ * Only the last update/delete of each document is applied, others are superseded
+ * by it (replace_document and delete_document both remove all documents of the term).
+ * NOTE: batch is aligned to the transaction, the superseding one is applied on resuming if terminated
+ */
+static void coalesce_scan()
+{
+	off_t off = raw_tell(), r_off = rec_off;
+	unsigned int r_size = rec_size, r_pos = rec_pos;
+	int r_total = rec_total, t_read = total_read, b_read = bytes_read, size;
+	char prefix[3], *buf;
+	XS_CMD cmd;
+
+	coalesce_map.clear();
+	coalesce_end = total_read + coalesce_batch - (total_read % coalesce_batch);
+	while (total_read < coalesce_end && data_read(&cmd, sizeof(cmd)) == 0) {
+		if (cmd.cmd == CMD_INDEX_EXDATA) {
+			continue;
+		}
+		if (cmd.cmd != CMD_IMPORT_HEADER && cmd.cmd != CMD_INDEX_REQUEST
+				&& cmd.cmd != CMD_INDEX_REMOVE && cmd.cmd != CMD_INDEX_SYNONYMS) {
+			break;
+		}
+		size = XS_CMD_BUFSIZE(&cmd);
+		if (size > 0 && (buf = data_ptr(size)) == NULL) {
+			break;
+		}
+		if (cmd.cmd == CMD_IMPORT_HEADER) {
+			continue;
+		}
+		if (size > 0 && ((cmd.cmd == CMD_INDEX_REMOVE && cmd.arg1 == CMD_INDEX_REMOVE_TERM)
+				|| (cmd.cmd == CMD_INDEX_REQUEST && cmd.arg1 == CMD_INDEX_REQUEST_UPDATE))) {
+			vno_to_prefix(cmd.arg2, prefix);
+			coalesce_map[string(prefix) + string(buf, size)] = total_read;
+		}
+		// skip commands of the document
+		if (cmd.cmd == CMD_INDEX_REQUEST) {
+			do {
+				if (data_read(&cmd, sizeof(cmd)) < 0) {
+					break;
+				}
+				size = XS_CMD_SIZE(&cmd) - sizeof(cmd);
+			} while ((size <= 0 || data_ptr(size) != NULL) && cmd.cmd != CMD_INDEX_SUBMIT);
+			if (cmd.cmd != CMD_INDEX_SUBMIT) {
+				break;
+			}
+		}
+		// same as doc_read(), dirty commands are not counted
+		if (total_read < num_skip || cmd.cmd == CMD_INDEX_SUBMIT || size > 0) {
+			total_read++;
+		}
+	}
+	log_debug("scan batch to coalesce (BEGIN:%d, END:%d, NUM_ID:%d)", t_read, total_read, coalesce_map.size());
+
+	// restore the position, reload current record if it is not finished
+	if ((flag & FLAG_RECORD) && r_pos < r_size) {
+		raw_seek(r_off);
+		record_load();
+		rec_pos = r_pos;
+	} else {
+		raw_seek(off);
+		rec_size = r_size;
+		rec_pos = r_pos;
+	}
+	rec_off = r_off;
+	rec_total = r_total;
+	total_read = t_read;
+	bytes_read = b_read;
+}
+
+/**
+ * Read commands of next document, dirty commands are skipped
+ * @return job pointer or NULL on abort
+ */
+static struct doc_job *doc_read()
+{
+	int size;
+	char prefix[3], *buf;
+	struct doc_job *job;
+	XS_CMD cmd;
+
+	if (coalesce_batch > 0 && total_read >= coalesce_end) {
+		coalesce_scan();
+	}
+	while (true) {
+		// read the first cmd header
+		if (data_read(&cmd, sizeof(cmd)) < 0) {
+			return NULL;
+		}
+
+		// check special CMD (CMD_INDEX_EXDATA) just skip, need not read the buffer
+		if (cmd.cmd == CMD_INDEX_EXDATA) {
+			continue;
+		}
+
+		size = XS_CMD_BUFSIZE(&cmd);
+		// just skip the import header
+		if (cmd.cmd == CMD_IMPORT_HEADER) {
+			struct xs_import_hdr dirty;
+
+			if ((buf = data_ptr(size)) == NULL) {
+				return NULL;
+			}
+			memset(&dirty, 0, sizeof(dirty));
+			memcpy(&dirty, buf, size > sizeof(dirty) ? sizeof(dirty) : size);
+			log_notice("dirty import header (PROC_NUM:%d, EFF_SIZE:%lld)", dirty.proc_num, dirty.eff_size);
+			continue;
+		}
+
+		// NOTE: check valid CMD
+		if (cmd.cmd != CMD_INDEX_REQUEST && cmd.cmd != CMD_INDEX_REMOVE && cmd.cmd != CMD_INDEX_SYNONYMS) {
+			log_notice("invalid command, abort (CMD:%d, BUFSIZE:%d)", cmd.cmd, XS_CMD_BUFSIZE(&cmd));
+			return NULL;
+		}
+
+		job = doc_job_alloc();
+		memcpy(&job->cmd, &cmd, sizeof(cmd));
+		job->rec_off = rec_off;
+		job->rec_total = rec_total;
+
+		// read cmd buffer? (try to get the vno from arg2)
+		if (size > 0) {
+			job->term = doc_job_tbuf(job, size + sizeof(prefix));
+			if (job->term == NULL) {
+				log_error("failed to allocate memory for command (CMD:%d, BUFSIZE:%d)", cmd.cmd, size);
+				doc_job_free(job);
+				return NULL;
+			}
+			vno_to_prefix(cmd.arg2, job->term);
+			buf = job->term + strlen(job->term);
+			if (data_read(buf, size) < 0) {
+				doc_job_free(job);
+				return NULL;
+			}
+			buf[size] = '\0';
+		}
+
+		// set rc by the number of read documents
+		job->rc = total_read < num_skip ? FETCH_SKIP : FETCH_DIRTY;
+		if (job->rc != FETCH_SKIP) {
+			if (cmd.cmd == CMD_INDEX_SYNONYMS && job->term != NULL) {
+				job->rc = FETCH_SYNONYMS;
+			} else if (cmd.cmd == CMD_INDEX_REMOVE && (cmd.arg1 & ~CMD_VALUE_FLAG_NUMERIC) == CMD_INDEX_REMOVE_RANGE) {
+				job->rc = job->term != NULL ? FETCH_PURGE : FETCH_DIRTY;
+			} else if (cmd.cmd == CMD_INDEX_REMOVE && job->term != NULL) {
+				job->rc = FETCH_DELETE;
+			} else if (cmd.cmd == CMD_INDEX_REQUEST && cmd.arg1 == CMD_INDEX_REQUEST_PATCH) {
+				job->rc = job->term != NULL ? FETCH_PATCH : FETCH_DIRTY;
+			} else if (cmd.cmd == CMD_INDEX_REQUEST) {
+				job->rc = (cmd.arg1 == CMD_INDEX_REQUEST_UPDATE && job->term != NULL
+						&& !(flag & FLAG_UNIQUE)) ? FETCH_UPDATE : FETCH_ADD;
+			}
+			if (flag & FLAG_SHARD) {
+				shard_route(job);
+			}
+			if ((job->rc == FETCH_UPDATE || job->rc == FETCH_DELETE || job->rc == FETCH_PATCH)
+					&& total_read < coalesce_end) {
+				coalesce_key.assign(job->term);
+				std::map<string, int>::iterator it = coalesce_map.find(coalesce_key);
+				if (it != coalesce_map.end() && it->second > total_read) {
+					job->rc = FETCH_COALESCE;
+				}
+			}
+		}
+
+		// copy the doc commands until submit
+		if (cmd.cmd == CMD_INDEX_REQUEST) {
+			do {
+				if (data_read(&cmd, sizeof(cmd)) < 0) {
+					doc_job_free(job);
+					return NULL;
+				}
+				size = XS_CMD_SIZE(&cmd);
+				// need not to build document of other sub-database or superseded
+				if (job->rc == FETCH_SHARD || job->rc == FETCH_DELETE || job->rc == FETCH_COALESCE) {
+					if (size > sizeof(cmd) && data_ptr(size - sizeof(cmd)) == NULL) {
+						doc_job_free(job);
+						return NULL;
+					}
+					continue;
+				}
+				if ((job->size + size) > job->dsize) {
+					int bsize = job->dsize > 0 ? job->dsize : 4096;
+					while (bsize < (job->size + size)) {
+						bsize <<= 1;
+					}
+					if ((buf = (char *) realloc(job->data, bsize)) == NULL) {
+						log_error("failed to allocate memory for doc command (CMD:%d, BUFSIZE:%d)", cmd.cmd, size);
+						doc_job_free(job);
+						return NULL;
+					}
+					job->data = buf;
+					job->dsize = bsize;
+				}
+				buf = job->data + job->size;
+				memcpy(buf, &cmd, sizeof(cmd));
+				if (size > sizeof(cmd) && data_read(buf + sizeof(cmd), size - sizeof(cmd)) < 0) {
+					doc_job_free(job);
+					return NULL;
+				}
+				job->size += size;
+			} while (cmd.cmd != CMD_INDEX_SUBMIT);
+		}
+
+		if (job->rc != FETCH_DIRTY) {
+			total_read++;
+			return job;
+		}
+		doc_job_free(job);
+	}
+}
+
+/**
+ * Get compressed document data if compression is enabled and it is smaller
+ * @param tb term buffers owned by the thread
+ * @param value
+ * @return compressed string in tb, or value itself
+ */
+static inline const string &doc_zdata(struct term_buffer &tb, const string &value)
+{
+#ifdef HAVE_ZSTD
+	if (zcdict != NULL && value.size() >= ZDATA_MIN_DATA && zdata_compress(&tb.zctx, zcdict, value, tb.zbuf)) {
+		return tb.zbuf;
+	}
+#endif
+	return value;
+}
+
+/**
+ * Build the document of CMD_INDEX_REQUEST, called in worker threads
+ * Terms are built in reusable buffers, memory of job is allocated only if it is not enough
+ * @param job
+ * @param tg term generator owned by the thread
+ * @param sc cached stemmer owned by the thread
+ * @param tb term buffers owned by the thread
+ */
+static void doc_build(struct doc_job *job, Xapian::TermGenerator &tg, CachedStem &sc, struct term_buffer &tb)
+{
+	int off, size;
+	char prefix[3], *buf;
+	XS_CMD cmd;
+
+	try {
+		tg.set_document(job->doc);
+		for (off = 0; off < job->size; off += sizeof(cmd) + size) {
+			memcpy(&cmd, job->data + off, sizeof(cmd));
+			buf = job->data + off + sizeof(cmd);
+			size = XS_CMD_BUFSIZE(&cmd);
+
+			// parse the cmd, assert(size==cmd.blen)?
+			switch (cmd.cmd) {
+				case CMD_DOC_TERM:
+					// arg1:wdf|flag, arg2:vno, blen:term_len, buf:term
+					if (job->rc == FETCH_SKIP)
+						break;
+					// empty term cause to increase termpos
+					if (size == 0) {
+						tg.increase_termpos();
+					} else {
+						prefix[0] = '\0';
+						if (CMD_INDEX_VALUENO(cmd) != XS_DATA_VNO) {
+							vno_to_prefix(CMD_INDEX_VALUENO(cmd), prefix);
+						}
+						tb.term.assign(prefix).append(buf, size);
+						if (!CMD_INDEX_WITHPOS(cmd)) {
+							job->doc.add_term(tb.term, CMD_INDEX_WEIGHT(cmd));
+						} else {
+							// adding with position information
+							job->doc.add_posting(tb.term, tg.get_termpos() + 1, CMD_INDEX_WEIGHT(cmd));
+							tg.increase_termpos(1);
+						}
+						// check stemmer
+						if (CMD_INDEX_CHECK_STEM(cmd)) {
+							tb.word.assign(buf, size);
+							if (sc.stem(tb.word, tb.stem)) {
+								tb.term.assign("Z").append(prefix).append(tb.stem);
+								job->doc.add_term(tb.term, CMD_INDEX_WEIGHT(cmd));
+							}
+						}
+					}
+					break;
+				case CMD_DOC_VALUE:
+					// arg1:flag(numeric=0x80), arg2:vno, blen:content_len, buf:content
+					if (job->rc != FETCH_SKIP && size > 0) {
+						tb.value.assign(buf, size);
+						if (CMD_INDEX_VALUENO(cmd) == XS_DATA_VNO) {
+							job->doc.set_data(doc_zdata(tb, tb.value));
+						} else {
+							if (!CMD_VALUE_NUMERIC(cmd)) {
+								job->doc.add_value(CMD_INDEX_VALUENO(cmd), tb.value);
+							} else {
+								job->doc.add_value(CMD_INDEX_VALUENO(cmd),
+										Xapian::sortable_serialise(strtod(tb.value.c_str(), NULL)));
+							}
+						}
+					}
+					// save first value as ID term for logging
+					if (job->term == NULL && size > 0 && (job->term = doc_job_tbuf(job, size + 1)) != NULL) {
+						memcpy(job->term, buf, size);
+						job->term[size] = '\0';
+					}
+					break;
+				case CMD_DOC_INDEX:
+					// arg1:weight|flag, arg2:vno, blen:content_len, buf:content
+					// weight: 0~63, flag_64:withpos, flag_128:save value also
+					if (job->rc != FETCH_SKIP && size > 0) {
+						// index text
+						vno_to_prefix(CMD_INDEX_VALUENO(cmd), prefix);
+						if (!CMD_INDEX_WITHPOS(cmd)) {
+							tg.index_text_without_positions(Xapian::Utf8Iterator(buf, size),
+									CMD_INDEX_WEIGHT(cmd), prefix);
+						} else {
+							tg.index_text(Xapian::Utf8Iterator(buf, size), CMD_INDEX_WEIGHT(cmd), prefix);
+							tg.increase_termpos();
+						}
+						// add value (numeric not supportted)
+						if (CMD_INDEX_SAVE_VALUE(cmd)) {
+							tb.value.assign(buf, size);
+							if (CMD_INDEX_VALUENO(cmd) == XS_DATA_VNO) {
+								job->doc.set_data(doc_zdata(tb, tb.value));
+							} else {
+								job->doc.add_value(CMD_INDEX_VALUENO(cmd), tb.value);
+							}
+						}
+					}
+					break;
+			}
+		}
+	} catch (const Xapian::Error &e) {
+		log_error("xapian exception (ERROR:%s)", e.get_msg().data());
+		job->failed = true;
+	}
+}
+
+/**
+ * Patch values of documents indexed by the ID term, other commands are ignored
+ * Document is replaced by the loaded one, so postings are not rewritten.
+ * Empty value is removed from the document.
+ * @return number of patched documents
+ */
+static int doc_patch(Xapian::WritableDatabase &db, struct doc_job *job)
+{
+	int off, size;
+	char *buf;
+	XS_CMD cmd;
+	std::vector<Xapian::docid> ids;
+	Xapian::PostingIterator p;
+
+	for (p = db.postlist_begin(job->term); p != db.postlist_end(job->term); p++) {
+		ids.push_back(*p);
+	}
+	for (size_t i = 0; i < ids.size(); i++) {
+		Xapian::Document doc = db.get_document(ids[i]);
+
+		for (off = 0; off < job->size; off += sizeof(cmd) + size) {
+			memcpy(&cmd, job->data + off, sizeof(cmd));
+			buf = job->data + off + sizeof(cmd);
+			size = XS_CMD_BUFSIZE(&cmd);
+			if (cmd.cmd != CMD_DOC_VALUE) {
+				continue;
+			}
+			main_tb.value.assign(buf, size);
+			if (CMD_INDEX_VALUENO(cmd) == XS_DATA_VNO) {
+				doc.set_data(doc_zdata(main_tb, main_tb.value));
+			} else if (size == 0) {
+				doc.remove_value(CMD_INDEX_VALUENO(cmd));
+			} else if (!CMD_VALUE_NUMERIC(cmd)) {
+				doc.add_value(CMD_INDEX_VALUENO(cmd), main_tb.value);
+			} else {
+				doc.add_value(CMD_INDEX_VALUENO(cmd),
+						Xapian::sortable_serialise(strtod(main_tb.value.c_str(), NULL)));
+			}
+		}
+		db.replace_document(ids[i], doc);
+	}
+	return (int) ids.size();
+}
+
+/**
+ * Remove documents matched by the query in batches
+ * Removed documents are invisible to the next batch though they are not committed.
+ * @return number of removed documents
+ */
+static int doc_purge(Xapian::WritableDatabase &db, const Xapian::Query &q)
+{
+	int num = 0;
+	Xapian::Enquire eq(db);
+	Xapian::MSet ms;
+	Xapian::MSetIterator m;
+
+	eq.set_query(q);
+	eq.set_weighting_scheme(Xapian::BoolWeight());
+	eq.set_docid_order(Xapian::Enquire::ASCENDING);
+	do {
+		ms = eq.get_mset(0, PURGE_BATCH_SIZE);
+		for (m = ms.begin(); m != ms.end(); m++) {
+			db.delete_document(*m);
+			num++;
+		}
+	} while (ms.size() == PURGE_BATCH_SIZE);
+	return num;
+}
+
+/**
+ * Get query of range removing, buffer of job: <prefix><from><to>
+ * @return query or MatchNothing if both of from & to are empty
+ */
+static Xapian::Query purge_query(struct doc_job *job)
+{
+	XS_CMD &cmd = job->cmd;
+	char prefix[3];
+	string from, to;
+
+	vno_to_prefix(cmd.arg2, prefix);
+	from.assign(job->term + strlen(prefix), cmd.blen);
+	to.assign(job->term + strlen(prefix) + cmd.blen, cmd.blen1);
+	if (CMD_VALUE_NUMERIC(cmd)) {
+		from = from.empty() ? from : Xapian::sortable_serialise(strtod(from.data(), NULL));
+		to = to.empty() ? to : Xapian::sortable_serialise(strtod(to.data(), NULL));
+	}
+	if (from.empty() && to.empty()) {
+		return Xapian::Query::MatchNothing;
+	} else if (from.empty()) {
+		return Xapian::Query(Xapian::Query::OP_VALUE_LE, cmd.arg2, to);
+	} else if (to.empty()) {
+		return Xapian::Query(Xapian::Query::OP_VALUE_GE, cmd.arg2, from);
+	}
+	return Xapian::Query(Xapian::Query::OP_VALUE_RANGE, cmd.arg2, from, to);
+}
+
+/**
+ * Remove the document from all segments of archive db
+ * @return bool true if the document found in archive
+ */
+static bool archive_remove(const char *term)
+{
+	bool found = false;
+
+	for (size_t i = 0; i < archives.size(); i++) {
+		if (archives[i].term_exists(term)) {
+			archives[i].delete_document(term);
+			found = true;
+		}
+	}
+	return found;
+}
+
+/**
+ * Remove synonym (clear all if syn_term is empty), segments of archive db are all checked
+ * New synonyms are added into syn_db, but segments moved from default db may have some.
+ */
+static void synonym_remove(const string &org_term, const string &syn_term)
+{
+	size_t i, num = archives.size() > 0 ? archives.size() : 1;
+	Xapian::WritableDatabase *db;
+
+	for (i = 0; i < num; i++) {
+		db = archives.size() > 0 ? &archives[i] : syn_db;
+		if (syn_term.size() > 0) {
+			db->remove_synonym(org_term, syn_term);
+		} else {
+			db->clear_synonyms(org_term);
+		}
+	}
+}
+
+/**
+ * Apply the document into database in original order (main thread)
+ * @return integer fetch result type
+ */
+static int doc_apply(struct doc_job *job)
+{
+	int rc = job->rc;
+	char *term = job->term;
+	XS_CMD &cmd = job->cmd;
+
+	// belongs to other sub-database
+	if (rc == FETCH_SHARD) {
+		return rc;
+	}
+	if (rc == FETCH_COALESCE) {
+		total_coalesce++;
+		log_info("~skip superseded update/remove (ID:%s, TOTAL_COALESCE:%d)", term, total_coalesce);
+		return rc;
+	}
+
+	// add try block for debugging
+	__TRY_FETCH_BEGIN__
+
+			// TODO: check synonyms cmd
+	if (cmd.cmd == CMD_INDEX_SYNONYMS && term != NULL) {
+		if (rc == FETCH_SKIP) {
+			log_info("~skip to add/del synonyms (TERM:%.*s, SKIP_LEFT:%d)",
+					cmd.blen, term + 1, num_skip - total - 1);
+		} else {
+			string org_term = Xapian::Unicode::tolower(string(term + 1, cmd.blen));
+			string syn_term = Xapian::Unicode::tolower(string(term + cmd.blen + 1, cmd.blen1));
+#ifdef HAVE_SYNONYMS_STEM
+			string org_stem, syn_stem;
+			if (should_stem(org_term) && org_term.find_first_of(' ') == string::npos) {
+				org_stem = "Z" + stemmer(org_term);
+				syn_stem = (syn_term.size() > 0 && should_stem(syn_term)) ? "Z" + stemmer(syn_term) : syn_term;
+			}
+#endif
+			if (cmd.arg1 == CMD_INDEX_SYNONYMS_ADD) {
+				// add
+				syn_db->add_synonym(org_term, syn_term);
+				log_info("+add synonym term (TERM:%s, SYNONYM:%s)", org_term.data(), syn_term.data());
+#ifdef HAVE_SYNONYMS_STEM
+				// stem
+				if (org_stem.size() > 0) {
+					syn_db->add_synonym(org_stem, syn_stem);
+					log_info("+add stemmed synonym (TERM:%s, SYNONYM:%s)", org_stem.data(), syn_stem.data());
+				}
+#endif
+			} else {
+				// del
+				if (syn_term.size() > 0) {
+					// del synonym word
+					synonym_remove(org_term, syn_term);
+					log_info("+remove synonym term (TERM:%s, SYNONYM:%s)", org_term.data(), syn_term.data());
+#ifdef HAVE_SYNONYMS_STEM
+					// stemmed
+					if (org_stem.size() > 0) {
+						synonym_remove(org_stem, syn_stem);
+						log_info("+remove stemmed synonym (TERM:%s, SYNONYM:%s)", org_stem.data(), syn_stem.data());
+					}
+#endif
+				} else {
+					// clear all synonyms
+					synonym_remove(org_term, syn_term);
+					log_info("#clear synonym terms (TERM:%s)", org_term.data());
+#ifdef HAVE_SYNONYMS_STEM
+					// stemmed
+					if (org_stem.size() > 0) {
+						synonym_remove(org_stem, string());
+						log_info("#clear stemmed synonyms (TERM:%s)", org_stem.data());
+					}
+#endif
+				}
+			}
+			total_synonyms++;
+		}
+		return rc;
+	}
+
+	// remove by range of value, both default db and segments of archive db
+	if (rc == FETCH_PURGE || (rc == FETCH_SKIP && cmd.cmd == CMD_INDEX_REMOVE
+			&& (cmd.arg1 & ~CMD_VALUE_FLAG_NUMERIC) == CMD_INDEX_REMOVE_RANGE)) {
+		if (rc == FETCH_SKIP) {
+			log_info("~skip to remove documents by range (VNO:%d, SKIP_LEFT:%d)", cmd.arg2, num_skip - total - 1);
+		} else {
+			Xapian::Query q = purge_query(job);
+			int num = doc_purge(database, q), num2 = 0;
+
+			for (size_t i = 0; (flag & FLAG_ARCHIVE) && i < archives.size(); i++) {
+				num2 += doc_purge(archives[i], q);
+			}
+			total_delete += num;
+			archive_delete += num2;
+			log_info("-remove documents by range (VNO:%d, FROM:%.*s, TO:%.*s, NUM:%d, ARCHIVE_NUM:%d)",
+					cmd.arg2, cmd.blen, term + strlen(term) - cmd.blen - cmd.blen1,
+					cmd.blen1, term + strlen(term) - cmd.blen1, num, num2);
+		}
+		return rc;
+	}
+
+	// check the remove cmd (or updated document owned by other sub-database)
+	if ((cmd.cmd == CMD_INDEX_REMOVE || rc == FETCH_DELETE) && term != NULL) {
+		if (rc == FETCH_SKIP) {
+			log_info("~skip to remove document (ID:%s, SKIP_LEFT:%d)", term, num_skip - total - 1);
+		} else {
+			if ((flag & FLAG_ARCHIVE) && archive_remove(term)) {
+				archive_delete++;
+				log_info("--remove the document from archive (ID:%s, ARCHIVE_DELETE:%d)", term, archive_delete);
+			} else {
+				total_delete++;
+				database.delete_document(term);
+				log_info("-remove the document (ID:%s, TOTAL_DELETE:%d)", term, total_delete);
+			}
+			if (flag & FLAG_DELTA) {
+				database.set_metadata(SHADOW_KEY_PREFIX + string(term), "1");
+			}
+		}
+		return rc;
+	}
+
+	// other case, only CMD_INDEX_REQUEST was accepted
+	if (cmd.cmd != CMD_INDEX_REQUEST) {
+		return rc;
+	}
+
+	// patch values, the document may be in segments of archive db
+	if (rc == FETCH_PATCH) {
+		int num = doc_patch(database, job);
+
+		for (size_t i = 0; num == 0 && (flag & FLAG_ARCHIVE) && i < archives.size(); i++) {
+			num = doc_patch(archives[i], job);
+		}
+		if (num == 0) {
+			log_info("~skip to patch the document not found (ID:%s)", term);
+		} else {
+			total_patch++;
+			log_info("!patch the document (ID:%s, NUM:%d, TOTAL_PATCH:%d)", term, num, total_patch);
+		}
+		return rc;
+	}
+
+	// submit it
+	if (job->failed) {
+		log_notice("skip to add/update the broken document (ID:%s)", term == NULL ? "NULL" : term);
+	} else if (rc == FETCH_ADD) {
+		total_add++;
+		database.add_document(job->doc);
+		log_info("+add the document (ID:%s, TOTAL_ADD:%d)", term == NULL ? "NULL" : term, total_add);
+	} else if (rc == FETCH_UPDATE) {
+		if ((flag & FLAG_ARCHIVE) && archive_remove(term)) {
+			archive_delete++;
+			log_info("--remove the document from archive (ID:%s, ARCHIVE_DELETE:%d)", term, archive_delete);
+		}
+		total_update++;
+		database.replace_document(term, job->doc);
+		if (flag & FLAG_DELTA) {
+			database.set_metadata(SHADOW_KEY_PREFIX + string(term), "1");
+		}
+		log_info("!update the document (ID:%s, TOTAL_UPDATE:%d)", term == NULL ? "NULL" : term, total_update);
+	} else {
+		log_info("~skip to update/add the document (ID:%s, SKIP_LEFT:%d)",
+				term == NULL ? "NULL" : term, num_skip - total - 1);
+	}
+	__TRY_FETCH_END__;
+
+	return rc;
+}
+
+/**
+ * Worker thread to build documents
+ */
+static void *doc_worker(void *arg)
+{
+	struct doc_job *job;
+	struct term_buffer tb;
+	Xapian::TermGenerator tg;
+	CachedStem *sc = new CachedStem(stem_lang);
+	Xapian::Stem st(sc); // sc is owned by st
+	sigset_t set;
+
+#ifdef HAVE_ZSTD
+	tb.zctx = NULL;
+#endif
+	// signals are handled in main thread
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	tg.set_stemmer(st);
+	tg.set_stopper(&stopper);
+	tg.set_scws(arg);
+
+	pthread_mutex_lock(&job_mutex);
+	while (true) {
+		while (work_head == NULL && !pipe_stopped) {
+			pthread_cond_wait(&work_cond, &job_mutex);
+		}
+		if ((job = work_head) == NULL) {
+			break;
+		}
+		if ((work_head = job->wnext) == NULL) {
+			work_tail = NULL;
+		}
+		pthread_mutex_unlock(&job_mutex);
+
+		doc_build(job, tg, *sc, tb);
+
+		pthread_mutex_lock(&job_mutex);
+		job->done = true;
+		pthread_cond_broadcast(&done_cond);
+	}
+	stem_hits += sc->hits;
+	stem_lookups += sc->lookups;
+	pthread_mutex_unlock(&job_mutex);
+#ifdef HAVE_ZSTD
+	ZSTD_freeCCtx(tb.zctx);
+#endif
+	return NULL;
+}
+
+/**
+ * Start worker threads of the pipeline
+ * @return number of started threads
+ */
+static int pipe_start(int num)
+{
+	int i;
+
+	pthread_mutex_init(&job_mutex, NULL);
+	pthread_cond_init(&work_cond, NULL);
+	pthread_cond_init(&done_cond, NULL);
+	if (num > 0 && (workers = (pthread_t *) malloc(sizeof(pthread_t) * num)) != NULL) {
+		for (i = 0; i < num; i++) {
+			// scws is forked in main thread, dictionaries are shared
+			scws_t s = scws_fork((scws_t) indexer.get_scws());
+			if (pthread_create(&workers[i], NULL, doc_worker, s) != 0) {
+				log_error("failed to create worker thread (ERROR:%s)", strerror(errno));
+				scws_free(s);
+				break;
+			}
+		}
+		num_workers = i;
+	}
+	job_max = num_workers > 0 ? num_workers * PIPE_JOBS_PER_THREAD : 1;
+	return num_workers;
+}
+
+/**
+ * Stop worker threads, free the pending jobs
+ */
+static void pipe_stop()
+{
+	struct doc_job *job;
+	int i;
+
+	pthread_mutex_lock(&job_mutex);
+	pipe_stopped = 1;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&job_mutex);
+	for (i = 0; i < num_workers; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	if (workers != NULL) {
+		free(workers);
+	}
+	while ((job = job_head) != NULL) {
+		job_head = job->next;
+		doc_job_destroy(job);
+	}
+	while ((job = job_pool) != NULL) {
+		job_pool = job->next;
+		doc_job_destroy(job);
+	}
+	pthread_mutex_destroy(&job_mutex);
+	pthread_cond_destroy(&work_cond);
+	pthread_cond_destroy(&done_cond);
+}
+
+/**
+ * Push a job into pipeline, documents are built by workers or at once
+ */
+static void pipe_push(struct doc_job *job)
+{
+	bool build = job->cmd.cmd == CMD_INDEX_REQUEST && job->rc != FETCH_DELETE
+			&& job->rc != FETCH_SHARD && job->rc != FETCH_COALESCE && job->rc != FETCH_PATCH;
+
+	pthread_mutex_lock(&job_mutex);
+	if (job_tail == NULL) {
+		job_head = job_tail = job;
+	} else {
+		job_tail->next = job;
+		job_tail = job;
+	}
+	job_num++;
+	if (!build) {
+		job->done = true;
+	} else if (num_workers > 0) {
+		if (work_tail == NULL) {
+			work_head = work_tail = job;
+		} else {
+			work_tail->wnext = job;
+			work_tail = job;
+		}
+		pthread_cond_signal(&work_cond);
+	}
+	pthread_mutex_unlock(&job_mutex);
+
+	// build it in main thread
+	if (build && num_workers == 0) {
+		doc_build(job, indexer, *stem_cache, main_tb);
+		job->done = true;
+	}
+}
+
+/**
+ * Pop the first job in original order, wait until it is built
+ * @return job pointer or NULL if pipeline empty
+ */
+static struct doc_job *pipe_pop()
+{
+	struct doc_job *job;
+
+	pthread_mutex_lock(&job_mutex);
+	if ((job = job_head) != NULL) {
+		while (!job->done) {
+			pthread_cond_wait(&done_cond, &job_mutex);
+		}
+		if ((job_head = job->next) == NULL) {
+			job_tail = NULL;
+		}
+		job_num--;
+	}
+	pthread_mutex_unlock(&job_mutex);
+	return job;
+}
+
+/**
+ * Fork child processes to import sub-databases in parallel, named as <db>_<num>
+ * Each child reads the whole input file by itself, parent waits for all of them.
+ * @param fpath path of input file
+ * @param db_path path of database, changed to sub-database in child
+ * @return shard id in child, -1 in parent
+ */
+static int shard_start(const char *fpath, char **db_path)
+{
+	static char shard_path[256];
+	off_t off = raw_tell();
+	pid_t pid;
+	int i;
+
+	if ((shard_pids = (pid_t *) calloc(shard_num, sizeof(pid_t))) == NULL) {
+		log_error("failed to allocate memory for shards (NUM:%d)", shard_num);
+		flag |= FLAG_TERMINATED;
+		return -1;
+	}
+	for (i = 0; i < shard_num && !(flag & FLAG_TERMINATED); i++) {
+		if ((pid = fork()) == 0) {
+			// lock is held by parent, never unlock it here
+			free(shard_pids);
+			shard_pids = NULL;
+			close(fd);
+			if ((fd = open(fpath, O_RDONLY)) < 0) {
+				log_error("failed to open the input file (FILE:%s, ERROR:%s)", fpath, strerror(errno));
+				exit(-1);
+			}
+			raw_seek(off);
+			snprintf(shard_path, sizeof(shard_path), "%s_%d", *db_path, i);
+			*db_path = shard_path;
+			shard_id = i;
+			flag |= FLAG_SHARD;
+			return i;
+		} else if (pid < 0) {
+			log_error("failed to fork shard process (SHARD:%d, ERROR:%s)", i, strerror(errno));
+			shard_failed++;
+			break;
+		}
+		shard_pids[i] = pid;
+		shard_left++;
+		log_info("spawn a shard process (SHARD:%d, PID:%d)", i, pid);
+	}
+
+	// wait for all children, SIGCHLD interrupts the sleeping
+	if (shard_failed > 0) {
+		shard_kill();
+	}
+	while (shard_left > 0) {
+		sleep(1);
+	}
+	if (shard_failed > 0) {
+		flag |= FLAG_TERMINATED;
+	}
+	log_alert("%s to import sub-databases (NUM:%d, FAILED:%d)",
+			shard_failed > 0 ? "failed" : "finished", shard_num, shard_failed);
+	free(shard_pids);
+	shard_pids = NULL;
+	return -1;
+}
+
+/**
+ * Remove a database directory, table files are never placed in sub-directories
+ * @return 0 on success or not exists, -1 on error
+ */
+static int remove_db(const string &path)
+{
+	DIR *dirp;
+	struct dirent *de;
+	int rc = 0;
+
+	if ((dirp = opendir(path.data())) == NULL) {
+		return errno == ENOENT ? 0 : -1;
+	}
+	while ((de = readdir(dirp)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+			continue;
+		}
+		if (unlink((path + "/" + de->d_name).data()) != 0) {
+			rc = -1;
+		}
+	}
+	closedir(dirp);
+	if (rc != 0 || rmdir(path.data()) != 0) {
+		log_error("failed to remove database (PATH:%s, ERROR:%s)", path.data(), strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Merge sub-databases <db>_<num> into <db> by compaction, then remove them
+ * @return 0 on success, -1 on error
+ */
+static int shard_merge(const char *db_path)
+{
+	string tmp = string(db_path) + "_m", old = string(db_path) + ".old";
+	char path[256];
+	struct stat st;
+	int i;
+
+	// 1. merge: db + db_0 + db_1 ... -> db_m
+	if (remove_db(tmp) != 0) {
+		return -1;
+	}
+	try {
+		Xapian::Database src;
+
+		if (!stat(db_path, &st) && S_ISDIR(st.st_mode)) {
+			src.add_database(Xapian::Database(db_path));
+		}
+		for (i = 0; i < MAX_IMPORT_SHARDS; i++) {
+			snprintf(path, sizeof(path), "%s_%d", db_path, i);
+			if (stat(path, &st) || !S_ISDIR(st.st_mode)) {
+				break;
+			}
+			src.add_database(Xapian::Database(path));
+		}
+		if (i == 0) {
+			log_notice("no sub-database to merge (DB:%s)", db_path);
+			return 0;
+		}
+		log_notice("merge sub-databases (DB:%s, NUM:%d, TOTAL:%d)", db_path, i, src.get_doccount());
+		src.compact(tmp);
+	} catch (const Xapian::Error &e) {
+		log_error("failed to merge sub-databases (DB:%s, ERROR:%s)", db_path, e.get_msg().data());
+		remove_db(tmp);
+		return -1;
+	}
+
+	// 2. rename: db -> db.old, db_m -> db
+	if (remove_db(old) != 0) {
+		remove_db(tmp);
+		return -1;
+	}
+	if (rename(db_path, old.data()) != 0 && errno != ENOENT) {
+		log_error("failed to rename database (PATH:%s, ERROR:%s)", db_path, strerror(errno));
+		remove_db(tmp);
+		return -1;
+	}
+	if (rename(tmp.data(), db_path) != 0) {
+		log_error("failed to rename merged database (PATH:%s, ERROR:%s)", tmp.data(), strerror(errno));
+		rename(old.data(), db_path);
+		remove_db(tmp);
+		return -1;
+	}
+
+	// 3. remove: db.old db_0 db_1 ...
+	// NOTE: merged already, never report failure to avoid merging them again, left ones are cleaned on next rebuilding
+	remove_db(old);
+	while (i--) {
+		snprintf(path, sizeof(path), "%s_%d", db_path, i);
+		remove_db(path);
+	}
+	return 0;
+}
+
+/**
+ * Lower CPU & I/O priority of current process, for merging/optimizing in background
+ */
+static void background_priority()
+{
+	setpriority(PRIO_PROCESS, 0, BACKGROUND_NICE);
+#ifdef SYS_ioprio_set
+	syscall(SYS_ioprio_set, 1, 0, 3 << 13); // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE
+#endif
+}
+
+/**
+ * Get directory of the database path (with tailing slash)
+ */
+static string db_dir(const char *db_path)
+{
+	const char *ptr = strrchr(db_path, '/');
+
+	return ptr == NULL ? string() : string(db_path, ptr - db_path + 1);
+}
+
+/**
+ * Get path of archive segment
+ */
+static string archive_path(const string &dir, int seq)
+{
+	char buf[64];
+
+	sprintf(buf, ARCHIVE_DB_NAME "%d", seq);
+	return dir + buf;
+}
+
+/**
+ * Get sequence number of archive segment by file name
+ * @return sequence number, -1 if not a segment
+ */
+static int archive_seq_of(const char *name)
+{
+	char *end;
+	long seq;
+
+	if (strncmp(name, ARCHIVE_DB_NAME, sizeof(ARCHIVE_DB_NAME) - 1)) {
+		return -1;
+	}
+	name += sizeof(ARCHIVE_DB_NAME) - 1;
+	if (*name < '0' || *name > '9') {
+		return -1;
+	}
+	seq = strtol(name, &end, 10);
+	return *end == '\0' ? (int) seq : -1;
+}
+
+/**
+ * Write the stub file of archive segments, replaced atomically by renaming
+ * Searchd opens the stub file as combined database of all segments
+ * @return 0 on success, -1 on failure
+ */
+static int archive_publish(const string &dir, const std::vector<int> &segs)
+{
+	string path = dir + ARCHIVE_DB_NAME, tmp = path + ".tmp", buf;
+	char line[64];
+	int sfd;
+	size_t i;
+
+	if (segs.size() == 0) {
+		log_notice("remove archive stub without segment (PATH:%s)", path.data());
+		return (unlink(path.data()) == 0 || errno == ENOENT) ? 0 : -1;
+	}
+	for (i = 0; i < segs.size(); i++) {
+		sprintf(line, "auto " ARCHIVE_DB_NAME "%d\n", segs[i]);
+		buf += line;
+	}
+	if ((sfd = open(tmp.data(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0
+			|| write(sfd, buf.data(), buf.size()) != (ssize_t) buf.size() || fsync(sfd) != 0) {
+		log_error("failed to write archive stub (PATH:%s, ERROR:%s)", tmp.data(), strerror(errno));
+		if (sfd >= 0) {
+			close(sfd);
+		}
+		return -1;
+	}
+	close(sfd);
+	if (rename(tmp.data(), path.data()) != 0) {
+		log_error("failed to publish archive stub (PATH:%s, ERROR:%s)", path.data(), strerror(errno));
+		return -1;
+	}
+	log_notice("publish archive segments (PATH:%s, NUM:%d)", path.data(), (int) segs.size());
+	return 0;
+}
+
+/**
+ * Adopt unlisted segment left by interrupted flushing or merging
+ * Merged segment replaces its sources (ARCHIVE_MERGED_KEY), otherwise it is appended
+ */
+static void archive_adopt(const string &dir, std::vector<int> &segs, int seq)
+{
+	std::vector<int>::iterator it, pos = segs.end();
+	string from;
+	char *ptr;
+
+	try {
+		from = Xapian::Database(archive_path(dir, seq)).get_metadata(ARCHIVE_MERGED_KEY);
+	} catch (const Xapian::Error &e) {
+		log_error("failed to open unlisted segment (SEQ:%d, ERROR:%s)", seq, e.get_msg().data());
+		return;
+	}
+	for (ptr = (char *) from.data(); *ptr != '\0'; ptr++) {
+		if ((it = std::find(segs.begin(), segs.end(), (int) strtol(ptr, &ptr, 10))) != segs.end()) {
+			if (pos == segs.end()) {
+				pos = it;
+			} else {
+				segs.erase(it);
+			}
+		}
+		if (*ptr == '\0') {
+			break;
+		}
+	}
+	log_notice("adopt unlisted archive segment (SEQ:%d, FROM:%s)", seq, from.data());
+	if (pos == segs.end()) {
+		segs.push_back(seq);
+	} else {
+		*pos = seq;
+	}
+}
+
+/**
+ * Load segments of archive db listed in stub file
+ * Old archive directory is converted into the first segment, unlisted segment newer than listed is adopted.
+ * NOTE: write lock of default db is required
+ * @param dir directory of default db
+ * @param segs
+ * @return number of segments, -1 on failure
+ */
+static int archive_load(const string &dir, std::vector<int> &segs)
+{
+	string path = dir + ARCHIVE_DB_NAME;
+	std::vector<int> news;
+	struct stat st;
+	struct dirent *de;
+	DIR *dirp;
+	FILE *fp;
+	char line[256];
+	int seq, max = -1;
+	size_t i;
+
+	segs.clear();
+	archive_seq = 0;
+	if (stat(path.data(), &st) == 0 && S_ISDIR(st.st_mode)) {
+		log_notice("convert old archive into segment (PATH:%s)", path.data());
+		if (rename(path.data(), archive_path(dir, 0).data()) != 0) {
+			log_error("failed to convert old archive (PATH:%s, ERROR:%s)", path.data(), strerror(errno));
+			return -1;
+		}
+		segs.push_back(0);
+		archive_seq = 1;
+		return archive_publish(dir, segs) == 0 ? 1 : -1;
+	}
+	if ((fp = fopen(path.data(), "r")) != NULL) {
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			if (sscanf(line, "auto " ARCHIVE_DB_NAME "%d", &seq) == 1 && seq >= 0) {
+				segs.push_back(seq);
+				max = seq > max ? seq : max;
+			}
+		}
+		fclose(fp);
+	}
+
+	// check unlisted segments
+	if ((dirp = opendir(dir.size() > 0 ? dir.data() : ".")) == NULL) {
+		return segs.size();
+	}
+	while ((de = readdir(dirp)) != NULL) {
+		if ((seq = archive_seq_of(de->d_name)) >= 0) {
+			if (seq > max) {
+				news.push_back(seq);
+			}
+			if (seq >= archive_seq) {
+				archive_seq = seq + 1;
+			}
+		}
+	}
+	closedir(dirp);
+	if (news.size() > 0) {
+		std::sort(news.begin(), news.end());
+		for (i = 0; i < news.size(); i++) {
+			archive_adopt(dir, segs, news[i]);
+		}
+		archive_publish(dir, segs);
+	}
+	return segs.size();
+}
+
+/**
+ * Remove merged segments (unlisted), if the stub file was published ARCHIVE_RETIRE_TIME ago
+ * Searchd reopens the stub file after failing to reopen the removed segments
+ */
+static void archive_retire(const string &dir, const std::vector<int> &segs)
+{
+	string path = dir + ARCHIVE_DB_NAME;
+	struct stat st;
+	struct dirent *de;
+	DIR *dirp;
+	int seq;
+
+	if (stat(path.data(), &st) != 0 || (time(NULL) - st.st_mtime) < ARCHIVE_RETIRE_TIME
+			|| (dirp = opendir(dir.size() > 0 ? dir.data() : ".")) == NULL) {
+		return;
+	}
+	while ((de = readdir(dirp)) != NULL) {
+		if ((seq = archive_seq_of(de->d_name)) >= 0 && std::find(segs.begin(), segs.end(), seq) == segs.end()) {
+			path = "/bin/rm -rf " + archive_path(dir, seq);
+			log_info("%s", path.data());
+			system(path.data());
+		}
+	}
+	closedir(dirp);
+}
+
+/**
+ * Move the default db into a new segment of archive, then re-create the empty one
+ * @param db_path path of default db (closed)
+ * @return 0 on success, -1 on failure
+ */
+static int archive_flush(const char *db_path)
+{
+	string dir = db_dir(db_path), seg, tmp = string(db_path) + "_n";
+	std::vector<int> segs;
+
+	if (archive_load(dir, segs) < 0) {
+		return -1;
+	}
+	try {
+		Xapian::WritableDatabase(tmp, Xapian::DB_CREATE_OR_OVERWRITE).close();
+	} catch (const Xapian::Error &e) {
+		log_error("failed to create empty default db (PATH:%s, ERROR:%s)", tmp.data(), e.get_msg().data());
+		return -1;
+	}
+	// db -> db_a<seq>, db_n -> db
+	seg = archive_path(dir, archive_seq);
+	log_info("mv -f %s %s", db_path, seg.data());
+	if (rename(db_path, seg.data()) != 0) {
+		log_error("failed to move db into archive (PATH:%s, ERROR:%s)", seg.data(), strerror(errno));
+		return -1;
+	}
+	if (rename(tmp.data(), db_path) != 0) {
+		log_error("failed to re-create the empty default db (PATH:%s, ERROR:%s)", db_path, strerror(errno));
+	}
+	segs.push_back(archive_seq);
+	return archive_publish(dir, segs);
+}
+
+/**
+ * Merge segments of archive db by size-tiered policy, called by indexd after the stub changed
+ * Tier n holds segments of [T*F^n, T*F^(n+1)) documents (T: DEFAULT_ARCHIVE_THRESHOLD, F: ARCHIVE_MERGE_FACTOR),
+ * F segments of the lowest full tier are merged into a new one at a time, run at low priority.
+ * @param db_path path of default db, locked during merging
+ * @return 0 on success or nothing to merge, -1 on failure
+ */
+static int archive_merge(const char *db_path)
+{
+	string dir = db_dir(db_path), tmp = dir + ARCHIVE_DB_NAME ".m", from;
+	std::vector<int> segs, tiers, pick;
+	std::vector<Xapian::doccount> counts;
+	Xapian::WritableDatabase wdb;
+	unsigned long long limit;
+	size_t i;
+	int tier, max_tier = 0, changed = 0;
+
+	try {
+		wdb = Xapian::WritableDatabase(db_path, Xapian::DB_CREATE_OR_OPEN);
+	} catch (const Xapian::Error &e) {
+		log_error("failed to lock default db (PATH:%s, ERROR:%s)", db_path, e.get_msg().data());
+		return -1;
+	}
+	if (archive_load(dir, segs) < 0) {
+		return -1;
+	}
+	archive_retire(dir, segs);
+
+	// get tier of segments, drop empty ones
+	for (i = 0; i < segs.size();) {
+		try {
+			counts.push_back(Xapian::Database(archive_path(dir, segs[i])).get_doccount());
+		} catch (const Xapian::Error &e) {
+			log_error("failed to open archive segment (SEQ:%d, ERROR:%s)", segs[i], e.get_msg().data());
+			return -1;
+		}
+		if (counts.back() == 0) {
+			log_notice("drop empty archive segment (SEQ:%d)", segs[i]);
+			segs.erase(segs.begin() + i);
+			counts.pop_back();
+			changed = 1;
+			continue;
+		}
+		for (tier = 0, limit = (unsigned long long) DEFAULT_ARCHIVE_THRESHOLD * ARCHIVE_MERGE_FACTOR;
+				counts.back() >= limit && tier < 16; tier++, limit *= ARCHIVE_MERGE_FACTOR);
+		tiers.push_back(tier);
+		max_tier = tier > max_tier ? tier : max_tier;
+		i++;
+	}
+
+	// pick segments of the lowest full tier, or the smallest if too many
+	for (tier = 0; tier <= max_tier && pick.size() < ARCHIVE_MERGE_FACTOR; tier++) {
+		pick.clear();
+		for (i = 0; i < segs.size() && pick.size() < ARCHIVE_MERGE_FACTOR; i++) {
+			if (tiers[i] == tier) {
+				pick.push_back(i);
+			}
+		}
+	}
+	if (pick.size() < ARCHIVE_MERGE_FACTOR) {
+		pick.clear();
+		if (segs.size() > ARCHIVE_MAX_SEGMENTS) {
+			std::vector<std::pair<Xapian::doccount, int> > order;
+			for (i = 0; i < segs.size(); i++) {
+				order.push_back(std::make_pair(counts[i], (int) i));
+			}
+			std::sort(order.begin(), order.end());
+			for (i = 0; i < ARCHIVE_MERGE_FACTOR; i++) {
+				pick.push_back(order[i].second);
+			}
+			std::sort(pick.begin(), pick.end());
+		}
+	}
+	if (pick.size() == 0) {
+		log_info("no archive segment to merge (NUM:%d)", (int) segs.size());
+		return changed ? archive_publish(dir, segs) : 0;
+	}
+
+	background_priority();
+
+	// merge into temporary db, then rename as the next segment
+	// NOTE: terminated by SIGTERM directly, temporary db is removed in next merging
+	from = "/bin/rm -rf " + tmp;
+	system(from.data());
+	from.clear();
+	try {
+		Xapian::Database src;
+		char buf[16];
+
+		for (i = 0; i < pick.size(); i++) {
+			src.add_database(Xapian::Database(archive_path(dir, segs[pick[i]])));
+			sprintf(buf, i > 0 ? ",%d" : "%d", segs[pick[i]]);
+			from += buf;
+		}
+		log_notice("merge archive segments (FROM:%s, TO:%d, TIER:%d)", from.data(), archive_seq, tiers[pick[0]]);
+		src.compact(tmp);
+
+		Xapian::WritableDatabase out(tmp, Xapian::DB_OPEN);
+		out.set_metadata(ARCHIVE_MERGED_KEY, from);
+		out.commit();
+		out.close();
+	} catch (const Xapian::Error &e) {
+		log_error("failed to merge archive segments (FROM:%s, ERROR:%s)", from.data(), e.get_msg().data());
+		from = "/bin/rm -rf " + tmp;
+		system(from.data());
+		return -1;
+	}
+	if (rename(tmp.data(), archive_path(dir, archive_seq).data()) != 0) {
+		log_error("failed to rename merged segment (PATH:%s, ERROR:%s)", tmp.data(), strerror(errno));
+		return -1;
+	}
+
+	// replace sources with the merged segment
+	segs[pick[0]] = archive_seq;
+	for (i = pick.size() - 1; i > 0; i--) {
+		segs.erase(segs.begin() + pick[i]);
+	}
+	return archive_publish(dir, segs);
+}
+
+/**
+ * Train dictionary by data of recent documents in the database
+ * Documents imported later are compressed with it, existing ones are not changed.
+ * @return 0 on success, -1 on failure
+ */
+static int db_train_zdict(const char *db_path)
+{
+#ifdef HAVE_ZSTD
+	string samples;
+	std::vector<size_t> sizes;
+	unsigned int id;
+
+	try {
+		Xapian::Database src(db_path);
+		Xapian::docid did = src.get_lastdocid();
+
+		for (; did > 0 && sizes.size() < ZDICT_SAMPLES; did--) {
+			try {
+				Xapian::Document doc = src.get_document(did);
+				string data = doc.get_data();
+
+				if (data.size() >= ZDATA_MIN_DATA && !ZDATA_COMPRESSED(data)) {
+					samples += data;
+					sizes.push_back(data.size());
+				}
+			} catch (const Xapian::DocNotFoundError &e) {
+				// deleted document
+			}
+		}
+	} catch (const Xapian::Error &e) {
+		log_error("failed to read samples (PATH:%s, ERROR:%s)", db_path, e.get_msg().data());
+		return -1;
+	}
+	log_notice("train dictionary (PATH:%s, SAMPLES:%d, SIZE:%d)", db_path, (int) sizes.size(), (int) samples.size());
+	if (sizes.size() == 0 || (id = zdict_train(db_dir(db_path), samples, sizes)) == 0) {
+		log_error("failed to train dictionary, more documents are required (PATH:%s)", db_path);
+		return -1;
+	}
+	log_alert("document data of the project are compressed since now (DICT_ID:%u)", id);
+	return 0;
+#else
+	log_error("compression is not supported, re-configure with zstd");
+	return -1;
+#endif
+}
+
+/**
+ * Optimize the database online, compact it into <db>.opt then swap them
+ * Called by indexd with importing paused, requests arrived meanwhile are kept in rcvfile.
+ * @param db_path
+ * @param bg run in background priority
+ * @return 0 on success, -1 on failure
+ */
+static int db_optimize(const char *db_path, bool bg)
+{
+	string tmp = string(db_path) + ".opt", cmd = "/bin/rm -rf " + tmp;
+	Xapian::WritableDatabase wdb;
+	sigset_t set, oset;
+	int rc = -1;
+
+	try {
+		wdb = Xapian::WritableDatabase(db_path, Xapian::DB_OPEN);
+	} catch (const Xapian::Error &e) {
+		log_error("failed to lock database (PATH:%s, ERROR:%s)", db_path, e.get_msg().data());
+		return -1;
+	}
+	if (bg) {
+		background_priority();
+	}
+	system(cmd.data());
+	try {
+		Xapian::Database src(db_path);
+
+		log_notice("optimize database (PATH:%s, TOTAL:%d)", db_path, src.get_doccount());
+		src.compact(tmp);
+	} catch (const Xapian::Error &e) {
+		log_error("failed to compact database (PATH:%s, ERROR:%s)", db_path, e.get_msg().data());
+		system(cmd.data());
+		return -1;
+	}
+
+	// swap them atomically if supported, never interrupted
+	sigfillset(&set);
+	sigprocmask(SIG_BLOCK, &set, &oset);
+#ifdef RENAME_EXCHANGE
+	rc = renameat2(AT_FDCWD, tmp.data(), AT_FDCWD, db_path, RENAME_EXCHANGE);
+#endif
+	if (rc != 0) {
+		string old = string(db_path) + ".old";
+
+		cmd = "/bin/rm -rf " + old;
+		system(cmd.data());
+		if ((rc = rename(db_path, old.data())) == 0 && (rc = rename(tmp.data(), db_path)) != 0) {
+			rename(old.data(), db_path);
+		}
+		tmp = old;
+	}
+	sigprocmask(SIG_SETMASK, &oset, NULL);
+	wdb.close();
+	if (rc != 0) {
+		log_error("failed to publish optimized database (PATH:%s, ERROR:%s)", db_path, strerror(errno));
+		tmp = string(db_path) + ".opt";
 	}
 
-	return 0;
+	// remove the old one (or failed)
+	cmd = "/bin/rm -rf " + tmp;
+	log_info("%s", cmd.data());
+	system(cmd.data());
+	return rc == 0 ? 0 : -1;
 }
 
 /**
- * Fetch a document from opened file description.
- * @return integer fetch result type
+ * Copy a file for snapshot
+ * @param src
+ * @param dst
+ * @param link hard link it if the file is never modified in place
+ * @return 0 on success, -1 on failure
  */
-static int doc_fetch()
+static int snapshot_file(const string &src, const string &dst, bool link)
 {
-	int rc, size, lsize;
-	char prefix[3], *buf, *term;
-	Xapian::Document doc;
-	XS_CMD cmd;
+	char buf[65536];
+	int sfd, dfd, n = 0;
 
-	// read the first cmd header
-	if (data_read(&cmd, sizeof(cmd)) < 0) {
-		return FETCH_ABORT;
+	if (link && ::link(src.data(), dst.data()) == 0) {
+		return 0;
 	}
-
-	// check special CMD (CMD_INDEX_EXDATA) just skip, need not read the buffer
-	if (cmd.cmd == CMD_INDEX_EXDATA) {
-		return FETCH_DIRTY;
+	if ((sfd = open(src.data(), O_RDONLY)) < 0) {
+		log_error("failed to open file (PATH:%s, ERROR:%s)", src.data(), strerror(errno));
+		return -1;
 	}
-
-	size = XS_CMD_BUFSIZE(&cmd);
-	// just skip the import header
-	if (cmd.cmd == CMD_IMPORT_HEADER) {
-		struct xs_import_hdr *hdr;
-
-		buf = (char *) malloc(size);
-		if (buf == NULL) {
-			log_error("failed to allocate memory for header (CMD:%d, BUFSIZE:%d)", cmd.cmd, size);
-			return FETCH_ABORT;
-		}
-		if (data_read(buf, size) < 0) {
-			free(buf);
-			return FETCH_ABORT;
+	if ((dfd = open(dst.data(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		log_error("failed to create file (PATH:%s, ERROR:%s)", dst.data(), strerror(errno));
+		close(sfd);
+		return -1;
+	}
+	while ((n = read(sfd, buf, sizeof(buf))) > 0) {
+		if (write(dfd, buf, n) != n) {
+			n = -1;
+			break;
 		}
-
-		hdr = (struct xs_import_hdr *) buf;
-		log_notice("dirty import header (PROC_NUM:%d, EFF_SIZE:%lld)", hdr->proc_num, hdr->eff_size);
-		free(buf);
-
-		return FETCH_DIRTY;
 	}
+	if (n < 0) {
+		log_error("failed to copy file (PATH:%s, ERROR:%s)", src.data(), strerror(errno));
+	}
+	close(sfd);
+	close(dfd);
+	return n < 0 ? -1 : 0;
+}
 
-	// NOTE: check valid CMD
-	if (cmd.cmd != CMD_INDEX_REQUEST && cmd.cmd != CMD_INDEX_REMOVE && cmd.cmd != CMD_INDEX_SYNONYMS) {
-		log_notice("invalid command, abort (CMD:%d, BUFSIZE:%d)", cmd.cmd, XS_CMD_BUFSIZE(&cmd));
-		return FETCH_ABORT;
+/**
+ * Snapshot a database by compacting a consistent revision of it into a new database
+ * Retry if the revision is overwritten by a writer not paused (logging db)
+ * @param src path of database
+ * @param dst path of snapshot
+ * @return 0 on success, -1 on failure
+ */
+static int snapshot_db(const string &src, const string &dst)
+{
+	for (int i = 0; i < 3; i++) {
+		try {
+			Xapian::Database db(src);
+
+			db.compact(dst);
+			log_info("database snapshot (PATH:%s, TOTAL:%d)", src.data(), db.get_doccount());
+			return 0;
+		} catch (const Xapian::DatabaseModifiedError &) {
+			log_notice("database modified during snapshot, retry (PATH:%s)", src.data());
+		} catch (const Xapian::Error &e) {
+			log_error("failed to snapshot database (PATH:%s, ERROR:%s)", src.data(), e.get_msg().data());
+			break;
+		}
+		remove_db(dst);
 	}
+	remove_db(dst);
+	return -1;
+}
 
-	// read cmd buffer? (try to get the vno from arg2)
-	buf = term = NULL;
-	if (size > 0) {
-		term = (char *) malloc(size + sizeof(prefix));
-		if (term == NULL) {
-			log_error("failed to allocate memory for command (CMD:%d, BUFSIZE:%d)", cmd.cmd, size);
-			return FETCH_ABORT;
+/**
+ * Take a snapshot of the project: db (with segments of archive if default), logging db & dicts
+ * indexd holds the import slot of db until exit, so db, segments and stub file are not changed meanwhile
+ * SNAPSHOT_DONE_FILE is saved at last
+ * @param db_path
+ * @param snap_path snapshot directory, must not exist
+ * @return 0 on success, -1 on failure
+ */
+static int db_snapshot(const char *db_path, const char *snap_path)
+{
+	string dir = db_dir(db_path), dst = string(snap_path) + "/", name;
+	const char *ptr = strrchr(db_path, '/');
+	struct dirent *de;
+	struct stat st;
+	DIR *dirp;
+	FILE *fp;
+	char line[256];
+	int seq, rc = 0;
+
+	name = ptr == NULL ? db_path : ptr + 1;
+	if (mkdir(snap_path, 0755) != 0) {
+		log_error("failed to create snapshot directory (PATH:%s, ERROR:%s)", snap_path, strerror(errno));
+		return -1;
+	}
+	log_notice("take snapshot (PATH:%s, SNAPSHOT:%s)", db_path, snap_path);
+	rc = snapshot_db(db_path, dst + name);
+
+	// archive segments, then the stub file
+	if (rc == 0 && name == DEFAULT_DB_NAME && (fp = fopen((dir + ARCHIVE_DB_NAME).data(), "r")) != NULL) {
+		while (rc == 0 && fgets(line, sizeof(line), fp) != NULL) {
+			if (sscanf(line, "auto " ARCHIVE_DB_NAME "%d", &seq) == 1 && seq >= 0) {
+				rc = snapshot_db(archive_path(dir, seq), archive_path(dst, seq));
+			}
 		}
-		vno_to_prefix(cmd.arg2, term);
-		buf = term + strlen(term);
-		if (data_read(buf, size) < 0) {
-			free(term);
-			return FETCH_ABORT;
+		fclose(fp);
+		if (rc == 0) {
+			rc = snapshot_file(dir + ARCHIVE_DB_NAME, dst + ARCHIVE_DB_NAME, false);
 		}
-		buf[size] = '\0';
 	}
 
-	// set rc & size, used for: doc_end label
-	rc = total < num_skip ? FETCH_SKIP : FETCH_DIRTY;
-	size = lsize = 0;
-	buf = NULL;
-
-	// add try block for debugging
-	__TRY_FETCH_BEGIN__
+	// logging db is updated by xs-logging without pausing
+	if (rc == 0 && stat((dir + SEARCH_LOG_DB).data(), &st) == 0) {
+		rc = snapshot_db(dir + SEARCH_LOG_DB, dst + SEARCH_LOG_DB);
+	}
 
-			// TODO: check synonyms cmd
-	if (cmd.cmd == CMD_INDEX_SYNONYMS && term != NULL) {
-		if (rc == FETCH_SKIP) {
-			log_info("~skip to add/del synonyms (TERM:%.*s, SKIP_LEFT:%d)",
-					cmd.blen, term + 1, num_skip - total - 1);
-		} else {
-			string org_term = Xapian::Unicode::tolower(string(term + 1, cmd.blen));
-			string syn_term = Xapian::Unicode::tolower(string(term + cmd.blen + 1, cmd.blen1));
-#ifdef HAVE_SYNONYMS_STEM
-			string org_stem, syn_stem;
-			if (should_stem(org_term) && org_term.find_first_of(' ') == string::npos) {
-				org_stem = "Z" + stemmer(org_term);
-				syn_stem = (syn_term.size() > 0 && should_stem(syn_term)) ? "Z" + stemmer(syn_term) : syn_term;
-			}
-#endif
-			rc = FETCH_SYNONYMS;
-			if (cmd.arg1 == CMD_INDEX_SYNONYMS_ADD) {
-				// add
-				syn_db->add_synonym(org_term, syn_term);
-				log_info("+add synonym term (TERM:%s, SYNONYM:%s)", org_term.data(), syn_term.data());
-#ifdef HAVE_SYNONYMS_STEM
-				// stem
-				if (org_stem.size() > 0) {
-					syn_db->add_synonym(org_stem, syn_stem);
-					log_info("+add stemmed synonym (TERM:%s, SYNONYM:%s)", org_stem.data(), syn_stem.data());
-				}
-#endif
-			} else {
-				// del
-				if (syn_term.size() > 0) {
-					// del synonym word
-					syn_db->remove_synonym(org_term, syn_term);
-					log_info("+remove synonym term (TERM:%s, SYNONYM:%s)", org_term.data(), syn_term.data());
-#ifdef HAVE_SYNONYMS_STEM
-					// stemmed
-					if (org_stem.size() > 0) {
-						syn_db->remove_synonym(org_stem, syn_stem);
-						log_info("+remove stemmed synonym (TERM:%s, SYNONYM:%s)", org_stem.data(), syn_stem.data());
-					}
-#endif
-				} else {
-					// clear all synonyms
-					syn_db->clear_synonyms(org_term);
-					log_info("#clear synonym terms (TERM:%s)", org_term.data());
-#ifdef HAVE_SYNONYMS_STEM
-					// stemmed
-					if (org_stem.size() > 0) {
-						syn_db->clear_synonyms(org_stem);
-						log_info("#clear stemmed synonyms (TERM:%s)", org_stem.data());
-					}
-#endif
+	// dicts: custom dict, dictionaries to decompress document data (immutable)
+	if (rc == 0 && stat((dir + CUSTOM_DICT_FILE).data(), &st) == 0) {
+		rc = snapshot_file(dir + CUSTOM_DICT_FILE, dst + CUSTOM_DICT_FILE, false);
+	}
+	if (rc == 0 && (dirp = opendir(dir.size() > 0 ? dir.data() : ".")) != NULL) {
+		while (rc == 0 && (de = readdir(dirp)) != NULL) {
+			if (!strncmp(de->d_name, ZDICT_FILE "_", sizeof(ZDICT_FILE))) {
+				rc = snapshot_file(dir + de->d_name, dst + de->d_name, true);
+			} else if (!strcmp(de->d_name, ZDICT_FILE)) {
+				int len = readlink((dir + ZDICT_FILE).data(), line, sizeof(line) - 1);
+				if (len > 0) {
+					line[len] = '\0';
+					symlink(line, (dst + ZDICT_FILE).data());
 				}
 			}
-			total_synonyms++;
 		}
-		goto doc_end;
+		closedir(dirp);
 	}
 
-	// check the remove cmd
-	if (cmd.cmd == CMD_INDEX_REMOVE && term != NULL) {
-		if (rc == FETCH_SKIP) {
-			log_info("~skip to remove document (ID:%s, SKIP_LEFT:%d)", term, num_skip - total - 1);
-		} else {
-			rc = FETCH_DELETE;
-			if ((flag & FLAG_ARCHIVE) && archive.term_exists(term)) {
-				archive_delete++;
-				archive.delete_document(term);
-				log_info("--remove the document from archive (ID:%s, ARCHIVE_DELETE:%d)", term, archive_delete);
-			} else {
-				total_delete++;
-				database.delete_document(term);
-				log_info("-remove the document (ID:%s, TOTAL_DELETE:%d)", term, total_delete);
-			}
-		}
-		goto doc_end;
+	// mark as finished
+	if (rc == 0 && (fp = fopen((dst + SNAPSHOT_DONE_FILE).data(), "w")) != NULL) {
+		fprintf(fp, "%ld\n", (long) time(NULL));
+		rc = fclose(fp) == 0 ? 0 : -1;
+	} else {
+		rc = -1;
 	}
-
-	// other case, only CMD_INDEX_REQUEST was accepted
-	if (cmd.cmd != CMD_INDEX_REQUEST) {
-		goto doc_end;
+	if (rc != 0) {
+		log_error("failed to take snapshot, removed (SNAPSHOT:%s)", snap_path);
+		system(("/bin/rm -rf " + string(snap_path)).data());
+		return -1;
 	}
+	log_notice("snapshot finished (SNAPSHOT:%s)", snap_path);
+	return 0;
+}
 
-	if (rc != FETCH_SKIP) {
-		rc = (cmd.arg1 == CMD_INDEX_REQUEST_UPDATE && term != NULL) ? FETCH_UPDATE : FETCH_ADD;
-	}
+static int import_main(int argc, char *argv[]);
 
-	// create the document & wait a submit command
-	indexer.set_document(doc);
-	do {
-		// read the doc cmd
-		if (data_read(&cmd, sizeof(cmd)) < 0) {
-			rc = FETCH_ABORT;
-			goto doc_end;
-		}
+/**
+ * Run as warm worker of indexd, scws dictionaries are loaded only once
+ * Request from <stdin> (socket): tab-separated arguments of an import, ends with LF
+ * Import is run in forked child, reply "+<pid>" at once, "-<pid> <status>" on its exit
+ */
+static void worker_loop()
+{
+	char buf[2048], *args[32], *ptr, *end;
+	int n, len = 0;
+	pid_t pid;
+	sigset_t set;
 
-		// read buffer data assert(size == cmd.blen)
-		size = XS_CMD_BUFSIZE(&cmd);
-		if (size > 0) {
-			if (size > lsize) {
-				buf = (char *) realloc(buf, size + 1);
-				if (buf == NULL) {
-					rc = FETCH_ABORT;
-					log_error("failed to allocate memory for doc command (CMD:%d, BUFSIZE:%d)", cmd.cmd, size);
-					goto doc_end;
-				}
-				lsize = size;
+	pcntl_base_signal();
+	base_scws = load_base_scws();
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	log_notice("import worker started (PID:%d)", getpid());
+
+	while (!(flag & FLAG_TERMINATED)) {
+		// read a whole line
+		if ((end = (char *) memchr(buf, '\n', len)) == NULL) {
+			if (len == sizeof(buf)) {
+				log_error("import request too long (SIZE:%d)", len);
+				break;
 			}
-			if (data_read(buf, size) < 0) {
-				rc = FETCH_ABORT;
-				goto doc_end;
+			if ((n = read(STDIN_FILENO, buf + len, sizeof(buf) - len)) > 0) {
+				len += n;
+			} else if (n == 0 || errno != EINTR) {
+				break;
 			}
-			buf[size] = '\0';
+			continue;
 		}
+		*end++ = '\0';
 
-		// parse the cmd, assert(size==cmd.blen)?
-		switch (cmd.cmd) {
-			case CMD_DOC_TERM:
-				// arg1:wdf|flag, arg2:vno, blen:term_len, buf:term
-				if (rc == FETCH_SKIP)
-					break;
-				// empty term cause to increase termpos
-				if (size == 0) {
-					indexer.increase_termpos();
-				} else {
-					string tt(buf, size);
-					string pp;
-					if (CMD_INDEX_VALUENO(cmd) != XS_DATA_VNO) {
-						vno_to_prefix(CMD_INDEX_VALUENO(cmd), prefix);
-						pp = string(prefix);
-					}
-					if (!CMD_INDEX_WITHPOS(cmd)) {
-						doc.add_term(pp + tt, CMD_INDEX_WEIGHT(cmd));
-					} else {
-						// adding with position information
-						doc.add_posting(pp + tt, indexer.get_termpos() + 1, CMD_INDEX_WEIGHT(cmd));
-						indexer.increase_termpos(1);
-					}
-					// check stemmer
-					if (CMD_INDEX_CHECK_STEM(cmd) && should_stem(tt)) {
-						string ss("Z");
-						ss += pp + stemmer(tt);
-						doc.add_term(ss, CMD_INDEX_WEIGHT(cmd));
-					}
-				}
-				break;
-			case CMD_DOC_VALUE:
-				// arg1:flag(numeric=0x80), arg2:vno, blen:content_len, buf:content
-				if (rc != FETCH_SKIP && size > 0) {
-					if (CMD_INDEX_VALUENO(cmd) == XS_DATA_VNO) {
-						doc.set_data(buf);
-					} else {
-						if (!CMD_VALUE_NUMERIC(cmd)) {
-							doc.add_value(CMD_INDEX_VALUENO(cmd), buf);
-						} else {
-							string enc = Xapian::sortable_serialise(strtod(buf, NULL));
-							doc.add_value(CMD_INDEX_VALUENO(cmd), enc);
-						}
-					}
-				}
-				// save first value as ID term for logging
-				if (term == NULL) {
-					term = strdup(buf);
-				}
-				break;
-			case CMD_DOC_INDEX:
-				// arg1:weight|flag, arg2:vno, blen:content_len, buf:content
-				// weight: 0~63, flag_64:withpos, flag_128:save value also
-				if (rc != FETCH_SKIP && size > 0) {
-					// index text
-					vno_to_prefix(CMD_INDEX_VALUENO(cmd), prefix);
-					if (!CMD_INDEX_WITHPOS(cmd)) {
-						indexer.index_text_without_positions(buf, CMD_INDEX_WEIGHT(cmd), prefix);
-					} else {
-						indexer.index_text(buf, CMD_INDEX_WEIGHT(cmd), prefix);
-						indexer.increase_termpos();
-					}
-					// add value (numeric not supportted)
-					if (CMD_INDEX_SAVE_VALUE(cmd)) {
-						if (CMD_INDEX_VALUENO(cmd) == XS_DATA_VNO) {
-							doc.set_data(buf);
-						} else {
-							doc.add_value(CMD_INDEX_VALUENO(cmd), buf);
-						}
-					}
-				}
-				break;
+		// split arguments
+		n = 0;
+		args[n++] = prog_name;
+		for (ptr = strtok(buf, "\t"); ptr != NULL && n < 31; ptr = strtok(NULL, "\t")) {
+			args[n++] = ptr;
 		}
-	} while (cmd.cmd != CMD_INDEX_SUBMIT);
-
-	// submit it
-	if (rc == FETCH_ADD) {
-		total_add++;
-		database.add_document(doc);
-		log_info("+add the document (ID:%s, TOTAL_ADD:%d)", term == NULL ? "NULL" : term, total_add);
-	} else if (rc == FETCH_UPDATE) {
-		if ((flag & FLAG_ARCHIVE) && archive.term_exists(term)) {
-			archive_delete++;
-			archive.delete_document(term);
-			log_info("--remove the document from archive (ID:%s, ARCHIVE_DELETE:%d)", term, archive_delete);
+		args[n] = NULL;
+
+		// exit report must be sent after the pid
+		sigprocmask(SIG_BLOCK, &set, NULL);
+		if ((pid = fork()) == 0) {
+			close(STDIN_FILENO);
+			open("/dev/null", O_RDONLY);
+			optind = 1;
+			import_main(n, args);
+		}
+		ptr = buf + sprintf(buf, "+%d\n", pid > 0 ? pid : -1);
+		write(STDIN_FILENO, buf, ptr - buf);
+		sigprocmask(SIG_UNBLOCK, &set, NULL);
+		if (pid < 0) {
+			log_error("failed to fork import process (ERROR:%s)", strerror(errno));
 		}
-		total_update++;
-		database.replace_document(term, doc);
-		log_info("!update the document (ID:%s, TOTAL_UPDATE:%d)", term == NULL ? "NULL" : term, total_update);
-	} else {
-		log_info("~skip to update/add the document (ID:%s, SKIP_LEFT:%d)",
-				term == NULL ? "NULL" : term, num_skip - total - 1);
-	}
-	__TRY_FETCH_END__;
-
-doc_end:
-	if (buf != NULL) free(buf);
-	if (term != NULL) free(term);
 
-	return rc;
+		len -= end - buf;
+		memmove(buf, end, len);
+	}
+	log_notice("import worker quit");
+	exit(0);
 }
 
 /**
@@ -643,13 +2480,21 @@ doc_end:
  */
 int main(int argc, char *argv[])
 {
-	int num_commit, num_limit, multi, size_limit;
+	return import_main(argc, argv);
+}
+
+/**
+ * Import entrance, called again in child of warm worker
+ */
+static int import_main(int argc, char *argv[])
+{
+	int num_commit, num_limit, multi, size_limit, num_threads, compact = 0;
+	struct doc_job *job;
 	time_t t_begin;
-	char *db_path, *fpath;
-	struct xs_import_hdr hdr;
+	char *db_path, *fpath, *snap_path;
 
 	// init variables
-	db_path = fpath = NULL;
+	db_path = fpath = snap_path = NULL;
 	flag = FLAG_TRANSACTION;
 	num_limit = bytes_read = 0;
 	num_skip = -1;
@@ -657,6 +2502,9 @@ int main(int argc, char *argv[])
 	num_commit = DEFAULT_COMMIT_NUMBER;
 	multi = DEFAULT_SCWS_MULTI;
 	stemmer = Xapian::Stem(DEFAULT_STEMMER);
+	stem_lang = DEFAULT_STEMMER;
+	num_threads = -1;
+	coalesce_batch = 1;
 
 	// open logger
 	log_open("stderr", "import", -1);
@@ -665,14 +2513,33 @@ int main(int argc, char *argv[])
 	if ((prog_name = strrchr(argv[0], '/')) != NULL) prog_name++;
 	else prog_name = argv[0];
 
-	while ((fd = getopt(argc, argv, "vhHNQSVd:f:k:l:m:n:s:t:z:")) != -1) {
+	shard_id = -1;
+	while ((fd = getopt(argc, argv, "vhABHIMNOQRSUVwZd:f:j:k:l:m:n:P:s:t:z:X:")) != -1) {
 		switch (fd) {
 			case 'H': flag |= FLAG_HEADER_ONLY;
 				break;
+			case 'A': flag |= FLAG_ARCHIVE_MERGE;
+				break;
+			case 'B': flag |= FLAG_BULK;
+				break;
+			case 'I': flag |= FLAG_UNIQUE;
+				break;
+			case 'M': flag |= FLAG_MERGE;
+				break;
 			case 'N': flag &= ~FLAG_TRANSACTION;
 				break;
+			case 'Z': flag |= FLAG_ZDICT;
+				break;
+			case 'O': flag |= FLAG_OPTIMIZE;
+				break;
+			case 'X':
+				flag |= FLAG_SNAPSHOT;
+				snap_path = optarg;
+				break;
 			case 'S': flag |= FLAG_CORRECTION;
 				break;
+			case 'U': coalesce_batch = 0;
+				break;
 			case 'Q': log_level(LOG_ERR);
 				break;
 			case 'V': log_level(LOG_INFO);
@@ -681,12 +2548,24 @@ int main(int argc, char *argv[])
 				break;
 			case 'f': fpath = optarg;
 				break;
+			case 'j': num_threads = atoi(optarg);
+				if (num_threads > MAX_IMPORT_THREADS)
+					num_threads = MAX_IMPORT_THREADS;
+				break;
 			case 'k': num_skip = atoi(optarg);
 				break;
 			case 'l': num_limit = atoi(optarg);
 				break;
 			case 'm': multi = atoi(optarg) & 0x0f;
 				break;
+			case 'R': flag |= FLAG_DELTA;
+				break;
+			case 'w': flag |= FLAG_WORKER;
+				break;
+			case 'P': shard_num = atoi(optarg);
+				if (shard_num > MAX_IMPORT_SHARDS)
+					shard_num = MAX_IMPORT_SHARDS;
+				break;
 			case 'n':
 				num_commit = atoi(optarg);
 				if (num_commit <= 0)
@@ -695,6 +2574,7 @@ int main(int argc, char *argv[])
 			case 't':
 				try {
 					stemmer = Xapian::Stem(optarg);
+					stem_lang = optarg;
 				} catch (...) {
 					log_error("invalid stemmer language (LANG:%s)", optarg);
 					goto main_end;
@@ -743,6 +2623,11 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	// warm worker, never return
+	if (flag & FLAG_WORKER) {
+		worker_loop();
+	}
+
 	// other arguments [db] [file]
 	argc -= optind;
 	if (argc > 0 && db_path == NULL) {
@@ -759,17 +2644,71 @@ int main(int argc, char *argv[])
 		log_error("you should specify the database using `-d' option");
 		goto main_end;
 	}
+	// just merge sub-databases
+	if (flag & FLAG_MERGE) {
+		if (shard_merge(db_path) < 0) {
+			flag |= FLAG_TERMINATED;
+		}
+		goto main_end;
+	}
+	// just merge segments of archive
+	if (flag & FLAG_ARCHIVE_MERGE) {
+		if (archive_merge(db_path) < 0) {
+			flag |= FLAG_TERMINATED;
+		}
+		goto main_end;
+	}
+	// just optimize the database
+	if (flag & FLAG_OPTIMIZE) {
+		if (strchr(db_path, ':') != NULL || db_optimize(db_path, true) < 0) {
+			flag |= FLAG_TERMINATED;
+		}
+		goto main_end;
+	}
+	if (flag & FLAG_ZDICT) {
+		if (strchr(db_path, ':') != NULL || db_train_zdict(db_path) < 0) {
+			flag |= FLAG_TERMINATED;
+		}
+		goto main_end;
+	}
+	if (flag & FLAG_SNAPSHOT) {
+		if (strchr(db_path, ':') != NULL || db_snapshot(db_path, snap_path) < 0) {
+			flag |= FLAG_TERMINATED;
+		}
+		goto main_end;
+	}
 	// check the input file(failed? redirect to <STDIN>
 	if (fpath == NULL) {
 		log_notice("read from STDIN, you may specify the input file using `-f' option");
 		fd = STDIN_FILENO;
 		flag |= FLAG_STDIN;
+	} else if (flag & FLAG_DELTA) {
+		// rcvfile is still appending by indexd, lock is not required
+		if ((fd = open(fpath, O_RDONLY)) < 0) {
+			log_error("failed to open the input file (FILE:%s, ERROR:%s)", fpath, strerror(errno));
+			flag |= FLAG_TERMINATED;
+			goto main_end;
+		}
 	} else if ((fd = open(fpath, O_RDWR)) < 0 || !FLOCK_WR_NB(fd)) {
 		log_error("failed to open/lock the input file (FILE:%s, ERROR:%s)", fpath, strerror(errno));
 		flag |= FLAG_TERMINATED;
 		goto main_end;
 	}
 
+	// bulk mode, use large batches if they are not specified
+	if (flag & FLAG_BULK) {
+		flag &= ~FLAG_TRANSACTION;
+		if (num_commit == DEFAULT_COMMIT_NUMBER) {
+			num_commit = BULK_COMMIT_NUMBER;
+		}
+		if (size_limit == DEFAULT_COMMIT_SIZE * 1048576) {
+			size_limit = BULK_COMMIT_SIZE * 1048576;
+		}
+	}
+	if (flag & FLAG_UNIQUE) {
+		coalesce_batch = 0;
+	}
+
 	// set the env: XAPIAN_FLUSH_THRESHOLD=10000
 	if (num_commit != 10000) {
 		char envbuf[64];
@@ -793,7 +2732,8 @@ int main(int argc, char *argv[])
 		if (flag & FLAG_STDIN) {
 			printf("** Not supported **\n");
 		} else if (flag & FLAG_HEADER) {
-			printf("{ proc_num:%d, eff_size:%lld, ... }\n", hdr.proc_num, hdr.eff_size);
+			printf("{ proc_num:%d, eff_size:%lld, proc_off:%lld, proc_skip:%d, version:%d, ... }\n",
+					hdr.proc_num, hdr.eff_size, hdr.proc_off, hdr.proc_skip, hdr.version);
 		} else {
 			printf("** Not Found **\n");
 		}
@@ -801,15 +2741,43 @@ int main(int argc, char *argv[])
 	}
 
 	// reset num_skip & filesize
+	if ((flag & FLAG_HEADER) && hdr.version == XS_IMPORT_VERSION) {
+		flag |= FLAG_RECORD;
+	}
 	if (num_skip < 0) {
 		num_skip = (flag & FLAG_HEADER) ? hdr.proc_num : 0;
+	} else {
+		hdr.proc_off = 0;
 	}
-	if (flag & FLAG_HEADER) {
+	if (flag & FLAG_DELTA) {
+		// read committed data only
+		if (!(flag & FLAG_HEADER)) {
+			log_error("delta database requires import header");
+			flag |= FLAG_TERMINATED;
+			goto main_end;
+		}
+		rd_limit = hdr.eff_size;
+		fstat(fd, &input_st);
+	} else if (flag & FLAG_HEADER) {
 		struct stat st;
 		if (!fstat(fd, &st) && st.st_size > hdr.eff_size) {
 			ftruncate(fd, hdr.eff_size);
 			log_notice("reset file size (ST_SIZE:%lld, EFF_SIZE:%lld)", st.st_size, hdr.eff_size);
+			raw_seek(raw_tell());
+		}
+	}
+
+	// import into sub-databases by child processes
+	if (shard_num > 0 && !(flag & FLAG_HEADER_ONLY)) {
+		if ((flag & FLAG_STDIN) || strchr(db_path, ':') != NULL) {
+			log_error("sub-databases require local database and input file");
+			flag |= FLAG_TERMINATED;
+			goto main_end;
+		}
+		if (shard_start(fpath, &db_path) < 0) {
+			goto main_end;
 		}
+		fstat(fd, &input_st);
 	}
 
 	// try open the database
@@ -823,6 +2791,17 @@ int main(int argc, char *argv[])
 			database = Xapian::Remote::open_writable(db_path, atoi(ptr), 5000, 1000);
 		}
 
+		if ((flag & FLAG_BULK) && ptr == NULL && database.get_lastdocid() == 0) {
+			compact = 1;
+		}
+		stem_cache = new CachedStem(stem_lang);
+		stemmer = Xapian::Stem(stem_cache);
+#ifdef HAVE_ZSTD
+		unsigned int zid;
+		if (ptr == NULL && (zcdict = zdict_load(db_dir(db_path), &zid)) != NULL) {
+			log_notice("compress document data (DICT_ID:%u)", zid);
+		}
+#endif
 		indexer.set_stemmer(stemmer);
 		indexer.set_stopper(&stopper);
 		indexer.set_database(database);
@@ -842,44 +2821,111 @@ int main(int argc, char *argv[])
 		goto main_end;
 	}
 
-	// try to open the archive database
+	// try to open segments of the archive database
 	syn_db = &database;
 	archive_delete = 0;
 	try {
-		char *ptr = strrchr(db_path, '/');
-		if (ptr == NULL) {
-			ptr = db_path;
-		} else {
-			ptr++;
-		}
-		if (!strcasecmp(ptr, DEFAULT_DB_NAME)) {
-			char dba_path[256];
+		std::vector<int> segs;
+		string dir = db_dir(db_path);
+		size_t i;
 
+		if (!strcasecmp(db_path + dir.size(), DEFAULT_DB_NAME)) {
 			flag |= FLAG_DEFAULT_DB;
-			snprintf(dba_path, sizeof(dba_path), "%.*s" DEFAULT_DB_NAME "_a", (int) (ptr - db_path), db_path);
-
-			log_info("try to open archive database (DB_A:%s)", dba_path);
-			archive = Xapian::WritableDatabase(dba_path, Xapian::DB_OPEN);
-			syn_db = &archive;
-			flag |= FLAG_ARCHIVE;
-			log_info("open archive database sucessfully");
+			log_info("try to open archive database (DIR:%s)", dir.data());
+			if (!(flag & FLAG_UNIQUE) && archive_load(dir, segs) > 0) {
+				for (i = 0; i < segs.size(); i++) {
+					archives.push_back(Xapian::WritableDatabase(archive_path(dir, segs[i]), Xapian::DB_OPEN));
+				}
+				syn_db = &archives[0];
+				flag |= FLAG_ARCHIVE;
+				log_info("open archive database sucessfully (NUM:%d)", (int) segs.size());
+			}
 		}
 	} catch (...) {
+		archives.clear();
+		syn_db = &database;
 		log_info("failed to open archive database");
 	}
 
+	// resume sub/delta database from its own progress of the same input
+	// size of rcvfile is growing for delta database
+	if (flag & (FLAG_SHARD | FLAG_DELTA)) {
+		unsigned long ino;
+		long long eff_size, proc_off;
+		int proc_num, proc_skip;
+
+		hdr.proc_off = 0;
+		if (sscanf(database.get_metadata(IMPORT_PROGRESS_KEY).data(), "%lu:%lld:%d:%lld:%d",
+				&ino, &eff_size, &proc_num, &proc_off, &proc_skip) == 5
+				&& ino == (unsigned long) input_st.st_ino && proc_num > num_skip
+				&& ((flag & FLAG_DELTA) || eff_size == (long long) hdr.eff_size)) {
+			num_skip = proc_num;
+			hdr.proc_off = proc_off;
+			hdr.proc_skip = proc_skip;
+		}
+	}
+
+	// resume from the record directly, skip documents only in that record
+	if ((flag & FLAG_RECORD) && hdr.proc_off > 0 && hdr.proc_skip <= num_skip) {
+		log_notice("resume from record (OFF:%lld, SKIP:%d)", hdr.proc_off, hdr.proc_skip);
+		raw_seek(hdr.proc_off);
+		total = num_skip - hdr.proc_skip;
+	}
+	total_read = total;
+
+	// coalesce in the batch of transaction, input must be seekable
+	if (coalesce_batch > 0 && !(flag & FLAG_STDIN)) {
+		coalesce_batch = num_commit;
+	} else {
+		coalesce_batch = 0;
+	}
+
+	// start the pipeline, spelling data must be written in order
+	if (num_threads < 0) {
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+		if (num_threads > MAX_IMPORT_THREADS) {
+			num_threads = MAX_IMPORT_THREADS;
+		}
+		if (shard_num > 0) {
+			num_threads /= shard_num;
+		}
+	}
+	if (flag & FLAG_CORRECTION) {
+		num_threads = 0;
+	}
+	num_threads = pipe_start(num_threads);
+
 	// read the file & count them
 	t_begin = time(NULL);
-	log_notice("begin to import (NUM_BATCH:%d, NUM_LIMIT:%d, SIZE_LIMIT:%dMB, TOTAL:%d, SKIP:%d)",
-			num_commit, num_limit, size_limit >> 20, database.get_doccount(), num_skip);
+	log_notice("begin to import (NUM_BATCH:%d, NUM_LIMIT:%d, SIZE_LIMIT:%dMB, TOTAL:%d, SKIP:%d, THREADS:%d, SHARD:%d)",
+			num_commit, num_limit, size_limit >> 20, database.get_doccount(), num_skip, num_threads, shard_id);
 
 	if (flag & FLAG_TRANSACTION) {
 		database.begin_transaction();
 	}
-	while (!(flag & FLAG_TERMINATED) && ((argc = doc_fetch()) != FETCH_ABORT)) {
-		if (argc != FETCH_DIRTY) {
-			total++;
+	while (!(flag & FLAG_TERMINATED)) {
+		// read documents ahead to keep workers busy
+		if (job_num < job_max && !(flag & FLAG_READ_END)) {
+			if ((job = doc_read()) == NULL) {
+				flag |= FLAG_READ_END;
+			} else {
+				pipe_push(job);
+				if (num_limit > 0 && (total_read - num_skip) == num_limit) {
+					flag |= FLAG_READ_END;
+				}
+			}
+			continue;
+		}
+		// apply the first document in order
+		if ((job = pipe_pop()) == NULL) {
+			break;
 		}
+		doc_apply(job);
+		app_rec_off = job->rec_off;
+		app_rec_total = job->rec_total;
+		doc_job_free(job);
+		total++;
+
 		if (num_limit > 0 && (total - num_skip) == num_limit) {
 			log_notice("number of import documents reach the upper limit (LIMIT:%d)", num_limit);
 			break;
@@ -896,58 +2942,37 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	// last committed
+	// last committed, drop the documents not applied
 	batch_committed(0);
+	pipe_stop();
 
 	// finished report
 	argc = time(NULL) - t_begin;
-	log_alert("%s (ADD:%d, UPDATE:%d, DELETE:%d[%d], SYNONYMS:%d, PROC_TOTAL:%d, DB_TOTAL:%d, TIME:%d'%02d\")",
+	stem_hits += stem_cache->hits;
+	stem_lookups += stem_cache->lookups;
+	log_alert("%s (ADD:%d, UPDATE:%d, PATCH:%d, DELETE:%d[%d], COALESCE:%d, SYNONYMS:%d, PROC_TOTAL:%d, DB_TOTAL:%d, STEM_HIT:%.1f%%, TIME:%d'%02d\")",
 			(flag & FLAG_TERMINATED ? "aborted" : "finished"),
-			total_add, total_update, total_delete, archive_delete, total_synonyms, total,
-			database.get_doccount(), argc / 60, argc % 60);
-
-	// check to archive
-	if ((flag & FLAG_DEFAULT_DB) && (database.get_doccount() >= DEFAULT_ARCHIVE_THRESHOLD)) {
-		char *ptr = strrchr(db_path, '/');
-
-		log_alert("compact the database into archive (DB:%s, TOTAL:%d)", db_path, database.get_doccount());
-		if (ptr != NULL) {
-			ptr[1] = '\0';
-			chdir(db_path);
-		}
+			total_add, total_update, total_patch, total_delete, archive_delete, total_coalesce, total_synonyms, total,
+			database.get_doccount(), stem_lookups > 0 ? 100.0 * stem_hits / stem_lookups : 0.0,
+			argc / 60, argc % 60);
 
+	// move into archive, segments are merged by indexd later (-A)
+	if ((flag & FLAG_DEFAULT_DB) && !(flag & FLAG_BULK) && (database.get_doccount() >= DEFAULT_ARCHIVE_THRESHOLD)) {
+		log_alert("move the database into archive (DB:%s, TOTAL:%d)", db_path, database.get_doccount());
 		database.close();
-		if (flag & FLAG_ARCHIVE) {
-			archive.close();
-
-			// 1. merge: db_a + db -> db_c
-			log_info("rm -rf db_c");
-			system("/bin/rm -rf " DEFAULT_DB_NAME "_c");
-			log_info("xapian-compact db + db_a = db_c");
-			system(XAPIAN_DIR "/bin/xapian-compact -n " DEFAULT_DB_NAME "_a " DEFAULT_DB_NAME " " DEFAULT_DB_NAME "_c");
-			// 2. remove: db_o db
-			log_info("rm -rf db_o db");
-			system("/bin/rm -rf " DEFAULT_DB_NAME "_o " DEFAULT_DB_NAME);
-			// 3. rename: db_a -> db_o, db_c -> db_a
-			log_info("mv -f db_a db_o");
-			system("/bin/mv -f " DEFAULT_DB_NAME "_a " DEFAULT_DB_NAME "_o");
-			log_info("mv -f db_c db_a");
-			system("/bin/mv -f " DEFAULT_DB_NAME "_c " DEFAULT_DB_NAME "_a");
-		} else {
-			// 1. remove: db_a (clean)
-			log_info("rm -rf db_a");
-			system("/bin/rm -rf " DEFAULT_DB_NAME "_a");
-			// 2. rename: db -> db_a
-			log_info("mv -f db db_a");
-			system("/bin/mv -f " DEFAULT_DB_NAME " " DEFAULT_DB_NAME "_a");
-		}
-
-		// re-create empty db
-		log_info("re-create the empty default db");
-		database = Xapian::WritableDatabase(DEFAULT_DB_NAME, Xapian::DB_CREATE_OR_OPEN);
+		archives.clear();
+		archive_flush(db_path);
 	}
 	database.close();
 
+	// bulk loaded into empty database, compact it directly (sub-databases are compacted on merging)
+	if (compact && !(flag & (FLAG_TERMINATED | FLAG_SHARD)) && shard_num == 0) {
+		log_notice("compact the bulk loaded database (DB:%s)", db_path);
+		if (db_optimize(db_path, false) < 0) {
+			flag |= FLAG_TERMINATED;
+		}
+	}
+
 main_end:
 	if (fd >= 0) {
 		if (!(flag & FLAG_STDIN)) {
@@ -10,7 +10,22 @@
 #define	DEFAULT_STEMMER				"english"	// default stemmer
 #define	DEFAULT_COMMIT_NUMBER		10000		// document numbers
 #define	DEFAULT_COMMIT_SIZE			256			// MB
+#define	BULK_COMMIT_NUMBER			100000		// document numbers of bulk mode
+#define	BULK_COMMIT_SIZE			1024		// MB, bulk mode
+#define	READ_BUFFER_SIZE			4194304		// read-ahead buffer size of input
+#define	MAX_RECORD_SIZE				1073741824	// max size of a record in import file, larger is broken
+#define	MAX_IMPORT_THREADS			8			// max threads to build documents
+#define	PIPE_JOBS_PER_THREAD		16			// max documents in pipeline for each thread
+#define	PIPE_JOB_BUFFER_KEEP		1048576		// max buffer size kept by recycled job
+#define	PURGE_BATCH_SIZE			10000		// documents removed in each batch by range
+#define	MAX_IMPORT_SHARDS			16			// max sub-databases to import in parallel
+#define	IMPORT_PROGRESS_KEY			"xs:import_progress"	// metadata key of sub/delta database
 
 #define	DEFAULT_ARCHIVE_THRESHOLD	100000		// default threshold value to archive
+#define	ARCHIVE_MERGE_FACTOR		4			// number of segments in the same tier to merge
+#define	ARCHIVE_MAX_SEGMENTS		32			// merge the smallest segments if more than it
+#define	ARCHIVE_RETIRE_TIME			600			// seconds to keep merged segments for searching
+#define	BACKGROUND_NICE				10			// nice value of merging/optimizing process
+#define	ARCHIVE_MERGED_KEY			"xs:archive_merged"	// metadata key of merged segment, the source list
 
 #endif
@@ -13,6 +13,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/param.h>
@@ -21,11 +22,15 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <time.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <sys/socket.h>
 
 #include "conn.h"
 #include "log.h"
 #include "pcntl.h"
 #include "global.h"
+#include "crc32c.h"
 #include "indexd.h"
 
 /**
@@ -36,6 +41,12 @@
 #define	FLAG_G_INITED		0x04
 #define	FLAG_ON_EXIT		0x08
 
+#ifdef HAVE_FDATASYNC
+#define	DATA_SYNC(fd)		fdatasync(fd)
+#else
+#define	DATA_SYNC(fd)		fsync(fd)
+#endif
+
 #define	IS_RQST_CMD(c)		(c==CMD_INDEX_SUBMIT||c==CMD_DOC_TERM||c==CMD_DOC_INDEX||c==CMD_DOC_VALUE)
 #define	IS_INDEX_CMD(c)		(c==CMD_INDEX_REQUEST||c==CMD_INDEX_REMOVE||c==CMD_INDEX_EXDATA||c==CMD_INDEX_SYNONYMS)
 
@@ -49,6 +60,28 @@
 } while(0)
 
 
+/**
+ * Connection waiting for group commit of rcvfile
+ */
+struct group_wait
+{
+	XS_CONN *conn;
+	int rc; // 0 -> persisted, -1 -> io error, -2 -> discarded
+	short num; // number of saved requests to be responded
+	short nomem; // last request failed for out of memory
+	struct group_wait *next;
+};
+
+/**
+ * Pending db to be committed, ordered by score
+ */
+struct commit_item
+{
+	long score;
+	XS_DB *db;
+	XS_USER *user;
+};
+
 /**
  * Global variables
  */
@@ -59,9 +92,16 @@ G_VAR_DECL(user_base, void *);
  * Local static variables
  */
 static time_t time_logging;
-static int queue_size;
-static char xs_import[128], xs_logging[128], *prog_name;
+static int queue_size, group_time, group_sync, rebuild_shards, delta_time;
+static struct group_wait *ack_head;
+static char xs_import[128], xs_logging[128], xs_replicate[128], *prog_name;
 static volatile int main_flag, import_num;
+static int import_max, commit_rate, commit_count, disk_latency;
+static int worker_fd = -1, worker_len;
+static pid_t worker_pid;
+static char worker_buf[512];
+static const char *repl_bind;
+static pid_t repl_pid;
 
 /**
  * Show version information
@@ -90,6 +130,18 @@ static void show_usage()
 	printf("  -l <log_file>    Specify the log output file, (default: none)\n");
 	printf("                   E.g: " DEFAULT_TEMP_DIR "%s.log, stderr\n", prog_name);
 	printf("  -q <num>         Set the queue size to commit, (default: %d)\n", DEFAULT_QUEUE_SIZE);
+	printf("  -c <num>         Set the max number of concurrent import processes, (1-%d, default: %d)\n",
+			MAX_IMPORT_LIMIT, MAX_IMPORT_NUM);
+	printf("  -g <msec>        Set the max time to wait for group commit of requests, (0-%d, default: %d)\n",
+			MAX_GROUP_TIME, DEFAULT_GROUP_TIME);
+	printf("  -s <none|fdatasync>\n");
+	printf("                   Respond requests after the data reach page cache or disk, (default: none)\n");
+	printf("  -d <sec>         Set the interval to import delta db for near-real-time searching, (0-%d, default: 0)\n",
+			MAX_DELTA_TIME);
+	printf("  -r <num>         Set the number of sub-databases to rebuild in parallel, (0-%d, default: 0)\n",
+			MAX_REBUILD_SHARDS);
+	printf("  -R <port>|<address:port>\n");
+	printf("                   Serve changesets of databases to replicas on address/port, (default: none)\n");
 	printf("  -e <bin_path>    Set the external program path, (default: " DEFAULT_BIN_PATH ")\n");
 	printf("  -k [fast]<stop|start|restart|reload> Server process running control\n");
 	printf("  -v               Show version information\n");
@@ -137,6 +189,44 @@ static void xs_logging_call(XS_USER *user)
 	}
 }
 
+static int db_flush_wbuf(XS_DB *db, XS_USER *user);
+static void db_release_waits(XS_DB *db, int rc);
+static pid_t import_spawn(const char **args);
+
+/**
+ * Get the budget of concurrent import processes
+ * Halved when writing of rcvfile is slow, the disk is busy already
+ * @return max number of import processes
+ */
+static inline int import_budget()
+{
+	if (disk_latency > SLOW_DISK_LATENCY && import_max > 1) {
+		return import_max >> 1;
+	}
+	return import_max;
+}
+
+/**
+ * Adapt the batch size of commit to the observed import throughput
+ * Batch is expected to take COMMIT_BATCH_TIME seconds, between MIN_COMMIT_COUNT and queue_size
+ * @param count number of imported documents
+ * @param cost seconds used to import
+ */
+static void commit_adapt(int count, int cost)
+{
+	int rate = count / (cost > 0 ? cost : 1);
+
+	commit_rate = commit_rate == 0 ? rate : (commit_rate * 3 + rate) >> 2;
+	commit_count = commit_rate * COMMIT_BATCH_TIME;
+	if (commit_count < MIN_COMMIT_COUNT) {
+		commit_count = MIN_COMMIT_COUNT;
+	} else if (commit_count > queue_size) {
+		commit_count = queue_size;
+	}
+	log_debug("adapt commit batch (COUNT:%d, COST:%d, RATE:%d, BATCH:%d)",
+			count, cost, commit_rate, commit_count);
+}
+
 /**
  * Call external program to import, write to the Xapian database
  * @param db
@@ -144,7 +234,12 @@ static void xs_logging_call(XS_USER *user)
 static void db_import_call(XS_DB *db, XS_USER *user)
 {
 	pid_t pid;
-	char dbpath[256], sndfile[128];
+	int i;
+	char dbpath[256], sndfile[128], arg[16], arg2[16];
+	const char *args[8];
+
+	// write buffered requests into rcvfile
+	db_flush_wbuf(db, user);
 
 	// temporary swap file
 	sprintf(dbpath, "%s/%s%s", user->home, db->name, (db->flag & XS_DBF_REBUILD_BEGIN) ? ".re" : "");
@@ -176,6 +271,7 @@ static void db_import_call(XS_DB *db, XS_USER *user)
 #endif	/* LARGEFILE */
 
 		// use new rcvfile
+		db->icount = 0;
 		if (i == 0) {
 			// re-check parameters [maye come from user command]
 			if (db->count == 0 || db->fd < 0) {
@@ -186,6 +282,7 @@ static void db_import_call(XS_DB *db, XS_USER *user)
 			// free resource
 			close(db->fd);
 			db->fd = -1;
+			db->icount = db->count;
 			db->count = db->lcount = 0;
 			db->flag &= ~XS_DBF_FORCE_COMMIT; // clean force flag
 
@@ -199,16 +296,30 @@ static void db_import_call(XS_DB *db, XS_USER *user)
 		}
 	}
 
-	// fork child process to run the import
-	if ((pid = fork()) == 0) {
-		char arg[16];
-		sprintf(arg, "-m%d", db->scws_multi);
-		EXTERNAL_CALL(xs_import, "xs-import", "-Q", arg, dbpath, sndfile);
-	} else if (pid > 0) {
+	// spawn child process to run the import
+	sprintf(arg, "-m%d", db->scws_multi);
+	args[0] = "xs-import";
+	args[1] = "-Q";
+	args[2] = arg;
+	i = 3;
+	if (db->flag & XS_DBF_REBUILD_BEGIN) {
+		// bulk mode for rebuilding, it is a new database
+		args[i++] = "-B";
+	}
+	if ((db->flag & XS_DBF_REBUILD_BEGIN) && rebuild_shards > 0) {
+		// rebuild into sub-databases in parallel, merged at the end
+		sprintf(arg2, "-P%d", rebuild_shards);
+		args[i++] = arg2;
+	}
+	args[i++] = dbpath;
+	args[i++] = sndfile;
+	args[i] = NULL;
+	if ((pid = import_spawn(args)) > 0) {
 		// save pid in parent
 		log_info("spawn a import progress (PID:%d, DB:%p)", pid, db);
 		import_num++; // increase the import process number
 		db->pid = pid;
+		time(&db->itime);
 	} else {
 		// fork error(), the file will try to import in next calling
 		log_error("failed to fork import process (DB:%s.%s, ERROR:%s)",
@@ -216,17 +327,32 @@ static void db_import_call(XS_DB *db, XS_USER *user)
 	}
 }
 
+/**
+ * Compare pending dbs by score (descending)
+ */
+static int commit_item_cmp(const void *a, const void *b)
+{
+	long d = ((const struct commit_item *) b)->score - ((const struct commit_item *) a)->score;
+
+	return d > 0 ? 1 : (d < 0 ? -1 : 0);
+}
+
 /**
  * Database auto-commit check
- * @param quit Is the server will quit at once (called in main_cleanup)
+ * Pending dbs are committed in order of score within the import budget,
+ * score is count of documents and waiting MIN_COMMIT_TIME is worth a full batch,
+ * every due db is scored, only the top MAX_COMMIT_PENDING are kept for ordering
  */
 static void db_commit_check()
 {
 	XS_USER *user;
 	XS_DB *db;
+	struct commit_item items[MAX_COMMIT_PENDING], item;
+	int i, min, num = 0, over = 0, budget = import_budget();
 	time_t now = time(NULL);
 
-	log_debug("check to commit database (EXIT:%s)", (main_flag & FLAG_ON_EXIT) ? "yes" : "no");
+	log_debug("check to commit database (EXIT:%s, IMPORT_NUM:%d, BUDGET:%d, BATCH:%d)",
+			(main_flag & FLAG_ON_EXIT) ? "yes" : "no", import_num, budget, commit_count);
 
 	user = (XS_USER *) G_VAR(user_base);
 	while (user != NULL) {
@@ -235,12 +361,16 @@ static void db_commit_check()
 				// in quit mode, just close the file description
 				// rcvfile will continue to use in the next running
 				if (db->fd >= 0) {
+					db_flush_wbuf(db, user);
 					close(db->fd);
 				}
 				// notify child import process to quit also
 				if (db->pid > 0) {
 					kill(db->pid, SIGTERM);
 				}
+				if (db->dpid > 0) {
+					kill(db->dpid, SIGTERM);
+				}
 				continue;
 			}
 
@@ -249,28 +379,62 @@ static void db_commit_check()
 				continue;
 			}
 
-			// allow to submit small/forced request
-			if (import_num >= MAX_IMPORT_NUM && db->count > MIN_COMMIT_COUNT
-					&& !(db->flag & XS_DBF_FORCE_COMMIT)) {
-				log_notice("server is too busy to skip commit (IMPORT_NUM:%d, DB:%s.%s, COUNT:%d)",
-						import_num, user->name, db->name, db->count);
-				continue;
-			}
-
 			// avoid committing too frequent
 			if (!(db->flag & XS_DBF_FORCE_COMMIT)
-					&& db->count < MIN_COMMIT_COUNT && (now - db->ltime) < MIN_COMMIT_TIME) {
-				log_notice("skip too frequently commit (DB:%s.%s, COUNT:%d)",
+					&& db->count < commit_count && (now - db->ltime) < MIN_COMMIT_TIME) {
+				log_debug("skip too frequently commit (DB:%s.%s, COUNT:%d)",
 						user->name, db->name, db->count);
 				continue;
 			}
 
-			// do commit
-			log_notice("commit index data (DB:%s.%s, COUNT:%d)", user->name, db->name, db->count);
-			db_import_call(db, user);
+			// forced request is always the first
+			if (db->flag & XS_DBF_FORCE_COMMIT) {
+				item.score = LONG_MAX;
+			} else {
+				item.score = db->count
+						+ (long) (now - db->ltime) * commit_count / MIN_COMMIT_TIME;
+			}
+			item.db = db;
+			item.user = user;
+			if (num < MAX_COMMIT_PENDING) {
+				items[num++] = item;
+				continue;
+			}
+
+			// replace the lowest one if full, waiting time raises score of others next time
+			over++;
+			for (i = 1, min = 0; i < num; i++) {
+				if (items[i].score < items[min].score) {
+					min = i;
+				}
+			}
+			if (item.score > items[min].score) {
+				items[min] = item;
+			}
 		}
 		user = user->next;
 	}
+	if (over > 0) {
+		log_notice("too many pending dbs, keep the top ones (NUM:%d, OVER:%d)", num, over);
+	}
+
+	qsort(items, num, sizeof(struct commit_item), commit_item_cmp);
+	for (i = 0; i < num; i++) {
+		db = items[i].db;
+		user = items[i].user;
+
+		// allow to submit forced request
+		if (import_num >= budget && items[i].score != LONG_MAX) {
+			log_notice("server is too busy to skip commit (IMPORT_NUM:%d, BUDGET:%d, SKIPPED:%d)",
+					import_num, budget, num - i);
+			break;
+		}
+
+		// do commit
+		log_notice("commit index data (DB:%s.%s, COUNT:%d, SCORE:%ld)",
+				user->name, db->name, db->count, items[i].score);
+		db_import_call(db, user);
+	}
 }
 
 /**
@@ -286,7 +450,7 @@ static XS_DB *db_get_by_pid(pid_t pid, XS_USER **db_user)
 	user = (XS_USER *) G_VAR(user_base);
 	while (user != NULL) {
 		for (db = user->db; db != NULL; db = db->next) {
-			if (db->pid == pid) {
+			if (db->pid == pid || db->dpid == pid) {
 				*db_user = user;
 				return db;
 			}
@@ -362,6 +526,125 @@ static int rmdir_r(const char *fpath)
 	return -1;
 }
 
+/**
+ * Remove the archive db of user (stub file and segments db_a<num>)
+ * @param user
+ */
+static void archive_clean(XS_USER *user)
+{
+	char buf[PATH_MAX], *name;
+	struct dirent *de;
+	DIR *dirp;
+
+	if ((dirp = opendir(user->home)) == NULL) {
+		return;
+	}
+	while ((de = readdir(dirp)) != NULL) {
+		name = de->d_name;
+		if (strncmp(name, ARCHIVE_DB_NAME, sizeof(ARCHIVE_DB_NAME) - 1)) {
+			continue;
+		}
+		name += sizeof(ARCHIVE_DB_NAME) - 1;
+		if (*name != '\0' && *name != '.' && (*name < '0' || *name > '9')) {
+			continue;
+		}
+		sprintf(buf, "%s/%s", user->home, de->d_name);
+		log_notice("clean archive database (PATH:%s)", buf);
+		if (rmdir_r(buf) == 0) {
+			unlink(buf);
+		}
+	}
+	closedir(dirp);
+}
+
+/**
+ * Remove the delta db, documents are searchable in main db (or discarded) now
+ * Running delta import is notified to quit, then removed on its exit
+ * @param db
+ * @param user
+ */
+static void db_delta_reset(XS_DB *db, XS_USER *user)
+{
+	char dbpath[256];
+
+	if (strcmp(db->name, DEFAULT_DB_NAME)) {
+		return;
+	}
+	if (db->dpid > 0) {
+		kill(db->dpid, SIGTERM);
+		db->flag |= XS_DBF_DELTA_RESET;
+		return;
+	}
+	sprintf(dbpath, "%s/" DELTA_DB_NAME, user->home);
+	if (!access(dbpath, R_OK)) {
+		log_info("remove delta database (PATH:%s)", dbpath);
+		rmdir_r(dbpath);
+	}
+	// documents of current rcvfile should be imported again
+	db->dcount = db->count;
+}
+
+/**
+ * Call external program to import committed data of rcvfile into delta db
+ * Delta db is searched with default db, so the documents are searchable before importing
+ * @param db
+ * @param user
+ */
+static void db_delta_call(XS_DB *db, XS_USER *user)
+{
+	pid_t pid;
+	char dbpath[256], rcvfile[128], arg[16];
+	const char *args[] = { "xs-import", "-Q", "-R", arg, dbpath, rcvfile, NULL };
+
+	sprintf(dbpath, "%s/" DELTA_DB_NAME, user->home);
+	sprintf(rcvfile, DEFAULT_TEMP_DIR "%s_%s.rcv", user->name, db->name);
+	sprintf(arg, "-m%d", db->scws_multi);
+	if ((pid = import_spawn(args)) > 0) {
+		log_info("spawn a delta import (PID:%d, DB:%s.%s, COUNT:%d)", pid, user->name, db->name, db->dcount);
+		import_num++;
+		db->dpid = pid;
+		db->dcount = 0;
+		time(&db->dtime);
+	} else {
+		log_error("failed to fork delta import (DB:%s.%s, ERROR:%s)",
+				user->name, db->name, strerror(errno));
+	}
+}
+
+/**
+ * Check to import delta db of all users, schedule the timer to check again
+ */
+static void db_delta_check()
+{
+	XS_USER *user;
+	XS_DB *db;
+	int left, wait = -1;
+	time_t now = time(NULL);
+
+	user = (XS_USER *) G_VAR(user_base);
+	while (user != NULL) {
+		for (db = user->db; db != NULL; db = db->next) {
+			if (db->dcount == 0 || db->fd < 0 || strcmp(db->name, DEFAULT_DB_NAME)
+					|| (db->flag & (XS_DBF_TOCLEAN | XS_DBF_STUB | XS_DBF_REBUILD_MASK))) {
+				continue;
+			}
+			left = delta_time - (int) (now - db->dtime);
+			if (left <= 0 && db->dpid == 0 && import_num < import_budget()) {
+				db_delta_call(db, user);
+			} else {
+				left = left > 0 ? left * 1000 : delta_time * 1000;
+				if (wait < 0 || left < wait) {
+					wait = left;
+				}
+			}
+		}
+		user = user->next;
+	}
+	if (wait >= 0) {
+		conn_server_add_timer(wait);
+	}
+}
+
 /**
  * Safe write data into file description
  * @return zero on success, -1 on failure
@@ -402,6 +685,9 @@ static inline void main_cleanup()
 		log_notice("terminated, check to commit all db");
 		db_commit_check();
 
+		if (repl_pid > 0) {
+			kill(repl_pid, SIGTERM);
+		}
 		xs_user_deinit();
 		G_VAR_FREE(user_base);
 		G_DEINIT();
@@ -420,8 +706,28 @@ int signal_term(int sig)
 	return main_flag & FLAG_NO_ERROR ? 0 : -1;
 }
 
+/**
+ * Remove sub-databases of parallel rebuilding (<db>.re_<num>)
+ * @param repath path of rebuilding db
+ */
+static void rebuild_clean_shards(const char *repath)
+{
+	char buf[256];
+	int i;
+
+	for (i = 0; i < MAX_REBUILD_SHARDS; i++) {
+		sprintf(buf, "%s_%d", repath, i);
+		if (access(buf, R_OK) != 0) {
+			break;
+		}
+		log_notice("clean exists sub-database (PATH:%s)", buf);
+		rmdir_r(buf);
+	}
+}
+
 /**
  * Rename db after rebuilding
+ * Sub-databases are merged by external process at first if exist
  * @param db
  * @param user
  */
@@ -430,6 +736,25 @@ static void rebuild_wdb_end(XS_DB *db, XS_USER *user)
 	// NOTE: size must greater than (sizeof(user->home)+sizeof(db->name))
 	char dbre[256], dbpath[256];
 
+	// merge sub-databases into db.re, called again after merged
+	sprintf(dbre, "%s/%s.re_0", user->home, db->name);
+	if (!(db->flag & XS_DBF_REBUILD_MERGE) && !access(dbre, R_OK)) {
+		pid_t pid;
+		const char *args[] = { "xs-import", "-Q", "-M", dbre, NULL };
+
+		dbre[strlen(dbre) - 2] = '\0';
+		if ((pid = import_spawn(args)) > 0) {
+			log_notice("spawn a merge process (PID:%d, PATH:%s)", pid, dbre);
+			import_num++;
+			db->pid = pid;
+			db->flag |= XS_DBF_REBUILD_MERGE;
+		} else {
+			log_error("failed to fork merge process (DB:%s.%s, ERROR:%s)",
+					user->name, db->name, strerror(errno));
+		}
+		return;
+	}
+
 	// rename the db.re => db
 	sprintf(dbre, "%s/%s.re", user->home, db->name);
 	sprintf(dbpath, "%s/%s", user->home, db->name);
@@ -441,14 +766,91 @@ static void rebuild_wdb_end(XS_DB *db, XS_USER *user)
 
 	// clean db_a
 	if (!strcmp(db->name, DEFAULT_DB_NAME)) {
-		strcat(dbpath, "_a");
-		log_info("clean old archive database (PATH:%s)", dbpath);
-		rmdir_r(dbpath);
+		archive_clean(user);
 	}
 
 	// clean flag
 	db->flag &= ~XS_DBF_REBUILD_MASK;
 	db->flag |= XS_DBF_FORCE_COMMIT;
+	db_delta_reset(db, user);
+}
+
+/**
+ * Check to merge segments of archive db after importing, if its stub file was changed
+ * Merging runs as import of the db in background priority, see: xs-import -A
+ * @param db
+ * @param user
+ */
+static void db_archive_check(XS_DB *db, XS_USER *user)
+{
+	pid_t pid;
+	struct stat st;
+	char path[256];
+	const char *args[] = { "xs-import", "-Q", "-A", path, NULL };
+
+	sprintf(path, "%s/" ARCHIVE_DB_NAME, user->home);
+	if (strcmp(db->name, DEFAULT_DB_NAME) || stat(path, &st) != 0 || st.st_mtime == db->atime) {
+		return;
+	}
+	db->atime = st.st_mtime;
+	sprintf(path, "%s/%s", user->home, db->name);
+	if ((pid = import_spawn(args)) > 0) {
+		log_notice("spawn an archive merge (PID:%d, DB:%s.%s)", pid, user->name, db->name);
+		import_num++;
+		db->pid = pid;
+		db->flag |= XS_DBF_ARCHIVE_MERGE;
+	} else {
+		log_error("failed to fork archive merge (DB:%s.%s, ERROR:%s)",
+				user->name, db->name, strerror(errno));
+	}
+}
+
+/**
+ * Call external program to optimize the db online, importing is paused until it exits
+ * @param db
+ * @param user
+ */
+static void db_optimize_call(XS_DB *db, XS_USER *user)
+{
+	pid_t pid;
+	char path[256];
+	const char *args[] = { "xs-import", "-Q", "-O", path, NULL };
+
+	sprintf(path, "%s/%s", user->home, db->name);
+	if ((pid = import_spawn(args)) > 0) {
+		log_notice("spawn an optimize process (PID:%d, DB:%s.%s)", pid, user->name, db->name);
+		import_num++;
+		db->pid = pid;
+		db->flag |= XS_DBF_OPTIMIZE;
+	} else {
+		log_error("failed to fork optimize process (DB:%s.%s, ERROR:%s)",
+				user->name, db->name, strerror(errno));
+	}
+}
+
+/**
+ * Call external program to take a snapshot of the db, importing is paused until it exits
+ * Requests are still saved into rcvfile, so db, segments of archive and stub file are copied consistently
+ * @param db
+ * @param user
+ * @param path snapshot directory
+ */
+static void db_snapshot_call(XS_DB *db, XS_USER *user, char *path)
+{
+	pid_t pid;
+	char dbpath[256];
+	const char *args[] = { "xs-import", "-Q", "-X", path, dbpath, NULL };
+
+	sprintf(dbpath, "%s/%s", user->home, db->name);
+	if ((pid = import_spawn(args)) > 0) {
+		log_notice("spawn a snapshot process (PID:%d, DB:%s.%s, PATH:%s)", pid, user->name, db->name, path);
+		import_num++;
+		db->pid = pid;
+		db->flag |= XS_DBF_SNAPSHOT;
+	} else {
+		log_error("failed to fork snapshot process (DB:%s.%s, ERROR:%s)",
+				user->name, db->name, strerror(errno));
+	}
 }
 
 /**
@@ -459,12 +861,27 @@ void signal_child(pid_t pid, int status)
 	char sndfile[256]; // size must greater than dbpath
 	XS_USER *user = NULL;
 	XS_DB *db;
+	int bg;
 
 	if (main_flag & FLAG_ON_EXIT) {
 		log_notice("skip exit report from child process (PID:%d, EXIT:%d)", pid, status);
 		return;
 	}
 
+	// warm import worker quit, fork imports directly
+	if (pid == worker_pid) {
+		log_error("import worker exit (PID:%d, EXIT:%d)", pid, status);
+		worker_pid = 0;
+		return;
+	}
+
+	// replication master quit, restart on next checking
+	if (pid == repl_pid) {
+		log_error("replication master exit (PID:%d, EXIT:%d)", pid, status);
+		repl_pid = 0;
+		return;
+	}
+
 	// reduce the import process num
 	import_num--;
 	if ((db = db_get_by_pid(pid, &user)) == NULL) {
@@ -472,9 +889,29 @@ void signal_child(pid_t pid, int status)
 		return;
 	}
 
+	// delta import exit
+	if (db->dpid == pid) {
+		db->dpid = 0;
+		log_info("delta import exit (DB:%s.%s, PID:%d, EXIT:%d)", user->name, db->name, pid, status);
+		if (db->flag & XS_DBF_DELTA_RESET) {
+			db->flag ^= XS_DBF_DELTA_RESET;
+			db_delta_reset(db, user);
+		} else if (status != 0) {
+			// try again on next checking
+			db->dcount++;
+		}
+		return;
+	}
+
 	// reset db struct
 	db->pid = 0;
+	bg = db->flag & (XS_DBF_ARCHIVE_MERGE | XS_DBF_OPTIMIZE | XS_DBF_SNAPSHOT);
+	db->flag &= ~(XS_DBF_ARCHIVE_MERGE | XS_DBF_OPTIMIZE | XS_DBF_SNAPSHOT);
 	time(&db->ltime);
+	if (status == 0 && db->icount > 0 && !(db->flag & XS_DBF_REBUILD_MASK)) {
+		commit_adapt(db->icount, (int) (db->ltime - db->itime));
+	}
+	db->icount = 0;
 
 	// logging
 	log_notice("import exit (DB:%s.%s%s, FLAG:0x%04x, PID:%d, EXIT:%d)",
@@ -488,6 +925,7 @@ void signal_child(pid_t pid, int status)
 		db->flag |= XS_DBF_FORCE_COMMIT;
 
 		unlink(sndfile);
+		db_delta_reset(db, user);
 		sprintf(sndfile, "%s/%s", user->home, db->name);
 		log_notice("clean marked database (PATH:%s)", sndfile);
 		if (rmdir_r(sndfile) != 0) {
@@ -495,11 +933,7 @@ void signal_child(pid_t pid, int status)
 					user->name, db->name, strerror(errno));
 		}
 		if (!strcmp(db->name, DEFAULT_DB_NAME)) {
-			strcat(sndfile, "_a");
-			if (!access(sndfile, R_OK)) {
-				log_notice("clean marked archive (PATH:%s)", sndfile);
-				rmdir_r(sndfile);
-			}
+			archive_clean(user);
 		}
 	} else if (db->flag & XS_DBF_REBUILD_STOP) {
 		db->flag &= ~XS_DBF_REBUILD_MASK;
@@ -515,11 +949,30 @@ void signal_child(pid_t pid, int status)
 			log_notice("clean exists rebuilt database (PATH:%s)", repath);
 			rmdir_r(repath);
 		}
+		rebuild_clean_shards(repath);
 
 		// marked as rebuild
 		db->flag ^= XS_DBF_REBUILD_WAIT;
 		unlink(sndfile);
 		log_notice("rebuild marked database (DB:%s.%s)", user->name, db->name);
+	} else if (db->flag & XS_DBF_REBUILD_MERGE) {
+		// sub-databases merged, sndfile is untouched
+		if (status == 0) {
+			rebuild_wdb_end(db, user);
+		} else {
+			db->flag ^= XS_DBF_REBUILD_MERGE;
+			log_error("failed to merge rebuilt sub-databases, retry on next commit (DB:%s.%s)",
+					user->name, db->name);
+		}
+	} else if (bg & XS_DBF_ARCHIVE_MERGE) {
+		// check again after next importing, stub file maybe changed in the same second
+		db->atime = 0;
+	} else if (bg & XS_DBF_OPTIMIZE) {
+		// requests arrived meanwhile are imported on next checking
+		log_notice("optimize %s (DB:%s.%s)", status == 0 ? "finished" : "failed", user->name, db->name);
+	} else if (bg & XS_DBF_SNAPSHOT) {
+		// SNAPSHOT_DONE_FILE is saved on success
+		log_notice("snapshot %s (DB:%s.%s)", status == 0 ? "finished" : "failed", user->name, db->name);
 	} else if (status == 0) {
 		// quit normal, remove sndfile
 		if (unlink(sndfile) != 0) {
@@ -529,12 +982,190 @@ void signal_child(pid_t pid, int status)
 		// check to rebuild end!
 		if (db->flag & XS_DBF_REBUILD_END) {
 			rebuild_wdb_end(db, user);
+		} else if (!(db->flag & XS_DBF_REBUILD_BEGIN)) {
+			// documents of delta db are searchable in main db now
+			db_delta_reset(db, user);
+			db_archive_check(db, user);
 		}
 	} else {
 		// quit excepional, keep sndfile for next trying
 	}
 }
 
+/**
+ * Stop using the warm import worker
+ */
+static void import_worker_stop()
+{
+	conn_server_set_watch(-1, NULL);
+	close(worker_fd);
+	worker_fd = -1;
+	worker_len = 0;
+	if (worker_pid > 0) {
+		kill(worker_pid, SIGTERM);
+	}
+}
+
+/**
+ * Read replies of warm import worker: "+<pid>" on forking, "-<pid> <status>" on exit
+ * Exit reports are handled as same as SIGCHLD, deferred until the pid got if waiting
+ * @param wait wait for the pid of new import
+ * @return pid of new import, 0 if not waiting, -1 on failure
+ */
+static pid_t import_worker_read(int wait)
+{
+	char *end, type;
+	int i, n, status, num_exit = 0, exits[32][2];
+	pid_t pid = -1;
+	struct pollfd pfd;
+
+	while (worker_fd >= 0) {
+		while ((end = (char *) memchr(worker_buf, '\n', worker_len)) != NULL) {
+			*end++ = '\0';
+			type = worker_buf[0];
+			status = 0;
+			sscanf(worker_buf + 1, "%d %d", &pid, &status);
+			worker_len -= end - worker_buf;
+			memmove(worker_buf, end, worker_len);
+			if (type == '-' && wait && num_exit < 32) {
+				exits[num_exit][0] = pid;
+				exits[num_exit++][1] = status;
+			} else if (type == '-') {
+				signal_child(pid, status);
+			} else if (type == '+' && wait) {
+				goto read_end;
+			}
+		}
+		if (worker_len == sizeof(worker_buf)) {
+			log_error("invalid reply of import worker (SIZE:%d)", worker_len);
+			break;
+		}
+		n = read(worker_fd, worker_buf + worker_len, sizeof(worker_buf) - worker_len);
+		if (n > 0) {
+			worker_len += n;
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && errno == EAGAIN) {
+			if (!wait) {
+				return 0;
+			}
+			pid = -1;
+			pfd.fd = worker_fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, 5000) == 0) {
+				log_error("timeout to wait for import worker (PID:%d)", worker_pid);
+				break;
+			}
+		} else {
+			log_error("failed to read from import worker (ERROR:%s)", n == 0 ? "EOF" : strerror(errno));
+			break;
+		}
+	}
+	if (worker_fd >= 0) {
+		import_worker_stop();
+	}
+	pid = -1;
+
+read_end:
+	for (i = 0; i < num_exit; i++) {
+		signal_child(exits[i][0], exits[i][1]);
+	}
+	return wait ? pid : 0;
+}
+
+/**
+ * Watch handler of the warm import worker
+ */
+static void import_worker_cb(int fd)
+{
+	import_worker_read(0);
+}
+
+/**
+ * Start warm import worker (xs-import -w) connected by socketpair
+ * It keeps the scws dictionaries loaded, and forks import processes for us
+ */
+static void import_worker_start()
+{
+	int sv[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		log_error("failed to create socketpair for import worker (ERROR:%s)", strerror(errno));
+		return;
+	}
+	if ((pid = fork()) == 0) {
+		close(sv[0]);
+		dup2(sv[1], STDIN_FILENO);
+		close(sv[1]);
+		EXTERNAL_CALL(xs_import, "xs-import", "-w");
+	} else if (pid > 0) {
+		close(sv[1]);
+		fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+		worker_fd = sv[0];
+		worker_pid = pid;
+		conn_server_set_watch(worker_fd, import_worker_cb);
+		log_notice("spawn import worker (PID:%d)", pid);
+	} else {
+		log_error("failed to fork import worker (ERROR:%s)", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+	}
+}
+
+/**
+ * Start replication master (xs-replicate -m) to serve changesets of databases
+ */
+static void replicate_start()
+{
+	pid_t pid;
+
+	if ((pid = fork()) == 0) {
+		EXTERNAL_CALL(xs_replicate, "xs-replicate", "-m", "-b", repl_bind, "-H", ".");
+	} else if (pid > 0) {
+		repl_pid = pid;
+		log_notice("spawn replication master (PID:%d, BIND:%s)", pid, repl_bind);
+	} else {
+		log_error("failed to fork replication master (ERROR:%s)", strerror(errno));
+	}
+}
+
+/**
+ * Spawn xs-import process, forked by warm worker if available
+ * @param args arguments, args[0] = "xs-import", ends with NULL
+ * @return pid of import process, or -1 on failure
+ */
+static pid_t import_spawn(const char **args)
+{
+	pid_t pid;
+
+	if (worker_fd >= 0) {
+		char buf[1024];
+		int i, len = 0;
+
+		for (i = 1; args[i] != NULL && len < sizeof(buf); i++) {
+			len += snprintf(buf + len, sizeof(buf) - len, "%s%c", args[i], args[i + 1] == NULL ? '\n' : '\t');
+		}
+		if (len >= sizeof(buf)) {
+			log_error("import arguments too long (SIZE:%d)", len);
+		} else if (safe_write(worker_fd, buf, len) != 0) {
+			log_error("failed to send request to import worker (ERROR:%s)", strerror(errno));
+			import_worker_stop();
+		} else if ((pid = import_worker_read(1)) > 0) {
+			return pid;
+		}
+	}
+
+	// fork & exec directly
+	if ((pid = fork()) == 0) {
+		usleep(50000);
+		log_dup2(STDOUT_FILENO);
+		log_dup2(STDERR_FILENO);
+		exit(execv(xs_import, (char * const *) args));
+	}
+	return pid;
+}
+
 /**
  * Shutdown gracefully
  */
@@ -558,16 +1189,15 @@ void signal_reload(int sig)
 
 /**
  * Update the effective size of swap file
- * @param fd file description
+ * @param db
  */
-static inline void update_eff_size(int fd)
+static inline void update_eff_size(XS_DB *db)
 {
+	int fd = db->fd;
 	off_t size = lseek(fd, 0, SEEK_CUR);
 
 	if (size > (sizeof(XS_CMD) + sizeof(struct xs_import_hdr))) {
-		lseek(fd, sizeof(XS_CMD) + offsetof(struct xs_import_hdr, eff_size), SEEK_SET);
-		write(fd, &size, sizeof(off_t));
-		lseek(fd, size, SEEK_SET);
+		pwrite(fd, &size, sizeof(off_t), sizeof(XS_CMD) + offsetof(struct xs_import_hdr, eff_size));
 	} else {
 		XS_CMD cmd;
 		struct xs_import_hdr hdr;
@@ -577,6 +1207,8 @@ static inline void update_eff_size(int fd)
 		cmd.cmd = CMD_IMPORT_HEADER;
 		cmd.blen = sizeof(struct xs_import_hdr);
 		hdr.eff_size = sizeof(XS_CMD) + sizeof(struct xs_import_hdr);
+		hdr.version = XS_IMPORT_VERSION;
+		db->flag &= ~XS_DBF_RCV_RAW;
 
 		lseek(fd, 0, SEEK_SET);
 		write(fd, &cmd, sizeof(XS_CMD));
@@ -586,26 +1218,84 @@ static inline void update_eff_size(int fd)
 }
 
 /**
- * Check the effective size of swap
+ * Scan forward the records beyond effective size
+ * Records saved before crash but missing in eff_size are kept, only the torn tail is dropped
  * @param fd file description
+ * @param off offset to begin scanning
+ * @param end file size
+ * @return offset of the end of last valid record
+ */
+static off_t scan_records(int fd, off_t off, off_t end)
+{
+	struct xs_import_rec rec;
+	char *buf = NULL;
+	unsigned int size = 0;
+
+	while ((end - off) >= sizeof(rec)) {
+		if (pread(fd, &rec, sizeof(rec), off) != sizeof(rec)
+				|| rec.magic != XS_IMPORT_REC_MAGIC || rec.size > (end - off - sizeof(rec))) {
+			break;
+		}
+		if (rec.size > size) {
+			char *buf2 = (char *) realloc(buf, rec.size);
+			if (buf2 == NULL) {
+				break;
+			}
+			buf = buf2;
+			size = rec.size;
+		}
+		if (pread(fd, buf, rec.size, off + sizeof(rec)) != rec.size
+				|| crc32c(0, buf, rec.size) != rec.crc) {
+			break;
+		}
+		off += sizeof(rec) + rec.size;
+	}
+	if (buf != NULL) {
+		free(buf);
+	}
+	return off;
+}
+
+/**
+ * Check the effective size of swap
+ * @param db
  */
-static inline void check_eff_size(int fd)
+static inline void check_eff_size(XS_DB *db)
 {
+	int fd = db->fd;
 	off_t file_size, eff_size = 0;
+	struct xs_import_hdr hdr;
 
 	file_size = lseek(fd, 0, SEEK_END);
-	lseek(fd, sizeof(XS_CMD) + offsetof(struct xs_import_hdr, eff_size), SEEK_SET);
+	if (pread(fd, &hdr, sizeof(hdr), sizeof(XS_CMD)) == sizeof(hdr)) {
+		eff_size = hdr.eff_size;
+	}
 
-	if (read(fd, &eff_size, sizeof(off_t)) != sizeof(off_t)
-			|| eff_size > file_size || eff_size <= (sizeof(XS_CMD) + sizeof(struct xs_import_hdr))) {
+	if (eff_size > file_size || eff_size < (sizeof(XS_CMD) + sizeof(struct xs_import_hdr))
+			|| (eff_size == (sizeof(XS_CMD) + sizeof(struct xs_import_hdr)) && hdr.version != XS_IMPORT_VERSION)) {
 		// invalid file, reset import header
 		if (file_size > 0) {
 			log_notice("reset import file header (FILE_SIZE:%ld, EFF_SIZE:%ld)",
 					file_size, eff_size);
 		}
 		lseek(fd, 0, SEEK_SET);
-		update_eff_size(fd);
+		update_eff_size(db);
 	} else {
+		if (hdr.version != XS_IMPORT_VERSION) {
+			// keep raw format until the file committed
+			log_notice("raw commands in import file (VERSION:%d, EFF_SIZE:%ld)", hdr.version, eff_size);
+			db->flag |= XS_DBF_RCV_RAW;
+		} else {
+			off_t size = scan_records(fd, eff_size, file_size);
+
+			db->flag &= ~XS_DBF_RCV_RAW;
+			if (size > eff_size) {
+				log_notice("recover records beyond effective size (EFF_SIZE:%ld, NEW_SIZE:%ld)",
+						eff_size, size);
+				eff_size = size;
+				pwrite(fd, &eff_size, sizeof(off_t), sizeof(XS_CMD) + offsetof(struct xs_import_hdr, eff_size));
+			}
+		}
 		// just update the filesize
 		// in fact, we need not truncate file to zero size
 		if (eff_size < file_size) {
@@ -639,10 +1329,213 @@ static inline void clean_uncommitted_data(XS_DB *db, XS_USER *user)
 	}
 #endif	/* LARGEFILE */
 
-	// clean current file
+	// clean current file, buffered requests are discarded also
+	db_release_waits(db, -2);
+	db->wlen = db->wcount = 0;
+	db_flush_wbuf(db, user);
 	lseek(db->fd, 0, SEEK_SET);
-	update_eff_size(db->fd);
+	update_eff_size(db);
 	db->count = db->lcount = 0;
+	db_delta_reset(db, user);
+}
+
+/**
+ * Append data into group commit buffer of rcvfile
+ * @return zero on success, -1 on failure
+ */
+static int db_wbuf_append(XS_DB *db, void *buf, int size)
+{
+	if ((db->wlen + size) > db->wsize) {
+		int wsize = db->wsize > 0 ? db->wsize : 8192;
+		char *wbuf;
+
+		while (wsize < (db->wlen + size)) {
+			wsize <<= 1;
+		}
+		if ((wbuf = (char *) realloc(db->wbuf, wsize)) == NULL) {
+			return -1;
+		}
+		db->wbuf = wbuf;
+		db->wsize = wsize;
+	}
+	memcpy(db->wbuf + db->wlen, buf, size);
+	db->wlen += size;
+	return 0;
+}
+
+/**
+ * Write the group commit buffer into rcvfile, sync it on demand
+ * Waiting connections are moved to the respond list
+ * @return zero on success, -1 on failure
+ */
+static int db_flush_wbuf(XS_DB *db, XS_USER *user)
+{
+	int rc = 0, cost;
+	struct timeval tv, tv2;
+
+	if (db->wlen > 0) {
+		gettimeofday(&tv, NULL);
+		if (safe_write(db->fd, db->wbuf, db->wlen) != 0) {
+			log_error("failed to write rcvfile (DB:%s.%s, SIZE:%d, ERROR:%s)",
+					user->name, db->name, db->wlen, strerror(errno));
+			rc = -1;
+		} else {
+			update_eff_size(db);
+			if (group_sync && DATA_SYNC(db->fd) != 0) {
+				log_error("failed to sync rcvfile (DB:%s.%s, ERROR:%s)",
+						user->name, db->name, strerror(errno));
+				rc = -1;
+			}
+			db->count += db->wcount;
+			db->dcount += db->wcount;
+			conn_server_add_num_task(db->wcount);
+		}
+		// observe latency of disk
+		gettimeofday(&tv2, NULL);
+		cost = (tv2.tv_sec - tv.tv_sec) * 1000 + (tv2.tv_usec - tv.tv_usec) / 1000;
+		disk_latency = (disk_latency * 3 + cost) >> 2;
+		if (cost > SLOW_DISK_LATENCY) {
+			log_notice("slow writing of rcvfile (DB:%s.%s, SIZE:%d, COST:%d, LATENCY:%d)",
+					user->name, db->name, db->wlen, cost, disk_latency);
+		}
+		log_debug("group commit rcvfile (DB:%s.%s, SIZE:%d, COUNT:%d, RET:%d)",
+				user->name, db->name, db->wlen, db->wcount, rc);
+		db->wlen = db->wcount = 0;
+	}
+	// release large buffer
+	if (db->wsize > GROUP_COMMIT_SIZE && db->wlen == 0) {
+		free(db->wbuf);
+		db->wbuf = NULL;
+		db->wsize = 0;
+	}
+
+	// move waiting connections to respond list
+	db_release_waits(db, rc);
+	return rc;
+}
+
+/**
+ * Move waiting connections of db to the respond list
+ * @param rc result of their requests: 0 -> persisted, -1 -> io error, -2 -> discarded
+ */
+static void db_release_waits(XS_DB *db, int rc)
+{
+	struct group_wait *gw;
+
+	if ((gw = (struct group_wait *) db->waits) != NULL) {
+		while (1) {
+			gw->rc = rc;
+			if (gw->next == NULL) {
+				break;
+			}
+			gw = gw->next;
+		}
+		gw->next = ack_head;
+		ack_head = (struct group_wait *) db->waits;
+		db->waits = NULL;
+		conn_server_add_timer(0);
+	}
+}
+
+/**
+ * Check whether more saving requests are already received completely
+ * Pipelined requests share one group commit instead of waiting a timer each
+ * @param conn
+ * @return 1 if the next saving request can be parsed without reading, otherwise 0
+ */
+static int conn_has_next_save(XS_CONN *conn)
+{
+	XS_CMD *cmd = conn->zcmd;
+	char *ptr, *end;
+	int in_rqst = 0;
+
+	if (conn->flag & CONN_FLAG_ZMALLOC) {
+		return 0;
+	}
+	ptr = (char *) cmd + XS_CMD_SIZE(cmd);
+	end = conn->rcv_buf + conn->rcv_size;
+	while ((end - ptr) >= (int) sizeof(XS_CMD)) {
+		cmd = (XS_CMD *) ptr;
+		ptr += XS_CMD_SIZE(cmd);
+		if (ptr > end) {
+			break;
+		}
+		// same order as index_zcmd_exec: request + ... (DOC) ... + submit
+		if (in_rqst) {
+			if (cmd->cmd == CMD_INDEX_SUBMIT) {
+				return 1;
+			}
+			if (!IS_RQST_CMD(cmd->cmd)) {
+				break;
+			}
+		} else if (cmd->cmd == CMD_INDEX_REQUEST) {
+			in_rqst = 1;
+		} else {
+			return (IS_INDEX_CMD(cmd->cmd) || cmd->cmd == CMD_INDEX_SUBMIT) ? 1 : 0;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Flush buffered requests of all dbs for the user
+ * @param user
+ */
+static void flush_user_wbuf(XS_USER *user)
+{
+	XS_DB *db;
+
+	for (db = user->db; db != NULL; db = db->next) {
+		db_flush_wbuf(db, user);
+	}
+}
+
+/**
+ * Check to commit or split rcvfile after new data saved
+ * @param db
+ * @param user
+ */
+static void db_queue_check(XS_DB *db, XS_USER *user)
+{
+	if (db->fd < 0) {
+		return;
+	}
+	if (db->count >= queue_size && db->pid == 0) {
+		log_notice("auto commit (DB:%s.%s, COUNT:%d)", user->name, db->name, db->count);
+		db_import_call(db, user);
+	}
+#if SIZEOF_OFF_T < 8
+	else if ((db->count - db->lcount) > queue_size) // check to split
+	{
+		struct stat st;
+
+		db->lcount = db->count;
+		if (!fstat(db->fd, &st) && st.st_size > MAX_SPLIT_SIZE) {
+			char rcvfile[128], rcvfile2[128], *suffix;
+			int i = 1;
+
+			// get filename
+			sprintf(rcvfile, DEFAULT_TEMP_DIR "%s_%s.rcv", user->name, db->name);
+			strcpy(rcvfile2, rcvfile);
+			suffix = rcvfile2 + strlen(rcvfile2);
+
+			do {
+				sprintf(suffix, ".%d", i++);
+			} while (access(rcvfile2, R_OK) == 0);
+
+			log_notice("auto split data (FILE:%s, COUNT:%d)", rcvfile2, db->count);
+			close(db->fd);
+			db->fd = -1;
+			db->count = db->lcount = 0;
+
+			// rename the file
+			if (rename(rcvfile, rcvfile2) != 0) {
+				log_error("failed to rename splitted file (FILE:%s, ERROR:%s)",
+						rcvfile2, strerror(errno));
+			}
+		}
+	}
+#endif	/* LAREFILE */
 }
 
 /**
@@ -680,6 +1573,7 @@ static int rebuild_conn_wdb(XS_CONN *conn)
 				log_notice("clean exists rebuilt database (PATH:%s)", repath);
 				rmdir_r(repath);
 			}
+			rebuild_clean_shards(repath);
 		}
 		db->flag |= XS_DBF_REBUILD_BEGIN;
 		return CONN_RES_OK(DB_REBUILD);
@@ -739,13 +1633,10 @@ static int remove_conn_wdb(XS_CONN *conn)
 		} else {
 			// remove the database from disk
 			log_debug_conn("remove the whole database (PATH:%s)", dbpath);
+			db_delta_reset(db, conn->user);
 			if (rmdir_r(dbpath) == 0) {
 				if (!strcmp(db->name, DEFAULT_DB_NAME)) {
-					strcat(dbpath, "_a");
-					if (!access(dbpath, R_OK)) {
-						log_notice_conn("remove the archive database (PATH:%s)", dbpath);
-						rmdir_r(dbpath);
-					}
+					archive_clean(conn->user);
 				}
 				return CONN_RES_OK(DB_CLEAN);
 			}
@@ -758,15 +1649,17 @@ static int remove_conn_wdb(XS_CONN *conn)
 
 /**
  * Save current request data into rcvfile
+ * The data is buffered and connection is paused until the group commit finished
  * @param conn
  * @return CMD_RES_xxx
  */
 static int save_conn_request(XS_CONN *conn)
 {
-	int last_count, rc = CMD_RES_CONT;
-	off_t off;
+	int last_len, last_count, rc = CMD_RES_CONT;
 	XS_CMD *cmd = conn->zcmd;
 	XS_DB *db;
+	struct group_wait *gw;
+	struct xs_import_rec rec;
 
 	// load default db
 	if ((db = get_conn_wdb(conn)) == NULL) {
@@ -785,13 +1678,17 @@ static int save_conn_request(XS_CONN *conn)
 			goto save_end;
 		}
 		log_debug_conn("check rcvfile header (FILE:%s)", rcvfile);
-		check_eff_size(db->fd);
+		check_eff_size(db);
 	}
 
-	// parse & save the commands
-	last_count = db->count;
-	off = lseek(db->fd, 0, SEEK_CUR);
-	if (cmd->cmd == CMD_INDEX_EXDATA) {
+	// parse & save the commands into buffer
+	last_len = db->wlen;
+	last_count = db->wcount;
+	memset(&rec, 0, sizeof(rec));
+	if (!(db->flag & XS_DBF_RCV_RAW) && db_wbuf_append(db, &rec, sizeof(rec)) != 0) {
+		// record header, filled after commands saved
+		rc = CMD_RES_NOMEM;
+	} else if (cmd->cmd == CMD_INDEX_EXDATA) {
 		char *buf = XS_CMD_BUF(cmd);
 		unsigned int off = 0, blen = XS_CMD_BLEN(cmd);
 
@@ -813,90 +1710,96 @@ static int save_conn_request(XS_CONN *conn)
 				continue;
 			}
 
-			// write the data
-			if (safe_write(db->fd, cmd, XS_CMD_SIZE(cmd)) != 0) {
-				rc = CMD_RES_IOERR;
+			// buffer the data
+			if (db_wbuf_append(db, cmd, XS_CMD_SIZE(cmd)) != 0) {
+				rc = CMD_RES_NOMEM;
 				break;
 			}
 
 			// add count (requst|remove|synonyms)
 			if (IS_INDEX_CMD(cmd->cmd)) {
-				db->count++;
+				db->wcount++;
 			}
 		}
 	} else if (cmd->cmd == CMD_INDEX_REMOVE || cmd->cmd == CMD_INDEX_SYNONYMS) {
-		if (safe_write(db->fd, cmd, XS_CMD_SIZE(cmd)) == 0) {
-			db->count++;
+		if (db_wbuf_append(db, cmd, XS_CMD_SIZE(cmd)) == 0) {
+			db->wcount++;
 		} else {
-			rc = CMD_RES_IOERR;
+			rc = CMD_RES_NOMEM;
 		}
 	} else if (cmd->cmd == CMD_INDEX_SUBMIT) {
 		XS_CMDS *cmds;
 
 		// save cmds
 		for (cmds = conn->zhead; cmds != NULL; cmds = cmds->next) {
-			if (safe_write(db->fd, cmds->cmd, XS_CMD_SIZE(cmds->cmd)) != 0) {
+			if (db_wbuf_append(db, cmds->cmd, XS_CMD_SIZE(cmds->cmd)) != 0) {
 				break;
 			}
 		}
 		// save submit cmd
-		if (cmds != NULL || safe_write(db->fd, cmd, XS_CMD_SIZE(cmd)) != 0) {
-			rc = CMD_RES_IOERR;
+		if (cmds != NULL || db_wbuf_append(db, cmd, XS_CMD_SIZE(cmd)) != 0) {
+			rc = CMD_RES_NOMEM;
 		} else {
-			db->count++;
+			db->wcount++;
 		}
 	}
-	// update effective size or restore offset
-	if (rc == CMD_RES_IOERR) {
-		lseek(db->fd, off, SEEK_SET);
-		rc = CONN_RES_ERR(IOERR);
+	// find the pending group commit of previous pipelined requests
+	for (gw = (struct group_wait *) db->waits; gw != NULL; gw = gw->next) {
+		if (gw->conn == conn) {
+			break;
+		}
+	}
+	// restore the buffer
+	if (rc == CMD_RES_NOMEM) {
+		log_error_conn("failed to allocate memory for rcvfile buffer (SIZE:%d)", db->wsize);
+		db->wlen = last_len;
+		db->wcount = last_count;
+		if (gw != NULL) {
+			// respond after the previous requests
+			gw->nomem = 1;
+			rc = CMD_RES_PAUSE;
+		} else {
+			rc = CONN_RES_ERR(NOMEM);
+		}
 		goto save_end;
 	}
-	update_eff_size(db->fd);
-
-	// update num task
-	conn_server_add_num_task(db->count - last_count);
 
-	// check to commit
-	if (db->count >= queue_size && db->pid == 0) {
-		log_notice_conn("auto commit (DB:%s.%s, COUNT:%d)", conn->user->name, db->name, db->count);
-		db_import_call(db, conn->user);
+	// fill the record header, drop it if nothing saved
+	if (!(db->flag & XS_DBF_RCV_RAW) && db->wlen == (last_len + (int) sizeof(rec))) {
+		db->wlen = last_len;
+	} else if (!(db->flag & XS_DBF_RCV_RAW)) {
+		rec.magic = XS_IMPORT_REC_MAGIC;
+		rec.size = db->wlen - last_len - sizeof(rec);
+		rec.crc = crc32c(0, db->wbuf + last_len + sizeof(rec), rec.size);
+		memcpy(db->wbuf + last_len, &rec, sizeof(rec));
 	}
-#if SIZEOF_OFF_T < 8
-	else if ((db->count - db->lcount) > queue_size) // check to split
-	{
-		struct stat st;
-
-		db->lcount = db->count;
-		if (!fstat(db->fd, &st) && st.st_size > MAX_SPLIT_SIZE) {
-			char rcvfile[128], rcvfile2[128], *suffix;
-			int i = 1;
-
-			// get filename
-			sprintf(rcvfile, DEFAULT_TEMP_DIR "%s_%s.rcv", conn->user->name, db->name);
-			strcpy(rcvfile2, rcvfile);
-			suffix = rcvfile2 + strlen(rcvfile2);
-
-			do {
-				sprintf(suffix, ".%d", i++);
-			} while (access(rcvfile2, R_OK) == 0);
 
-			log_notice_conn("auto split data (FILE:%s, COUNT:%d)", rcvfile2, db->count);
-			close(db->fd);
-			db->fd = -1;
-			db->count = db->lcount = 0;
-
-			// rename the file
-			if (rename(rcvfile, rcvfile2) != 0) {
-				log_error_conn("failed to rename splitted file (FILE:%s, ERROR:%s)",
-						rcvfile2, strerror(errno));
+	// tagged request must be responded in place, write it at once
+	if (conn->flag & CONN_FLAG_CAPTURE) {
+		rc = db_flush_wbuf(db, conn->user);
+		db_queue_check(db, conn->user);
+		rc = (rc == 0 ? CONN_RES_OK(RQST_FINISHED) : CONN_RES_ERR(IOERR));
+	} else {
+		if (gw == NULL) {
+			debug_malloc(gw, sizeof(struct group_wait), struct group_wait);
+			if (gw == NULL) {
+				log_error_conn("failed to allocate memory for group commit");
+				db->wlen = last_len;
+				db->wcount = last_count;
+				rc = CONN_RES_ERR(NOMEM);
+				goto save_end;
 			}
+			gw->conn = conn;
+			gw->num = gw->nomem = 0;
+			gw->next = (struct group_wait *) db->waits;
+			db->waits = gw;
 		}
+		gw->num++;
+		conn_server_add_timer(db->wlen >= GROUP_COMMIT_SIZE ? 0 : group_time);
+		// buffer the following received requests, then pause until the group commit finished
+		rc = (gw->num < 0x7fff && db->wlen < GROUP_COMMIT_SIZE && conn_has_next_save(conn))
+				? CMD_RES_CONT : CMD_RES_PAUSE;
 	}
-#endif	/* LAREFILE */
-
-	// finished
-	rc = CONN_RES_OK(RQST_FINISHED);
 
 save_end:
 	// clean cmds & return
@@ -926,6 +1829,7 @@ static int index_zcmd_exec(XS_CONN *conn)
 		case CMD_DELETE_PROJECT:
 			// delete current project
 			log_info_conn("try to delete project (USER:%s, HOME:%s)", conn->user->name, conn->user->home);
+			flush_user_wbuf(conn->user);
 			if (rmdir_r(conn->user->home) != 0) {
 				log_error_conn("failed to remove user home (HOME:%s, ERROR:%s)",
 						conn->user->home, strerror(errno));
@@ -987,7 +1891,7 @@ static int index_zcmd_exec(XS_CONN *conn)
 			break;
 			// force to flush logging
 		case CMD_FLUSH_LOGGING:
-			if (import_num >= MAX_IMPORT_NUM) {
+			if (import_num >= import_budget()) {
 				rc = CONN_RES_ERR(BUSY);
 			} else {
 				log_info_conn("force to call xs-logging (USER:%s)", conn->user->name);
@@ -1076,7 +1980,7 @@ static int index_zcmd_exec(XS_CONN *conn)
 				rc = CONN_RES_ERR(NODB);
 			} else if (conn->wdb->pid != 0) {
 				rc = CONN_RES_ERR(RUNNING);
-			} else if (import_num >= MAX_IMPORT_NUM) {
+			} else if (import_num >= import_budget()) {
 				rc = CONN_RES_ERR(BUSY);
 			} else {
 				log_info_conn("force to commit (DB:%s.%s)", conn->user->name, conn->wdb->name);
@@ -1084,6 +1988,78 @@ static int index_zcmd_exec(XS_CONN *conn)
 				rc = CONN_RES_OK(DB_COMMITED);
 			}
 			break;
+			// optimize current db in background
+		case CMD_INDEX_OPTIMIZE:
+			if (get_conn_wdb(conn) == NULL) {
+				rc = CONN_RES_ERR(NODB);
+			} else if (conn->wdb->flag & XS_DBF_STUB) {
+				rc = CMD_RES_UNIMP;
+			} else if (conn->wdb->flag & XS_DBF_REBUILD_MASK) {
+				rc = CONN_RES_ERR(REBUILDING);
+			} else if (conn->wdb->pid != 0) {
+				rc = CONN_RES_ERR(RUNNING);
+			} else if (import_num >= import_budget()) {
+				rc = CONN_RES_ERR(BUSY);
+			} else {
+				log_info_conn("optimize db online (DB:%s.%s)", conn->user->name, conn->wdb->name);
+				db_optimize_call(conn->wdb, conn->user);
+				rc = CONN_RES_OK(DB_OPTIMIZE);
+			}
+			break;
+		case CMD_INDEX_SNAPSHOT:
+			if (get_conn_wdb(conn) == NULL) {
+				rc = CONN_RES_ERR(NODB);
+			} else if (conn->wdb->flag & XS_DBF_STUB) {
+				rc = CMD_RES_UNIMP;
+			} else {
+				char name[XS_MAX_NAME_LEN] = "", path[256];
+				int len = XS_CMD_BLEN(cmd), err = CMD_OK;
+
+				if (len == 0 && cmd->arg1 != 1) {
+					time_t now = time(NULL);
+					len = strftime(name, sizeof(name), "%Y%m%d%H%M%S", localtime(&now));
+				} else if ((err = xs_user_check_name(XS_CMD_BUF(cmd), len)) == CMD_OK) {
+					memcpy(name, XS_CMD_BUF(cmd), len);
+					name[len] = '\0';
+				}
+				sprintf(path, "%s/" SNAPSHOT_DIR "/%s", conn->user->home, name);
+				if (err == CMD_ERR_TOOLONG) {
+					rc = CONN_RES_ERR(TOOLONG);
+				} else if (err == CMD_ERR_INVALIDCHAR) {
+					rc = CONN_RES_ERR(INVALIDCHAR);
+				} else if (err == CMD_ERR_EMPTY) {
+					rc = CONN_RES_ERR(EMPTY);
+				} else if (cmd->arg1 == 1) {
+					// query status: finished, running or failed (removed)
+					char done[sizeof(path) + sizeof(SNAPSHOT_DONE_FILE)];
+
+					sprintf(done, "%s/" SNAPSHOT_DONE_FILE, path);
+					if (access(done, F_OK) == 0) {
+						rc = CONN_RES_OK3(DB_SNAPSHOT, name, len);
+					} else if ((conn->wdb->flag & XS_DBF_SNAPSHOT) && access(path, F_OK) == 0) {
+						rc = CONN_RES_ERR(RUNNING);
+					} else {
+						rc = CONN_RES_ERR(SNAPSHOT);
+					}
+				} else if (conn->wdb->flag & XS_DBF_REBUILD_MASK) {
+					rc = CONN_RES_ERR(REBUILDING);
+				} else if (conn->wdb->pid != 0) {
+					rc = CONN_RES_ERR(RUNNING);
+				} else if (import_num >= import_budget()) {
+					rc = CONN_RES_ERR(BUSY);
+				} else if (access(path, F_OK) == 0) {
+					rc = CONN_RES_ERR(EXISTS);
+				} else {
+					sprintf(path, "%s/" SNAPSHOT_DIR, conn->user->home);
+					mkdir(path, 0755);
+					sprintf(path, "%s/" SNAPSHOT_DIR "/%s", conn->user->home, name);
+					log_info_conn("take snapshot of db (DB:%s.%s, NAME:%s)",
+							conn->user->name, conn->wdb->name, name);
+					db_snapshot_call(conn->wdb, conn->user, path);
+					rc = CONN_RES_OK3(DB_SNAPSHOT, name, len);
+				}
+			}
+			break;
 			// request + ... (DOC) ... + submit => respond
 		case CMD_INDEX_REQUEST:
 			conn->flag |= CONN_FLAG_IN_RQST;
@@ -1128,15 +2104,72 @@ static int index_zcmd_exec(XS_CONN *conn)
 	return rc;
 }
 
+/**
+ * Timer handler of listening server, group commit all buffered requests
+ * Respond the waiting connections and resume them
+ */
+static void index_group_commit()
+{
+	XS_USER *user;
+	XS_DB *db;
+	XS_CONN *conn;
+	struct group_wait *gw;
+	int rc;
+
+	user = (XS_USER *) G_VAR(user_base);
+	while (user != NULL) {
+		for (db = user->db; db != NULL; db = db->next) {
+			if (db->wlen > 0 || db->waits != NULL) {
+				db_flush_wbuf(db, user);
+				db_queue_check(db, user);
+			}
+		}
+		user = user->next;
+	}
+	if (delta_time > 0) {
+		db_delta_check();
+	}
+
+	// NOTE: new waiting connections maybe added during resuming
+	while ((gw = ack_head) != NULL) {
+		ack_head = gw->next;
+		conn = gw->conn;
+		for (rc = CMD_RES_CONT; gw->num > 0 && rc == CMD_RES_CONT; gw->num--) {
+			if (gw->rc == 0) {
+				rc = CONN_RES_OK(RQST_FINISHED);
+			} else if (gw->rc == -2) {
+				rc = CONN_RES_ERR(DISCARDED);
+			} else {
+				rc = CONN_RES_ERR(IOERR);
+			}
+		}
+		if (gw->nomem && rc == CMD_RES_CONT) {
+			rc = CONN_RES_ERR(NOMEM);
+		}
+		debug_free(gw);
+		if (rc != CMD_RES_CONT) {
+			conn_quit(conn, rc);
+		} else {
+			conn_server_resume(conn);
+		}
+	}
+}
+
 /**
  * Timeout handler of listening server
  */
 static void index_server_timeout()
 {
 	db_commit_check();
-	if (import_num < MAX_IMPORT_NUM) {
+	if (delta_time > 0) {
+		db_delta_check();
+	}
+	if (import_num < import_budget()) {
 		xs_logging_call(NULL);
 	}
+	if (repl_bind != NULL && repl_pid == 0) {
+		replicate_start();
+	}
 }
 
 /**
@@ -1154,6 +2187,9 @@ int main(int argc, char *argv[])
 	home = PREFIX;
 	bind = DEFAULT_BIND_PATH;
 	queue_size = DEFAULT_QUEUE_SIZE;
+	import_max = MAX_IMPORT_NUM;
+	commit_count = MIN_COMMIT_COUNT;
+	group_time = DEFAULT_GROUP_TIME;
 	epath = DEFAULT_BIN_PATH;
 
 	time(&time_logging);
@@ -1171,7 +2207,7 @@ int main(int argc, char *argv[])
 	}
 
 	// parse arguments, NOTE: optarg maybe changed by setproctitle()
-	while ((cc = getopt(argc, argv, "FvhL:H:b:k:l:q:e:?")) != -1) {
+	while ((cc = getopt(argc, argv, "FvhL:H:R:b:k:l:q:c:g:d:r:s:e:?")) != -1) {
 		switch (cc) {
 			case 'F': main_flag |= FLAG_FOREGROUND;
 				break;
@@ -1194,8 +2230,41 @@ int main(int argc, char *argv[])
 					queue_size = DEFAULT_QUEUE_SIZE;
 				}
 				break;
+			case 'c':
+				import_max = atoi(optarg);
+				if (import_max < 1 || import_max > MAX_IMPORT_LIMIT) {
+					import_max = MAX_IMPORT_NUM;
+				}
+				break;
+			case 'g':
+				group_time = atoi(optarg);
+				if (group_time < 0 || group_time > MAX_GROUP_TIME) {
+					group_time = DEFAULT_GROUP_TIME;
+				}
+				break;
+			case 'd':
+				delta_time = atoi(optarg);
+				if (delta_time < 0 || delta_time > MAX_DELTA_TIME) {
+					delta_time = 0;
+				}
+				break;
+			case 'r':
+				rebuild_shards = atoi(optarg);
+				if (rebuild_shards < 0 || rebuild_shards > MAX_REBUILD_SHARDS) {
+					rebuild_shards = 0;
+				}
+				break;
+			case 's':
+				if (!strcasecmp(optarg, "fdatasync")) {
+					group_sync = 1;
+				} else if (strcasecmp(optarg, "none")) {
+					fprintf(stderr, "WARNING: unknown sync mode, fallback to none (MODE:%s)\n", optarg);
+				}
+				break;
 			case 'e': epath = optarg;
 				break;
+			case 'R': repl_bind = optarg;
+				break;
 			case 'v':
 				show_version();
 				break;
@@ -1234,6 +2303,17 @@ int main(int argc, char *argv[])
 		goto main_end;
 	}
 
+	// changesets are written by imports for replicas
+	if (repl_bind != NULL) {
+		snprintf(xs_replicate, sizeof(xs_replicate), "%s/xs-replicate", epath);
+		if (access(xs_replicate, X_OK) < 0) {
+			fprintf(stderr, "ERROR: `xs-replicate' program checking failure (FILE:%s, ERROR:%s)\n",
+					xs_replicate, strerror(errno));
+			goto main_end;
+		}
+		setenv("XAPIAN_MAX_CHANGESETS", REPLICATE_CHANGESETS, 1);
+	}
+
 	// just run the control signal `-k'
 	if (ctrl != NULL) {
 		pcntl_kill(bind, ctrl, prog_name);
@@ -1288,6 +2368,11 @@ int main(int argc, char *argv[])
 	conn_server_init();
 	conn_server_set_zcmd_handler(index_zcmd_exec);
 	conn_server_set_timeout_handler(index_server_timeout);
+	conn_server_set_timer_handler(index_group_commit);
+	import_worker_start();
+	if (repl_bind != NULL) {
+		replicate_start();
+	}
 	conn_server_start(cc);
 
 	// finished gracefully
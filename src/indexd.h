@@ -13,7 +13,20 @@
 
 #define	MIN_COMMIT_COUNT		100			// number of changed
 #define	MIN_COMMIT_TIME			180			// seconds
-#define	MAX_IMPORT_NUM			5			// number of concurrent import processes
+#define	MAX_IMPORT_NUM			5			// number of concurrent import processes (default)
+#define	MAX_IMPORT_LIMIT		32			// max value of concurrent import processes
+
+#define	MAX_COMMIT_PENDING		256			// max dbs to be ordered in one commit check
+#define	COMMIT_BATCH_TIME		10			// seconds of import work expected for a batch
+#define	SLOW_DISK_LATENCY		100			// msec to write rcvfile, halve import budget if slower
+
+#define	GROUP_COMMIT_SIZE		262144		// flush rcvfile buffer at once if reach this size
+#define	DEFAULT_GROUP_TIME		0			// msec to wait for group commit (0 -> next loop)
+#define	MAX_GROUP_TIME			1000		// max msec to wait for group commit
+
+#define	MAX_REBUILD_SHARDS		16			// max sub-databases to rebuild in parallel
+#define	MAX_DELTA_TIME			60			// max seconds to import delta db (near-real-time)
+#define	REPLICATE_CHANGESETS	"100"		// changesets kept by each db for replicas (XAPIAN_MAX_CHANGESETS)
 
 #if SIZEOF_OFF_T < 8
 #define	MAX_SPLIT_FILES			10			// max split files (xxx_xx.rcv.[NUM])
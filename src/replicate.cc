@@ -0,0 +1,755 @@
+/**
+ * Replicate project databases from index server to search replicas
+ * Master: serve Xapian changesets of databases under data/, spawned by indexd (-R)
+ * Replica: pull changesets into local data/ periodically, searched by local searchd
+ *
+ * Protocol (one request per connection, line terminated):
+ *   LIST                     -> "D <project>/<db>\n" ... "F <project>/<file> <size> <mtime>\n" ... ".\n"
+ *   FILE <project>/<file>    -> raw contents of the file
+ *   SYNC <project>/<db> <hex of revision info> -> Xapian replication stream
+ *
+ * $Id: $
+ */
+
+#ifdef HAVE_CONFIG_H
+#    include "config.h"
+#endif
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <xapian.h>
+#include <xapian/replication.h>
+#include <map>
+
+#include "log.h"
+#include "global.h"
+
+#define	DEFAULT_REPLICATE_PORT	8385		// default port of replication master
+#define	DEFAULT_SYNC_INTERVAL	5			// seconds between replica pulls
+#define	MAX_LINE_SIZE			1024
+#define	READER_CLOSE_TIME		5.0			// seconds to wait before a full copy replaces the live one
+
+/* global flag settings */
+#define	FLAG_MASTER			0x01	// run as master
+#define	FLAG_ONCE			0x02	// replica: pull once then exit
+
+using std::string;
+
+/* local global variables */
+static char *prog_name;
+static int flag;
+
+/**
+ * Show version information
+ */
+static void show_version()
+{
+	printf("%s: %s/%s (replicator)\n", prog_name, PACKAGE_NAME, PACKAGE_VERSION);
+	exit(0);
+}
+
+/**
+ * Usage help
+ */
+static void show_usage()
+{
+	printf("%s (%s/%s) - Database Replicator\n", prog_name, PACKAGE_NAME, PACKAGE_VERSION);
+	printf("Copyright (C)2007-2011 hightman, HangZhou YunSheng Network Co., Ltd.\n\n");
+
+	printf("Usage: %s [options]\n", prog_name);
+	printf("  -m               Run as master, serve changesets of local databases\n");
+	printf("  -b <port>|<address:port>\n");
+	printf("                   Bind the master to address/port, (default: %d)\n", DEFAULT_REPLICATE_PORT);
+	printf("  -s <host>[:port] Run as replica, pull databases from the master\n");
+	printf("  -p <project>     Replicate the specified project only, (default: all)\n");
+	printf("  -i <sec>         Set the interval of pulling, (default: %d)\n", DEFAULT_SYNC_INTERVAL);
+	printf("  -1               Pull once then exit\n");
+	printf("  -H <home>        Specify the working directory\n");
+	printf("                   Default: " PREFIX "\n");
+	printf("  -Q               Completely quiet mode, not output any information\n");
+	printf("  -V               Enable verbose mode, show more messages\n");
+	printf("  -v               Show version information\n");
+	printf("  -h               Display this help page\n\n");
+	printf("NOTE: changesets are kept by imports only if indexd is started with `-R'\n");
+	printf("Compiled with xapian-core-scws-" XAPIAN_VERSION "\n");
+	exit(0);
+}
+
+/**
+ * Check the name of replicated entry: <project>/<name>, without hidden or parent path
+ */
+static bool check_name(const char *name)
+{
+	const char *ptr = strchr(name, '/');
+
+	if (ptr == NULL || ptr == name || strchr(ptr + 1, '/') != NULL) {
+		return false;
+	}
+	return name[0] != '.' && ptr[1] != '.' && ptr[1] != '\0';
+}
+
+/**
+ * Check whether the file under project home should be replicated
+ */
+static bool is_repl_file(const char *name)
+{
+	int len = strlen(name);
+
+	if (!strcmp(name, ARCHIVE_DB_NAME) || !strcmp(name, CUSTOM_DICT_FILE)) {
+		return true;
+	}
+	// zdict_<id>.dat, the symbol link is used to compress only
+	return len > 9 && !strncmp(name, ZDICT_FILE "_", sizeof(ZDICT_FILE)) && !strcmp(name + len - 4, ".dat");
+}
+
+/**
+ * Read a line from socket without buffering, the rest belongs to the stream
+ * @return length of line, -1 on failure
+ */
+static int read_line(int fd, char *buf, int size)
+{
+	int len = 0;
+
+	while (len < size - 1) {
+		int n = read(fd, buf + len, 1);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		if (buf[len] == '\n') {
+			break;
+		}
+		len++;
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+/**
+ * Write all data into socket
+ * @return zero on success, -1 on failure
+ */
+static int write_all(int fd, const char *buf, int size)
+{
+	while (size > 0) {
+		int n = write(fd, buf, size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		buf += n;
+		size -= n;
+	}
+	return 0;
+}
+
+/**
+ * Encode/decode revision info (binary) to send in request line
+ */
+static string hex_encode(const string &s)
+{
+	static const char hex[] = "0123456789abcdef";
+	string r;
+
+	for (string::const_iterator it = s.begin(); it != s.end(); it++) {
+		r += hex[((unsigned char) *it) >> 4];
+		r += hex[((unsigned char) *it) & 0x0f];
+	}
+	return r;
+}
+
+static string hex_decode(const char *p)
+{
+	string r;
+
+	while (p[0] != '\0' && p[1] != '\0') {
+		char tmp[3] = {p[0], p[1], '\0'};
+		r += (char) strtol(tmp, NULL, 16);
+		p += 2;
+	}
+	return r;
+}
+
+/**
+ * Check whether the directory is a Xapian database
+ * @param path
+ * @param replica true to check databases created by DatabaseReplica
+ */
+static bool is_db_dir(const string &path, bool replica)
+{
+	if (replica) {
+		return access((path + "/XAPIANDB").data(), R_OK) == 0;
+	}
+	return access((path + "/iamglass").data(), R_OK) == 0
+			|| access((path + "/iamchert").data(), R_OK) == 0;
+}
+
+/**
+ * Parse <host>[:port] or <port> into socket address
+ * @return true on success
+ */
+static bool parse_addr(const char *addr, struct sockaddr_in *sin)
+{
+	char host[128];
+	const char *ptr;
+	int port = DEFAULT_REPLICATE_PORT;
+
+	memset(sin, 0, sizeof(struct sockaddr_in));
+	sin->sin_family = AF_INET;
+	host[0] = '\0';
+	if ((ptr = strchr(addr, ':')) != NULL) {
+		if ((ptr - addr) >= (int) sizeof(host)) {
+			return false;
+		}
+		strncpy(host, addr, ptr - addr);
+		host[ptr - addr] = '\0';
+		port = atoi(ptr + 1);
+	} else if (strspn(addr, "0123456789") == strlen(addr)) {
+		port = atoi(addr);
+	} else {
+		strncpy(host, addr, sizeof(host) - 1);
+		host[sizeof(host) - 1] = '\0';
+	}
+	if (port <= 0 || port > 65535) {
+		return false;
+	}
+	sin->sin_port = htons(port);
+	if (!host[0] || host[0] == '*') {
+		sin->sin_addr.s_addr = htonl(INADDR_ANY);
+	} else if ((sin->sin_addr.s_addr = inet_addr(host)) == INADDR_NONE) {
+		struct hostent *he = gethostbyname(host);
+		if (he == NULL || he->h_addrtype != AF_INET) {
+			return false;
+		}
+		memcpy(&sin->sin_addr, he->h_addr, sizeof(sin->sin_addr));
+	}
+	return true;
+}
+
+/**
+ * Serve LIST request: databases & files of all projects
+ */
+static void master_list(int fd)
+{
+	DIR *dirp, *dirp2;
+	struct dirent *de, *de2;
+	struct stat st;
+	char buf[MAX_LINE_SIZE];
+	string out;
+
+	if ((dirp = opendir(DEFAULT_DATA_DIR)) == NULL) {
+		log_error("failed to open data directory (ERROR:%s)", strerror(errno));
+		return;
+	}
+	while ((de = readdir(dirp)) != NULL) {
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		string home = string(DEFAULT_DATA_DIR) + de->d_name;
+		if ((dirp2 = opendir(home.data())) == NULL) {
+			continue;
+		}
+		while ((de2 = readdir(dirp2)) != NULL) {
+			// skip temporary entries: *.re, *.tmp, ...
+			if (de2->d_name[0] == '.' || (strchr(de2->d_name, '.') != NULL && !is_repl_file(de2->d_name))) {
+				continue;
+			}
+			string path = home + "/" + de2->d_name;
+			if (lstat(path.data(), &st) != 0) {
+				continue;
+			}
+			if (S_ISDIR(st.st_mode) && is_db_dir(path, false)) {
+				snprintf(buf, sizeof(buf), "D %s/%s\n", de->d_name, de2->d_name);
+			} else if (S_ISREG(st.st_mode) && is_repl_file(de2->d_name)) {
+				snprintf(buf, sizeof(buf), "F %s/%s %ld %ld\n", de->d_name, de2->d_name,
+						(long) st.st_size, (long) st.st_mtime);
+			} else {
+				continue;
+			}
+			out += buf;
+		}
+		closedir(dirp2);
+	}
+	closedir(dirp);
+	out += ".\n";
+	write_all(fd, out.data(), out.size());
+}
+
+/**
+ * Serve FILE request
+ */
+static void master_file(int fd, const char *name)
+{
+	char buf[8192];
+	int n, fd2;
+
+	if (!is_repl_file(strchr(name, '/') + 1)) {
+		log_notice("refused to send file (NAME:%s)", name);
+		return;
+	}
+	if ((fd2 = open((string(DEFAULT_DATA_DIR) + name).data(), O_RDONLY)) < 0) {
+		log_error("failed to open file (NAME:%s, ERROR:%s)", name, strerror(errno));
+		return;
+	}
+	while ((n = read(fd2, buf, sizeof(buf))) > 0) {
+		if (write_all(fd, buf, n) != 0) {
+			break;
+		}
+	}
+	close(fd2);
+}
+
+/**
+ * Serve SYNC request, changesets since the revision of replica, or a full copy
+ */
+static void master_sync(int fd, const char *name, const char *rev)
+{
+	string path = string(DEFAULT_DATA_DIR) + name;
+
+	if (!is_db_dir(path, false)) {
+		log_notice("refused to sync non-database (NAME:%s)", name);
+		return;
+	}
+	try {
+		Xapian::DatabaseMaster master(path);
+		Xapian::ReplicationInfo info;
+
+		master.write_changesets_to_fd(fd, hex_decode(rev), &info);
+		log_info("database sent (NAME:%s, CHANGESETS:%d, FULLCOPY:%d)",
+				name, info.changeset_count, info.fullcopy_count);
+	} catch (const Xapian::Error &e) {
+		log_error("failed to send database (NAME:%s, ERROR:%s)", name, e.get_msg().data());
+	}
+}
+
+/**
+ * Handle one request from replica (in child process)
+ */
+static void master_serve(int fd)
+{
+	char line[MAX_LINE_SIZE], *name, *rev;
+
+	if (read_line(fd, line, sizeof(line)) <= 0) {
+		return;
+	}
+	log_debug("replica request (LINE:%s)", line);
+	if (!strcmp(line, "LIST")) {
+		master_list(fd);
+		return;
+	}
+	if ((name = strchr(line, ' ')) == NULL) {
+		log_notice("unknown replica request (LINE:%s)", line);
+		return;
+	}
+	*name++ = '\0';
+	if ((rev = strchr(name, ' ')) != NULL) {
+		*rev++ = '\0';
+	}
+	if (!check_name(name)) {
+		log_notice("invalid name of replica request (NAME:%s)", name);
+	} else if (!strcmp(line, "FILE")) {
+		master_file(fd, name);
+	} else if (!strcmp(line, "SYNC")) {
+		master_sync(fd, name, rev == NULL ? "" : rev);
+	} else {
+		log_notice("unknown replica request (LINE:%s)", line);
+	}
+}
+
+/**
+ * Master loop, fork a child process for each connection
+ */
+static void master_loop(const char *bind_addr)
+{
+	struct sockaddr_in sin;
+	int sock, fd, val = 1;
+	pid_t pid;
+
+	if (!parse_addr(bind_addr, &sin)) {
+		log_error("invalid address to bind (BIND:%s)", bind_addr);
+		return;
+	}
+	if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		log_error("socket() failed (ERROR:%s)", strerror(errno));
+		return;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (void *) &val, sizeof(val));
+	if (bind(sock, (struct sockaddr *) &sin, sizeof(sin)) < 0 || listen(sock, DEFAULT_BACKLOG) < 0) {
+		log_error("bind() or listen() failed (BIND:%s, ERROR:%s)", bind_addr, strerror(errno));
+		close(sock);
+		return;
+	}
+	signal(SIGCHLD, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+	log_notice("replication master start (BIND:%s)", bind_addr);
+
+	while (true) {
+		if ((fd = accept(sock, NULL, NULL)) < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			log_error("accept() failed (ERROR:%s)", strerror(errno));
+			break;
+		}
+		if ((pid = fork()) == 0) {
+			close(sock);
+			master_serve(fd);
+			close(fd);
+			_exit(0);
+		} else if (pid < 0) {
+			log_error("failed to fork replication process (ERROR:%s)", strerror(errno));
+		}
+		close(fd);
+	}
+	close(sock);
+}
+
+/**
+ * Connect to master and send the request line
+ * @return socket fd, -1 on failure
+ */
+static int replica_request(const char *master, const string &line)
+{
+	struct sockaddr_in sin;
+	int fd;
+
+	if (!parse_addr(master, &sin)) {
+		log_error("invalid address of master (MASTER:%s)", master);
+		return -1;
+	}
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		log_error("socket() failed (ERROR:%s)", strerror(errno));
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *) &sin, sizeof(sin)) < 0 || write_all(fd, line.data(), line.size()) != 0) {
+		log_error("failed to request master (MASTER:%s, ERROR:%s)", master, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Pull a database by Xapian replication
+ * @return true on success
+ */
+static bool replica_sync_db(const char *master, const string &name)
+{
+	bool ok = false;
+	int fd = -1;
+
+	try {
+		Xapian::DatabaseReplica replica(string(DEFAULT_DATA_DIR) + name);
+		Xapian::ReplicationInfo info, sub;
+
+		fd = replica_request(master, "SYNC " + name + " " + hex_encode(replica.get_revision_info()) + "\n");
+		if (fd >= 0) {
+			replica.set_read_fd(fd);
+			while (true) {
+				bool more = replica.apply_next_changeset(&sub, READER_CLOSE_TIME);
+				info.changeset_count += sub.changeset_count;
+				info.fullcopy_count += sub.fullcopy_count;
+				if (!more) {
+					break;
+				}
+			}
+			replica.close();
+			ok = true;
+			if (info.changeset_count > 0 || info.fullcopy_count > 0) {
+				log_info("database replicated (NAME:%s, CHANGESETS:%d, FULLCOPY:%d)",
+						name.data(), info.changeset_count, info.fullcopy_count);
+			}
+		}
+	} catch (const Xapian::Error &e) {
+		log_error("failed to replicate database (NAME:%s, ERROR:%s)", name.data(), e.get_msg().data());
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+	return ok;
+}
+
+/**
+ * Pull a file if size or mtime changed, replaced atomically
+ * @return true on success
+ */
+static bool replica_sync_file(const char *master, const string &name, off_t size, time_t mtime)
+{
+	struct stat st;
+	struct utimbuf ut;
+	string path = string(DEFAULT_DATA_DIR) + name, tmp = path + ".tmp", buf;
+	char data[8192];
+	int n, fd;
+	FILE *fp;
+
+	if (stat(path.data(), &st) == 0 && st.st_size == size && st.st_mtime == mtime) {
+		return true;
+	}
+	if ((fd = replica_request(master, "FILE " + name + "\n")) < 0) {
+		return false;
+	}
+	while ((n = read(fd, data, sizeof(data))) > 0) {
+		buf.append(data, n);
+	}
+	close(fd);
+	if (buf.size() != (size_t) size) {
+		log_error("incomplete file from master (NAME:%s, SIZE:%d<>%d)", name.data(), (int) buf.size(), (int) size);
+		return false;
+	}
+	// segments listed in stub file must be replicated already
+	if (name.substr(name.find('/') + 1) == ARCHIVE_DB_NAME) {
+		string home = path.substr(0, path.rfind('/') + 1);
+		size_t pos = 0, end;
+
+		while ((end = buf.find('\n', pos)) != string::npos) {
+			if (!buf.compare(pos, 5, "auto ") && !is_db_dir(home + buf.substr(pos + 5, end - pos - 5), true)) {
+				log_notice("stub file refers to missing segment, try again later (NAME:%s)", name.data());
+				return false;
+			}
+			pos = end + 1;
+		}
+	}
+	if ((fp = fopen(tmp.data(), "wb")) == NULL) {
+		log_error("failed to open file (PATH:%s, ERROR:%s)", tmp.data(), strerror(errno));
+		return false;
+	}
+	n = fwrite(buf.data(), 1, buf.size(), fp);
+	fclose(fp);
+	ut.actime = ut.modtime = mtime;
+	if (n != (int) buf.size() || utime(tmp.data(), &ut) != 0 || rename(tmp.data(), path.data()) != 0) {
+		log_error("failed to save file (PATH:%s, ERROR:%s)", path.data(), strerror(errno));
+		unlink(tmp.data());
+		return false;
+	}
+	log_info("file replicated (NAME:%s, SIZE:%d)", name.data(), (int) size);
+	return true;
+}
+
+/**
+ * Remove databases & files of the project no longer on master
+ */
+static void replica_clean(const string &project, const std::map<string, bool> &names)
+{
+	DIR *dirp;
+	struct dirent *de;
+	string home = string(DEFAULT_DATA_DIR) + project;
+
+	if ((dirp = opendir(home.data())) == NULL) {
+		return;
+	}
+	while ((de = readdir(dirp)) != NULL) {
+		string path = home + "/" + de->d_name;
+		if (de->d_name[0] == '.' || names.find(project + "/" + de->d_name) != names.end()) {
+			continue;
+		}
+		if (is_repl_file(de->d_name)) {
+			log_notice("remove file not on master (PATH:%s)", path.data());
+			unlink(path.data());
+		} else if (is_db_dir(path, true)) {
+			log_notice("remove database not on master (PATH:%s)", path.data());
+			system(("/bin/rm -rf \"" + path + "\"").data());
+		}
+	}
+	closedir(dirp);
+}
+
+/**
+ * Save time of the replicated state, read by searchd to report lag
+ */
+static void replica_save_state(const string &project, time_t stime)
+{
+	string path = string(DEFAULT_DATA_DIR) + project + "/" REPLICA_STATE_FILE, tmp = path + ".tmp";
+	FILE *fp;
+
+	if ((fp = fopen(tmp.data(), "w")) == NULL) {
+		log_error("failed to save replica state (PATH:%s, ERROR:%s)", path.data(), strerror(errno));
+		return;
+	}
+	fprintf(fp, "%ld\n", (long) stime);
+	fclose(fp);
+	rename(tmp.data(), path.data());
+}
+
+/**
+ * Pull all databases & files of master once
+ * Files are pulled after databases, so stub file never refers to missing segments
+ */
+static void replica_pull(const char *master, const char *only)
+{
+	char line[MAX_LINE_SIZE], *name;
+	long size, mtime;
+	int fd;
+	time_t stime;
+	FILE *fp;
+	std::map<string, bool> names, projects; // projects: all entries ok or not
+	std::map<string, std::pair<long, long> > files;
+	std::map<string, bool>::iterator it;
+
+	// state of master is replicated as of the listing
+	time(&stime);
+	if ((fd = replica_request(master, "LIST\n")) < 0) {
+		return;
+	}
+	fp = fdopen(fd, "r");
+	line[0] = '\0';
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (!strcmp(line, ".") || strlen(line) < 3) {
+			break;
+		}
+		name = line + 2;
+		if (line[0] == 'F' && sscanf(name, "%*s %ld %ld", &size, &mtime) == 2) {
+			*strchr(name, ' ') = '\0';
+		} else if (line[0] != 'D') {
+			continue;
+		}
+		string project(name, strchr(name, '/') - name);
+		if (!check_name(name) || (only != NULL && project != only)) {
+			continue;
+		}
+		names[name] = line[0] == 'D';
+		if (line[0] == 'F') {
+			files[name] = std::make_pair(size, mtime);
+		}
+		if (projects.find(project) == projects.end()) {
+			projects[project] = true;
+			mkdir((string(DEFAULT_DATA_DIR) + project).data(), 0755);
+		}
+	}
+	fclose(fp);
+	if (strcmp(line, ".")) {
+		log_error("incomplete list from master (MASTER:%s)", master);
+		return;
+	}
+
+	// databases, then files
+	for (it = names.begin(); it != names.end(); it++) {
+		if (it->second && !replica_sync_db(master, it->first)) {
+			projects[it->first.substr(0, it->first.find('/'))] = false;
+		}
+	}
+	for (it = names.begin(); it != names.end(); it++) {
+		if (!it->second && !replica_sync_file(master, it->first, files[it->first].first, files[it->first].second)) {
+			projects[it->first.substr(0, it->first.find('/'))] = false;
+		}
+	}
+
+	// cleanup & save state of projects replicated completely
+	for (it = projects.begin(); it != projects.end(); it++) {
+		if (it->second) {
+			replica_clean(it->first, names);
+			replica_save_state(it->first, stime);
+		}
+	}
+	log_debug("replica pulled (MASTER:%s, PROJECTS:%d, ENTRIES:%d)", master, (int) projects.size(), (int) names.size());
+}
+
+/**
+ * Main function(entrance)
+ * @param argc
+ * @param argv
+ */
+int main(int argc, char *argv[])
+{
+	int cc, interval = DEFAULT_SYNC_INTERVAL;
+	const char *home = PREFIX, *bind_addr = NULL, *master = NULL, *only = NULL;
+	char buf[16];
+
+	// open logger
+	log_open("stderr", "replicate", -1);
+
+	// parse the arguments
+	if ((prog_name = strrchr(argv[0], '/')) != NULL) {
+		prog_name++;
+	} else {
+		prog_name = argv[0];
+	}
+
+	while ((cc = getopt(argc, argv, "vhmQV1H:b:i:p:s:")) != -1) {
+		switch (cc) {
+			case 'm': flag |= FLAG_MASTER;
+				break;
+			case '1': flag |= FLAG_ONCE;
+				break;
+			case 'Q': log_level(LOG_ERR);
+				break;
+			case 'V': log_level(LOG_INFO);
+				break;
+			case 'H': home = optarg;
+				break;
+			case 'b': bind_addr = optarg;
+				break;
+			case 'i':
+				interval = atoi(optarg);
+				if (interval < 1) {
+					interval = DEFAULT_SYNC_INTERVAL;
+				}
+				break;
+			case 'p': only = optarg;
+				break;
+			case 's': master = optarg;
+				break;
+			case 'v':
+				show_version();
+				break;
+			case 'h':
+				show_usage();
+				break;
+			case '?':
+			default:
+				log_error("Use `-h' option to get more help messages");
+				return -1;
+		}
+	}
+
+	// check home directory
+	if (chdir(home) < 0) {
+		log_error("failed to change work directory (DIR:%s, ERROR:%s)", home, strerror(errno));
+		return -1;
+	}
+
+	if (flag & FLAG_MASTER) {
+		if (bind_addr == NULL) {
+			sprintf(buf, "%d", DEFAULT_REPLICATE_PORT);
+			bind_addr = buf;
+		}
+		master_loop(bind_addr);
+		return -1;
+	}
+	if (master == NULL) {
+		log_error("neither master mode nor the master address specified");
+		return -1;
+	}
+	if (access(DEFAULT_DATA_DIR, W_OK) < 0) {
+		log_error("data directory not exists or not writable (DIR:" DEFAULT_DATA_DIR ")");
+		return -1;
+	}
+	log_notice("replica start (MASTER:%s, PROJECT:%s, INTERVAL:%d)", master, only == NULL ? "*" : only, interval);
+	signal(SIGPIPE, SIG_IGN);
+	while (true) {
+		replica_pull(master, only);
+		if (flag & FLAG_ONCE) {
+			break;
+		}
+		sleep(interval);
+	}
+	return 0;
+}
@@ -36,6 +36,7 @@
 #include "pinyin.h"
 #include "tpool.h"
 #include "task.h"
+#include "stemcache.h"
 #include "searchd.h"
 #ifdef HAVE_MEMORY_CACHE
 #    include "mcache.h"
@@ -75,7 +76,7 @@ G_VAR_DECL(user_base, void *);
 MC *mc;
 #endif
 
-Xapian::Stem stemmer;
+Xapian::Stem stemmer; // cached, shared by threads
 Xapian::SimpleStopper *stopper;
 
 /**
@@ -93,9 +94,9 @@ static char *prog_name;
 static int worker_num, listen_sock;
 
 /**
- * Thread pool
+ * Thread pool (shared with batch search in task.cc)
  */
-static tpool_t thr_pool;
+tpool_t thr_pool;
 
 #define	TPOOL_INIT()			tpool_init(&thr_pool, MAX_THREAD_NUM, 0, 0)
 #define	TPOOL_DEINIT()			tpool_destroy(&thr_pool)
@@ -110,6 +111,31 @@ static tpool_t thr_pool;
  */
 #define	IS_MASTER()				(main_flag & FLAG_MASTER)
 
+/**
+ * Get replication lag of the project, seconds since the master state replicated last
+ * @param conn
+ * @return CMD_RES_xxx
+ */
+static int worker_replica_lag(XS_CONN *conn)
+{
+	char fpath[256];
+	int lag = -1;
+	long stime;
+	FILE *fp;
+
+	snprintf(fpath, sizeof(fpath), "%s/" REPLICA_STATE_FILE, conn->user->home);
+	if ((fp = fopen(fpath, "r")) != NULL) {
+		if (fscanf(fp, "%ld", &stime) == 1) {
+			lag = (int) (time(NULL) - stime);
+			if (lag < 0) {
+				lag = 0;
+			}
+		}
+		fclose(fp);
+	}
+	return CONN_RES_OK3(REPLICA_LAG, (char *) &lag, sizeof(lag));
+}
+
 /**
  * Worker basic zcmd handler (trigger task & save commands)
  * @param conn
@@ -128,8 +154,11 @@ static int worker_zcmd_exec(XS_CONN *conn)
 		case CMD_QUERY_GET_EXPANDED:
 		case CMD_SEARCH_SET_DB:
 		case CMD_SEARCH_ADD_DB:
+		case CMD_SEARCH_SET_SHARDS:
 		case CMD_SEARCH_GET_DB:
 		case CMD_SEARCH_SCWS_GET:
+		case CMD_SEARCH_BATCH:
+		case CMD_REQUEST:
 			if (conn->zcmd->cmd == CMD_SEARCH_SCWS_GET)
 				conn->flag |= CONN_FLAG_ON_SCWS;
 			// paused in event server, submit task to thread pool
@@ -155,6 +184,8 @@ static int worker_zcmd_exec(XS_CONN *conn)
 			return CMD_RES_CONT | CMD_RES_SAVE;
 		case CMD_SEARCH_ADD_LOG:
 			return task_add_search_log(conn);
+		case CMD_SEARCH_REPLICA_LAG:
+			return worker_replica_lag(conn);
 		case CMD_SEARCH_FINISH:
 			return CONN_RES_ERR(WRONGPLACE);
 		case CMD_SEARCH_KEEPALIVE:
@@ -487,7 +518,7 @@ int main(int argc, char *argv[])
 	bind = DEFAULT_BIND_PATH;
 	msize = DEFAULT_MM_SIZE;
 	worker_num = DEFAULT_WORKER_NUM;
-	stemmer = Xapian::Stem(DEFAULT_STEMMER);
+	stemmer = Xapian::Stem(new CachedStem(DEFAULT_STEMMER, STEM_CACHE_SIZE, true));
 	main_flag = FLAG_MASTER;
 	stopper = NULL;
 
@@ -565,7 +596,7 @@ int main(int argc, char *argv[])
 				break;
 			case 't':
 				try {
-					stemmer = Xapian::Stem(optarg);
+					stemmer = Xapian::Stem(new CachedStem(optarg, STEM_CACHE_SIZE, true));
 				} catch (...) {
 					fprintf(stderr, "ERROR: invalid stemmer language (LANG:%s)\n", optarg);
 					goto main_end;
@@ -0,0 +1,154 @@
+/**
+ * Stemmer with bounded cache of stemmed words
+ *
+ * $Id$
+ */
+
+#ifdef HAVE_CONFIG_H
+#    include "config.h"
+#endif
+
+#include <xapian/unicode.h>
+
+#include "stemcache.h"
+
+using std::string;
+
+#define	STEM_SLOT_CHECKED	0x01	// checked by should_stem()
+#define	STEM_SLOT_SHOULD	0x02	// should be stemmed
+#define	STEM_SLOT_STEMMED	0x04	// stemmed word saved
+
+/**
+ * Unicode range for CJK characters
+ */
+#define	UNICODE_CJK(x)	(((x)>=0x2e80 && (x)<=0x2eff)				\
+    || ((x)>=0x3000 && (x)<=0xa71f)	|| ((x)>=0xac00 && (x)<=0xd7af)	\
+    || ((x)>=0xf900 && (x)<=0xfaff)	|| ((x)>=0xff00 && (x)<=0xffef)	\
+    || ((x)>=0x20000 && (x)<=0x2a6df) || ((x)>=0x2f800 && (x)<=0x2fa1f))
+
+/**
+ * check requirement of stemmer
+ * @param term
+ * @return 
+ */
+bool should_stem(const string &term)
+{
+	const unsigned int SHOULD_STEM_MASK =
+			(1 << Xapian::Unicode::LOWERCASE_LETTER) |
+			(1 << Xapian::Unicode::TITLECASE_LETTER) |
+			(1 << Xapian::Unicode::MODIFIER_LETTER) |
+			(1 << Xapian::Unicode::OTHER_LETTER);
+	Xapian::Utf8Iterator u(term);
+	bool should = (!UNICODE_CJK(*u) && ((SHOULD_STEM_MASK >> Xapian::Unicode::get_category(*u)) & 1));
+	return should;
+}
+
+CachedStem::CachedStem(const string &lang, unsigned int size, bool locked) : st(lang)
+{
+	unsigned int n = 1;
+
+	while (n < size) {
+		n <<= 1;
+	}
+	slots = new struct slot[n];
+	for (mask = 0; mask < n; mask++) {
+		slots[mask].state = 0;
+	}
+	mask = n - 1;
+	hits = lookups = 0;
+	this->locked = locked;
+	if (locked) {
+		pthread_mutex_init(&mutex, NULL);
+	}
+}
+
+CachedStem::~CachedStem()
+{
+	delete[] slots;
+	if (locked) {
+		pthread_mutex_destroy(&mutex);
+	}
+}
+
+/**
+ * Get slot of the word (FNV-1a), the collided slot is reset
+ */
+CachedStem::slot *CachedStem::find(const string &word)
+{
+	unsigned int h = 2166136261U;
+	string::const_iterator it;
+	struct slot *s;
+
+	for (it = word.begin(); it != word.end(); ++it) {
+		h ^= (unsigned char) *it;
+		h *= 16777619U;
+	}
+	s = &slots[h & mask];
+	lookups++;
+	if (s->state != 0 && s->word == word) {
+		hits++;
+	} else {
+		s->state = 0;
+		s->word = word;
+	}
+	return s;
+}
+
+/**
+ * Stem the word, called by Xapian (TermGenerator, QueryParser)
+ */
+string CachedStem::operator()(const string &word)
+{
+	string result;
+	struct slot *s;
+
+	if (locked) {
+		pthread_mutex_lock(&mutex);
+	}
+	s = find(word);
+	if (!(s->state & STEM_SLOT_STEMMED)) {
+		s->stem = st(word);
+		s->state |= STEM_SLOT_STEMMED;
+	}
+	result = s->stem;
+	if (locked) {
+		pthread_mutex_unlock(&mutex);
+	}
+	return result;
+}
+
+string CachedStem::get_description() const
+{
+	return "Cached" + st.get_description();
+}
+
+/**
+ * Stem the word if required (checked by should_stem)
+ * @param word
+ * @param result stemmed word
+ * @return bool false if the word should not be stemmed
+ */
+bool CachedStem::stem(const string &word, string &result)
+{
+	bool should;
+	struct slot *s;
+
+	if (locked) {
+		pthread_mutex_lock(&mutex);
+	}
+	s = find(word);
+	if (!(s->state & STEM_SLOT_CHECKED)) {
+		s->state |= should_stem(word) ? (STEM_SLOT_CHECKED | STEM_SLOT_SHOULD) : STEM_SLOT_CHECKED;
+	}
+	if ((should = (s->state & STEM_SLOT_SHOULD))) {
+		if (!(s->state & STEM_SLOT_STEMMED)) {
+			s->stem = st(word);
+			s->state |= STEM_SLOT_STEMMED;
+		}
+		result = s->stem;
+	}
+	if (locked) {
+		pthread_mutex_unlock(&mutex);
+	}
+	return should;
+}
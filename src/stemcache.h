@@ -0,0 +1,53 @@
+/**
+ * Stemmer with bounded cache of stemmed words
+ * Words are mapped into slots of a fixed table by hash, collided one is replaced.
+ *
+ * $Id$
+ */
+
+#ifndef __XS_STEMCACHE_20261019_H__
+#define	__XS_STEMCACHE_20261019_H__
+
+#include <pthread.h>
+#include <string>
+#include <xapian.h>
+
+#define	STEM_CACHE_SIZE		131072		// number of slots (power of 2)
+
+/**
+ * check requirement of stemmer (first letter is not CJK)
+ */
+bool should_stem(const std::string &term);
+
+/**
+ * Cached stemmer implementation, used by Xapian::Stem(new CachedStem(...))
+ * Non-locked one must be used in a single thread only.
+ */
+class CachedStem : public Xapian::StemImplementation
+{
+	struct slot
+	{
+		int state; // STEM_SLOT_* flags, 0: empty
+		std::string word, stem;
+	};
+
+	Xapian::Stem st;
+	struct slot *slots;
+	unsigned int mask;
+	bool locked;
+	pthread_mutex_t mutex;
+
+	struct slot *find(const std::string &word);
+
+public:
+	unsigned long hits, lookups;
+
+	CachedStem(const std::string &lang, unsigned int size = STEM_CACHE_SIZE, bool locked = false);
+	virtual ~CachedStem();
+	virtual std::string operator()(const std::string &word);
+	virtual std::string get_description() const;
+
+	bool stem(const std::string &word, std::string &result);
+};
+
+#endif	/* __XS_STEMCACHE_20261019_H__ */
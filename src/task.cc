@@ -8,12 +8,18 @@
 
 #include <string>
 #include <set>
+#include <map>
+#include <list>
+#include <vector>
 
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <limits.h>
+#include <sys/stat.h>
 #include <xapian.h>
 #include <pthread.h>
 
@@ -23,6 +29,8 @@
 #include "task.h"
 #include "pinyin.h"
 #include "import.h"
+#include "tpool.h"
+#include "zdata.h"
 
 /**
  * Reset debug log macro to contain tid
@@ -46,6 +54,7 @@ static scws_t _scws;
  */
 extern Xapian::Stem stemmer;
 extern Xapian::SimpleStopper *stopper;
+extern tpool_t thr_pool;
 using std::string;
 
 /**
@@ -75,6 +84,24 @@ struct cache_qp
 static struct cache_qp *qp_base = NULL;
 static pthread_mutex_t qp_mutex;
 
+/**
+ * Local cached parsed query (LRU, shared by threads of worker)
+ * Query object is not thread-safe, so it is saved as serialised string
+ */
+typedef std::multimap<string, string> unstem_map;
+
+struct cache_query
+{
+	long stamp[2]; // mtime of custom dict, revision of synonyms
+	string data; // serialised query
+	unstem_map unstem; // unstemmed terms of the query
+	std::list<string>::iterator lru;
+};
+
+static std::map<string, struct cache_query> cq_map;
+static std::list<string> cq_lru;
+static pthread_mutex_t cq_mutex;
+
 /**
  * Data structure for zcmd_exec
  */
@@ -93,6 +120,9 @@ struct object_chain
 	struct object_chain *next;
 };
 
+struct batch_ctx;
+static void batch_abort(struct batch_ctx *ctx);
+
 struct search_zarg
 {
 	Xapian::Database *db;
@@ -105,6 +135,15 @@ struct search_zarg
 	unsigned char cuts[XS_DATA_VNO + 1]; // 0x80(numeric)|(cut_len/10)
 	unsigned char facets[MAX_SEARCH_FACETS]; // facets earch record
 
+	unsigned char scws_multi; // scws multi level of qp
+	unsigned char syn_scale; // synonym scale of qp (0: default)
+	string *qp_sign; // signature of prefixes, range processors of qp
+	unstem_map *unstem; // unstemmed terms of last cached query (NULL: use qp)
+	long cq_stamp[2]; // stamp to check cached query, cq_stamp[0] == 0: not loaded
+	struct batch_ctx *batch; // running batch search
+	struct batch_ctx *rq; // pending tagged requests
+	class ShadowDecider *shadow; // hide documents replaced by delta db (NULL: none)
+
 	struct object_chain *objs;
 };
 
@@ -239,6 +278,20 @@ void TermCountMatchSpy::operator()(const Xapian::Document &doc, double wt) {
 	}
 }
 
+/**
+ * ShadowDecider
+ * hide documents of db/db_a which were updated or removed in delta db
+ */
+class ShadowDecider : public Xapian::MatchDecider {
+
+public:
+	std::set<Xapian::docid> docids; // docid of combined database
+
+	bool operator()(const Xapian::Document &doc) const {
+		return docids.find(doc.get_docid()) == docids.end();
+	}
+};
+
 /**
  * @param conn
  * @return CMD_RES_CONT
@@ -322,6 +375,131 @@ static void free_queryparser(Xapian::QueryParser *qp)
 	pthread_mutex_unlock(&qp_mutex);
 }
 
+/**
+ * Load stamp of cached query: mtime of custom dict & revision of synonyms
+ */
+static void load_query_stamp(XS_CONN *conn)
+{
+	struct stat st;
+	char fpath[256];
+	struct search_zarg *zarg = (struct search_zarg *) conn->zarg;
+
+	sprintf(fpath, "%s/" CUSTOM_DICT_FILE, conn->user->home);
+	zarg->cq_stamp[0] = stat(fpath, &st) == 0 ? (long) st.st_mtime : -1;
+	zarg->cq_stamp[1] = strtol(zarg->db->get_metadata(SYNONYMS_REV_KEY).data(), NULL, 10);
+	log_debug_conn("load query stamp (DICT_MTIME:%ld, SYNONYMS_REV:%ld)", zarg->cq_stamp[0], zarg->cq_stamp[1]);
+}
+
+/**
+ * Parse query string with cache
+ * Skip the cache for custom db, or flags which depend on terms of db
+ * @param conn
+ * @param qstr query string
+ * @param flag parse flag
+ * @param op default op (arg2 of cmd)
+ */
+static Xapian::Query parse_query_cached(XS_CONN *conn, const string &qstr, int flag, int op)
+{
+	char buf[64];
+	string key;
+	Xapian::Query qq;
+	std::map<string, struct cache_query>::iterator it;
+	struct search_zarg *zarg = (struct search_zarg *) conn->zarg;
+
+	zarg->qp->set_default_op(GET_QUERY_OP(op));
+	if (zarg->db == NULL || (conn->flag & CONN_FLAG_CH_DB)
+			|| (flag & (Xapian::QueryParser::FLAG_WILDCARD | Xapian::QueryParser::FLAG_PARTIAL
+			| Xapian::QueryParser::FLAG_SPELLING_CORRECTION))) {
+		DELETE_PTR(zarg->unstem);
+		return zarg->qp->parse_query(qstr, flag);
+	}
+
+	// KEY: user \0 flag:op:multi:scale \0 qp_sign \0 query
+	sprintf(buf, "%x:%d:%d:%d", flag, op % QUERY_OP_NUM, zarg->scws_multi, zarg->syn_scale);
+	key = string(conn->user->name) + '\0' + string(buf) + '\0' + *zarg->qp_sign + '\0' + qstr;
+	if (zarg->cq_stamp[0] == 0) {
+		load_query_stamp(conn);
+	}
+
+	// lookup
+	pthread_mutex_lock(&cq_mutex);
+	it = cq_map.find(key);
+	if (it != cq_map.end()) {
+		struct cache_query *cq = &it->second;
+		if (cq->stamp[0] == zarg->cq_stamp[0] && cq->stamp[1] == zarg->cq_stamp[1]) {
+			string data = cq->data;
+
+			cq_lru.splice(cq_lru.begin(), cq_lru, cq->lru);
+			DELETE_PTR(zarg->unstem);
+			zarg->unstem = new unstem_map(cq->unstem);
+			pthread_mutex_unlock(&cq_mutex);
+			log_debug_conn("parsed query cache hit (QUERY:%s)", qstr.data());
+			return Xapian::Query::unserialise(data);
+		}
+		log_debug_conn("parsed query cache expired (QUERY:%s)", qstr.data());
+		cq_lru.erase(cq->lru);
+		cq_map.erase(it);
+	}
+	pthread_mutex_unlock(&cq_mutex);
+
+	// parse & save the result
+	DELETE_PTR(zarg->unstem);
+	qq = zarg->qp->parse_query(qstr, flag);
+
+	struct cache_query cs;
+	Xapian::TermIterator tb = qq.get_terms_begin();
+	Xapian::TermIterator te = qq.get_terms_end();
+	while (tb != te) {
+		string tt = *tb++;
+		Xapian::TermIterator ub = zarg->qp->unstem_begin(tt);
+		Xapian::TermIterator ue = zarg->qp->unstem_end(tt);
+		while (ub != ue) {
+			cs.unstem.insert(std::make_pair(tt, *ub++));
+		}
+	}
+	cs.data = qq.serialise();
+	cs.stamp[0] = zarg->cq_stamp[0];
+	cs.stamp[1] = zarg->cq_stamp[1];
+
+	pthread_mutex_lock(&cq_mutex);
+	if (cq_map.find(key) == cq_map.end()) {
+		if (cq_map.size() >= MAX_QUERY_CACHE) {
+			cq_map.erase(cq_lru.back());
+			cq_lru.pop_back();
+		}
+		cq_lru.push_front(key);
+		cs.lru = cq_lru.begin();
+		cq_map.insert(std::make_pair(key, cs));
+		log_debug_conn("parsed query cache created (QUERY:%s, NUM:%d)", qstr.data(), (int) cq_map.size());
+	}
+	pthread_mutex_unlock(&cq_mutex);
+
+	return qq;
+}
+
+/**
+ * Get unstemmed words of the term, from cached query or queryparser
+ * @param zarg
+ * @param tt term
+ * @param words
+ */
+static void get_unstem_words(struct search_zarg *zarg, const string &tt, std::vector<string> &words)
+{
+	words.clear();
+	if (zarg->unstem != NULL) {
+		std::pair<unstem_map::iterator, unstem_map::iterator> range = zarg->unstem->equal_range(tt);
+		while (range.first != range.second) {
+			words.push_back((range.first++)->second);
+		}
+	} else {
+		Xapian::TermIterator ub = zarg->qp->unstem_begin(tt);
+		Xapian::TermIterator ue = zarg->qp->unstem_end(tt);
+		while (ub != ue) {
+			words.push_back(*ub++);
+		}
+	}
+}
+
 /**
  * Cut longer string or convert serialise string into numeric
  * @param s string
@@ -417,12 +595,23 @@ static inline void cut_matched_string(string &s, int v, unsigned int id, struct
 	} else { \
 		string qstr = string(XS_CMD_BUF(cmd), XS_CMD_BLEN(cmd)); \
 		int flag = zarg->parse_flag > 0 ? zarg->parse_flag : Xapian::QueryParser::FLAG_DEFAULT;	\
-		zarg->qp->set_default_op(GET_QUERY_OP(cmd->arg2)); \
-		q = zarg->qp->parse_query(qstr, flag); \
+		q = parse_query_cached(conn, qstr, flag, cmd->arg2); \
 		log_info_conn("search/count query (QUERY:%s, FLAG:0x%04x, DEF_OP:%d)", qstr.data(), flag, cmd->arg2); \
 	} \
 } while(0)
 
+/**
+ * Decompress the data field to be sent, compressed by xs-import with dictionary of the project
+ * @param conn (XS_CONN *)
+ * @param data
+ */
+static inline void load_field_data(XS_CONN *conn, string &data)
+{
+	if (ZDATA_COMPRESSED(data) && !zdata_decompress(string(conn->user->home) + "/", data)) {
+		log_notice_conn("failed to decompress field data (USER:%s, SIZE:%d)", conn->user->name, (int) data.size());
+	}
+}
+
 /**
  * Send a document to client
  * @param conn (XS_CONN *)
@@ -460,21 +649,22 @@ static int send_result_doc(XS_CONN *conn, struct result_doc *rd, struct search_r
 		data = d.get_data();
 		vno = XS_DATA_VNO;
 
+		load_field_data(conn, data);
 		cut_matched_string(data, vno, rd->docid, (struct search_zarg *) conn->zarg);
 		rc = conn_respond(conn, CMD_SEARCH_RESULT_FIELD, vno, data.data(), data.size());
 
 		// send matched terms
 		if (conn->flag & CONN_FLAG_MATCHED_TERM) {
 			int i;
+			std::vector<string> words;
 			Xapian::TermIterator tb = zarg->eq->get_matching_terms_begin(rd->docid);
 			Xapian::TermIterator te = zarg->eq->get_matching_terms_end(rd->docid);
 			// get matched terms
 			data.resize(0);
 			while (tb != te) {
 				string tt = *tb;
-				Xapian::TermIterator ub = zarg->qp->unstem_begin(tt);
-				Xapian::TermIterator ue = zarg->qp->unstem_end(tt);
-				if (ub == ue) {
+				get_unstem_words(zarg, tt, words);
+				if (words.empty()) {
 					for (i = 0; tt[i] >= 'A' && tt[i] <= 'Z'; i++);
 					if (data.size() == 0) {
 						data = tt.substr(i);
@@ -482,12 +672,11 @@ static int send_result_doc(XS_CONN *conn, struct result_doc *rd, struct search_r
 						data += " " + tt.substr(i);
 					}
 				} else {
-					while (ub != ue) {
-						tt = *ub++;
+					for (i = 0; i < words.size(); i++) {
 						if (data.size() == 0) {
-							data = tt;
+							data = words[i];
 						} else {
-							data += " " + tt;
+							data += " " + words[i];
 						}
 					}
 				}
@@ -598,6 +787,18 @@ static inline void zarg_cleanup(struct search_zarg *zarg)
 	free_queryparser(zarg->qp);
 	DELETE_PTR(zarg->qq);
 	DELETE_PTR(zarg->db);
+	DELETE_PTR(zarg->qp_sign);
+	DELETE_PTR(zarg->unstem);
+	DELETE_PTR(zarg->shadow);
+	// release sub searches (on canceled or failure)
+	if (zarg->batch != NULL) {
+		batch_abort(zarg->batch);
+		zarg->batch = NULL;
+	}
+	if (zarg->rq != NULL) {
+		batch_abort(zarg->rq);
+		zarg->rq = NULL;
+	}
 }
 
 /**
@@ -734,10 +935,16 @@ static int zcmd_task_default(XS_CONN *conn)
 			break;
 		case CMD_SEARCH_SET_CUTOFF:
 			zarg->eq->set_cutoff(cmd->arg1 > 100 ? 100 : cmd->arg1, (double) cmd->arg2 / 10.0);
+			if (cmd->arg1 == 0 && cmd->arg2 == 0) {
+				conn->flag &= ~CONN_FLAG_CH_CUTOFF;
+			} else {
+				conn->flag |= CONN_FLAG_CH_CUTOFF;
+			}
 			break;
 		case CMD_SEARCH_SET_MISC:
 			if (cmd->arg1 == CMD_SEARCH_MISC_SYN_SCALE) {
 				zarg->qp->set_syn_scale((double) cmd->arg2 / 100.0);
+				zarg->syn_scale = cmd->arg2;
 			} else if (cmd->arg1 == CMD_SEARCH_MISC_MATCHED_TERM) {
 				if (cmd->arg2 == 1) {
 					conn->flag |= CONN_FLAG_MATCHED_TERM;
@@ -762,6 +969,7 @@ static int zcmd_task_default(XS_CONN *conn)
 			if (cmd->arg1 == 1) {
 				zarg->qp->clear();
 				zarg->qp->set_database(*zarg->db);
+				zarg->qp_sign->resize(0);
 				zarg->parse_flag = 0;
 				memset(&zarg->cuts, 0, sizeof(zarg->cuts));
 			}
@@ -777,6 +985,7 @@ static int zcmd_task_default(XS_CONN *conn)
 				} else {
 					zarg->qp->add_prefix(field, prefix);
 				}
+				zarg->qp_sign->append(1, (char) cmd->arg1).append(prefix).append(field).append(1, ',');
 			}
 			break;
 		case CMD_QUERY_PARSEFLAG:
@@ -796,6 +1005,7 @@ static int zcmd_task_default(XS_CONN *conn)
 
 			zarg_add_object(zarg, OTYPE_RANGER, NULL, vrp);
 			zarg->qp->add_rangeprocessor(vrp);
+			zarg->qp_sign->append(1, (char) cmd->arg1).append(1, (char) cmd->arg2).append(1, ',');
 			log_debug_conn("new (Xapian::RangeProcessor *) %p", vrp);
 		}
 			break;
@@ -805,6 +1015,7 @@ static int zcmd_task_default(XS_CONN *conn)
 				scws_t scws = (scws_t) zarg->qp->get_scws();
 				if (scws != NULL) {
 					scws_set_multi(scws, (cmd->arg2 << 12) & SCWS_MULTI_MASK);
+					zarg->scws_multi = cmd->arg2;
 					log_debug_conn("change scws multi level (MODE:%d)", cmd->arg2);
 				}
 			}
@@ -831,12 +1042,90 @@ static inline Xapian::Database *fetch_conn_database(XS_CONN *conn, const char *n
 		db->keep_alive();
 		zarg_add_object(zarg, OTYPE_DB, name, db);
 		log_debug_conn("new (Xapian::Database *) %p (KEY:%s)", db, name);
+	} else {
+		try {
+			db->reopen();
+		} catch (const Xapian::DatabaseError &e) {
+			// segments of stub file were merged and removed (db_a), open it again
+			log_info_conn("reopen database (KEY:%s, ERROR:%s)", name, e.get_msg().data());
+			*db = Xapian::Database(string(conn->user->home) + "/" + string(name));
+		}
+	}
+	return db;
+}
+
+/**
+ * fetch remote shard for conn by address: <host:port>
+ * @return database pointer, NULL if the address is invalid
+ */
+static inline Xapian::Database *fetch_conn_shard(XS_CONN *conn, const string &addr)
+{
+	struct search_zarg *zarg = (struct search_zarg *) conn->zarg;
+	string key = "shard:" + addr;
+	Xapian::Database *db = (Xapian::Database *) zarg_get_object(zarg, OTYPE_DB, key.data());
+	size_t pos = addr.rfind(':');
+	int port;
+
+	if (db == NULL) {
+		if (pos == string::npos || pos == 0 || (port = atoi(addr.data() + pos + 1)) <= 0) {
+			return NULL;
+		}
+		db = new Xapian::Database(Xapian::Remote::open(addr.substr(0, pos), port,
+				SHARD_TIMEOUT, SHARD_CONNECT_TIMEOUT));
+		zarg_add_object(zarg, OTYPE_DB, key.data(), db);
+		log_debug_conn("new (Xapian::Database *) %p (KEY:%s)", db, key.data());
 	} else {
 		db->reopen();
 	}
 	return db;
 }
 
+/**
+ * Add near-real-time delta db after default db (and archive db)
+ * Documents shadowed by ID term in delta db are collected by docid of combined database:
+ * (sub_docid - 1) * num_sub + sub_index + 1, archive db may have several segments (sub-databases)
+ * @param conn
+ * @param dba archive db (NULL: not exists)
+ * @param db default db
+ */
+static void add_delta_database(XS_CONN *conn, Xapian::Database *dba, Xapian::Database *db)
+{
+	struct search_zarg *zarg = (struct search_zarg *) conn->zarg;
+	Xapian::Database *dbd, *subs[2];
+	Xapian::TermIterator ti;
+	Xapian::PostingIterator pi;
+	unsigned int i, num = 0, total, off, size, did;
+	string key = SHADOW_KEY_PREFIX;
+
+	try {
+		dbd = fetch_conn_database(conn, DELTA_DB_NAME);
+	} catch (...) {
+		return;
+	}
+	if (dba != NULL) {
+		subs[num++] = dba;
+	}
+	subs[num++] = db;
+	zarg->db->add_database(*dbd);
+	total = zarg->db->size();
+
+	for (ti = dbd->metadata_keys_begin(key); ti != dbd->metadata_keys_end(key); ti++) {
+		string term = (*ti).substr(key.size());
+		for (i = off = 0; i < num; i++, off += size) {
+			size = subs[i]->size();
+			for (pi = subs[i]->postlist_begin(term); pi != subs[i]->postlist_end(term); pi++) {
+				if (zarg->shadow == NULL) {
+					zarg->shadow = new ShadowDecider();
+				}
+				did = *pi - 1;
+				zarg->shadow->docids.insert((did / size) * total + off + (did % size) + 1);
+			}
+		}
+	}
+	log_debug_conn("add delta database (TOTAL:%d, SHADOW:%d)", dbd->get_doccount(),
+			zarg->shadow == NULL ? 0 : zarg->shadow->docids.size());
+}
+
 /**
  * Set the active db to search
  * @param conn
@@ -862,6 +1151,7 @@ static int zcmd_task_set_db(XS_CONN *conn)
 		Xapian::Database *db = fetch_conn_database(conn, name.data());
 
 		conn->flag |= CONN_FLAG_CH_DB;
+		DELETE_PTR(zarg->shadow);
 		if (zarg->db == NULL || cmd->cmd == CMD_SEARCH_SET_DB) {
 			DELETE_PTR(zarg->db);
 			zarg->db = new Xapian::Database();
@@ -875,17 +1165,23 @@ static int zcmd_task_set_db(XS_CONN *conn)
 		 * archive database db_a was added automatically
 		 */
 		if (XS_CMD_BLEN(cmd) == 0) {
-			Xapian::Database *dba = (Xapian::Database *) zarg_get_object(zarg, OTYPE_DB, DEFAULT_DB_NAME "_a");
+			Xapian::Database *dba = (Xapian::Database *) zarg_get_object(zarg, OTYPE_DB, ARCHIVE_DB_NAME);
 			if (dba != NULL) {
 				zarg->db->add_database(*dba);
 			}
+			zarg->db->add_database(*db);
+			if (cmd->cmd == CMD_SEARCH_SET_DB) {
+				add_delta_database(conn, dba, db);
+			}
+		} else {
+			zarg->db->add_database(*db);
 		}
-		zarg->db->add_database(*db);
 
 		zarg->qp->set_database(*zarg->db);
 		DELETE_PTR(zarg->eq);
 		zarg->eq = new Xapian::Enquire(*zarg->db);
 		conn->flag &= ~CONN_FLAG_CH_SORT;
+		zarg->cq_stamp[0] = 0;
 
 		zarg->db_total = zarg->db->get_doccount();
 		rc = CONN_RES_OK(DB_CHANGED);
@@ -893,14 +1189,133 @@ static int zcmd_task_set_db(XS_CONN *conn)
 	return rc;
 }
 
+/**
+ * Set remote shards to search, matched by Xapian remote backend
+ * Weights are calculated with statistics of all shards, so results are ranked consistently
+ * @param conn
+ * @return CMD_RES_CONT
+ */
+static int zcmd_task_set_shards(XS_CONN *conn)
+{
+	XS_CMD *cmd = conn->zcmd;
+	struct search_zarg *zarg = (struct search_zarg *) conn->zarg;
+	string list = string(XS_CMD_BUF(cmd), XS_CMD_BLEN(cmd)), addr;
+	Xapian::Database *db, *sdb;
+	size_t pos = 0, end;
+	int num = 0;
+
+	db = new Xapian::Database();
+	try {
+		while (pos < list.size()) {
+			if ((end = list.find(';', pos)) == string::npos) {
+				end = list.size();
+			}
+			addr = list.substr(pos, end - pos);
+			pos = end + 1;
+			if (addr.empty()) {
+				continue;
+			}
+			if (++num > MAX_SEARCH_SHARDS) {
+				delete db;
+				return CONN_RES_ERR(TOOLONG);
+			}
+			if ((sdb = fetch_conn_shard(conn, addr)) == NULL) {
+				log_notice_conn("invalid address of shard (ADDR:%s)", addr.data());
+				delete db;
+				return CONN_RES_ERR(WRONGFORMAT);
+			}
+			db->add_database(*sdb);
+		}
+	} catch (...) {
+		delete db;
+		throw;
+	}
+	if (num == 0) {
+		delete db;
+		return CONN_RES_ERR(EMPTY);
+	}
+
+	conn->flag |= CONN_FLAG_CH_DB;
+	DELETE_PTR(zarg->shadow);
+	DELETE_PTR(zarg->db);
+	zarg->db = db;
+	zarg->qp->set_database(*zarg->db);
+	DELETE_PTR(zarg->eq);
+	zarg->eq = new Xapian::Enquire(*zarg->db);
+	conn->flag &= ~CONN_FLAG_CH_SORT;
+	zarg->cq_stamp[0] = 0;
+
+	zarg->db_total = zarg->db->get_doccount();
+	log_info_conn("search on remote shards (NUM:%d, TOTAL:%u)", num, zarg->db_total);
+	return CONN_RES_OK(DB_CHANGED);
+}
+
+/**
+ * Get matched count from term frequency directly (without matcher)
+ * Supported: single term, match all, or filtered by them, weight scaled is ignored
+ * @param db
+ * @param q
+ * @param count
+ * @return bool true if the count is available
+ */
+static bool get_count_by_termfreq(Xapian::Database *db, const Xapian::Query &q, unsigned int &count)
+{
+	switch (q.get_type()) {
+		case Xapian::Query::LEAF_MATCH_ALL:
+			count = db->get_doccount();
+			return true;
+		case Xapian::Query::LEAF_TERM:
+			count = db->get_termfreq(*q.get_terms_begin());
+			return true;
+		case Xapian::Query::OP_SCALE_WEIGHT:
+			return get_count_by_termfreq(db, q.get_subquery(0), count);
+		case Xapian::Query::OP_AND:
+		case Xapian::Query::OP_FILTER:
+			if (q.get_num_subqueries() == 2) {
+				if (q.get_subquery(0).get_type() == Xapian::Query::LEAF_MATCH_ALL) {
+					return get_count_by_termfreq(db, q.get_subquery(1), count);
+				}
+				if (q.get_subquery(1).get_type() == Xapian::Query::LEAF_MATCH_ALL) {
+					return get_count_by_termfreq(db, q.get_subquery(0), count);
+				}
+			}
+			break;
+		default:
+			break;
+	}
+	return false;
+}
+
+#ifdef HAVE_MEMORY_CACHE
+/**
+ * Get cache key of matched count, shared by CMD_SEARCH_GET_TOTAL & CMD_SEARCH_GET_RESULT
+ * KEY: MD5("Count for " +  user + ": " + query [+ " Check: " + check_at_least]);
+ * @param conn
+ * @param qq
+ * @param check check_at_least used to get the count
+ * @param md5
+ */
+static void get_count_key(XS_CONN *conn, const Xapian::Query &qq, unsigned int check, char *md5)
+{
+	string key = "Count for " + string(conn->user->name) + ": " + qq.get_description();
+	if (check != MAX_SEARCH_RESULT) {
+		char buf[32];
+		sprintf(buf, " Check: %u", check);
+		key += buf;
+	}
+	md5_r(key.data(), md5);
+}
+#endif
+
 /**
  * Get total matched count
+ * arg1: CMD_COUNT_ESTIMATED/CMD_COUNT_EXACT, buf1: check_at_least (optional)
  * @param conn
  * @return CMD_RES_CONT
  */
 static int zcmd_task_get_total(XS_CONN *conn)
 {
-	unsigned int count, total;
+	unsigned int count, total, check;
 	XS_CMD *cmd = conn->zcmd;
 	struct search_zarg *zarg = (struct search_zarg *) conn->zarg;
 	Xapian::Query qq;
@@ -928,18 +1343,25 @@ static int zcmd_task_get_total(XS_CONN *conn)
 
 	// get total & count
 	total = zarg->db->get_doccount();
+	if (XS_CMD_BLEN1(cmd) == sizeof(int)) {
+		check = *((unsigned int *) XS_CMD_BUF1(cmd));
+	} else {
+		check = cmd->arg1 == CMD_COUNT_EXACT ? total : MAX_SEARCH_RESULT;
+	}
 	if (qq.empty()) {
 		count = total;
+	} else if (!(conn->flag & (CONN_FLAG_CH_COLLAPSE | CONN_FLAG_CH_CUTOFF)) && zarg->shadow == NULL
+			&& get_count_by_termfreq(zarg->db, qq, count)) {
+		log_debug_conn("search count by termfreq (COUNT:%d)", count);
 	} else {
 		int cache_flag = CACHE_NONE;
 #ifdef HAVE_MEMORY_CACHE
-		char md5[33]; // KEY: MD5("Count for " +  user + ": " + query");
+		char md5[33];
 
 		if (!(conn->flag & CONN_FLAG_CH_DB)) {
 			struct cache_count *cc;
-			string key = "Count for " + string(conn->user->name) + ": " + qq.get_description();
 
-			md5_r(key.data(), md5);
+			get_count_key(conn, qq, check, md5);
 			cache_flag |= CACHE_USE;
 
 			// Extremely low probability of deadlock for adding CONN_FLAG_CACHE_LOCKED
@@ -969,9 +1391,10 @@ static int zcmd_task_get_total(XS_CONN *conn)
 			zarg->eq->set_sort_by_relevance(); // sort reset
 			zarg->eq->set_query(qq);
 
-			Xapian::MSet mset = zarg->eq->get_mset(0, MAX_SEARCH_RESULT);
+			// count only, none of documents need to be ranked or collected
+			Xapian::MSet mset = zarg->eq->get_mset(0, 0, check, NULL, zarg->shadow);
 			count = mset.get_matches_estimated();
-			log_debug_conn("search count estimated (COUNT:%d)", count);
+			log_debug_conn("search count estimated (COUNT:%d, CHECK:%u)", count, check);
 
 #ifdef HAVE_MEMORY_CACHE
 			if (cache_flag & CACHE_USE) {
@@ -1017,6 +1440,7 @@ static int zcmd_task_get_result(XS_CONN *conn)
 #endif
 	Xapian::Query qq;
 	unsigned char facets[MAX_SEARCH_FACETS + 2];
+	bool exact = cmd->arg1 == CMD_COUNT_EXACT;
 
 	conn_server_add_num_task(1);
 	// load & clear specified facets
@@ -1052,9 +1476,9 @@ static int zcmd_task_get_result(XS_CONN *conn)
 			limit = MAX_SEARCH_RESULT;
 		}
 	}
-	log_debug_conn("search result (USER:%s, OFF:%d, LIMIT:%d, QUERY:%s, FACETS:%c%d)",
+	log_debug_conn("search result (USER:%s, OFF:%d, LIMIT:%d, QUERY:%s, FACETS:%c%d, EXACT:%d)",
 			conn->user->name, off, limit, qq.get_description().data() + 13,
-			facets[0], strlen((const char *) facets) - 1);
+			facets[0], strlen((const char *) facets) - 1, exact);
 
 #if 0
 	// check to skip empty query
@@ -1096,9 +1520,13 @@ static int zcmd_task_get_result(XS_CONN *conn)
 #ifdef HAVE_MEMORY_CACHE
 	// Only cache for default db with default sorter, and only top MAX_SEARCH_RESUT items
 	// KEY: MD5("Result for " +  user + ": " + query");
+	// NOTE: the matched count is also saved into count cache for CMD_SEARCH_GET_TOTAL
 	if ((off + limit) <= MAX_SEARCH_RESULT
 			&& !(conn->flag & (CONN_FLAG_CH_SORT | CONN_FLAG_CH_DB | CONN_FLAG_CH_COLLAPSE))) {
 		string key = "Result for " + string(conn->user->name) + ": " + qq.get_description();
+		if (exact) {
+			key += " Exact";
+		}
 		if (facets[1] != '\0') {
 			key += " Facets: " + string((const char *) facets);
 		}
@@ -1148,7 +1576,7 @@ static int zcmd_task_get_result(XS_CONN *conn)
 			zarg->eq->add_matchspy(spy[i - 1]);
 		}
 
-		Xapian::MSet mset = zarg->eq->get_mset(off2, limit2, facets[0] == '+' ? total : 0);
+		Xapian::MSet mset = zarg->eq->get_mset(off2, limit2, (exact || facets[0] == '+') ? total : 0, NULL, zarg->shadow);
 		count = mset.get_matches_estimated();
 		log_debug_conn("search result estimated (COUNT:%d, OFF2:%d, LIMIT2:%d)", count, off2, limit2);
 
@@ -1244,11 +1672,17 @@ res_err1:
 #ifdef HAVE_MEMORY_CACHE
 		// check to save or delete cache
 		if (cache_flag & CACHE_NEED) {
-			cr->total = total;
-			cr->count = count;
-			cr->lastid = zarg->db->get_lastdocid();
+			struct cache_count cs;
+			char md5c[33];
+
+			cr->total = cs.total = total;
+			cr->count = cs.count = count;
+			cr->lastid = cs.lastid = zarg->db->get_lastdocid();
+			// off2 = 0, limit2 = MAX_SEARCH_RESULT, so check_at_least is the same as counting
+			get_count_key(conn, qq, (exact || facets[0] == '+') ? total : MAX_SEARCH_RESULT, md5c);
 			C_LOCK_CACHE();
 			mc_put(mc, md5, cr, sizeof(struct search_result) +cr->facets_len);
+			mc_put(mc, md5c, &cs, sizeof(cs));
 			C_UNLOCK_CACHE();
 			log_debug_conn("search result cache created (KEY:%s, COUNT:%d)", md5, count);
 		} else if (cache_flag & CACHE_FOUND) {
@@ -1431,8 +1865,7 @@ static int zcmd_task_add_query(XS_CONN *conn)
 		q2 = Xapian::Query(less ? Xapian::Query::OP_VALUE_LE : Xapian::Query::OP_VALUE_GE, cmd->arg2, qstr);
 	} else {
 		int flag = zarg->parse_flag > 0 ? zarg->parse_flag : Xapian::QueryParser::FLAG_DEFAULT;
-		zarg->qp->set_default_op(GET_QUERY_OP(cmd->arg2));
-		q2 = zarg->qp->parse_query(qstr, flag);
+		q2 = parse_query_cached(conn, qstr, flag, cmd->arg2);
 		log_info_conn("add parse query (QUERY:%s, FLAG:0x%04x, ADD_OP:%d, DEF_OP:%d)",
 				qstr.data(), flag, cmd->arg1, cmd->arg2);
 	}
@@ -1491,8 +1924,7 @@ static int zcmd_task_get_query(XS_CONN *conn)
 		string qstr = string(XS_CMD_BUF(cmd), XS_CMD_BLEN(cmd));
 		int flag = zarg->parse_flag > 0 ? zarg->parse_flag : Xapian::QueryParser::FLAG_DEFAULT;
 
-		zarg->qp->set_default_op(GET_QUERY_OP(cmd->arg2));
-		qq = zarg->qp->parse_query(qstr, flag);
+		qq = parse_query_cached(conn, qstr, flag, cmd->arg2);
 
 		if (cmd->cmd == CMD_QUERY_GET_STRING && XS_CMD_BLEN1(cmd) == 2) {
 			unsigned char *buf1 = (unsigned char *) XS_CMD_BUF1(cmd);
@@ -1504,6 +1936,7 @@ static int zcmd_task_get_query(XS_CONN *conn)
 	if (cmd->cmd == CMD_QUERY_GET_TERMS) {
 		std::set<string, string_casecmp> terms;
 		std::pair < std::set<string, string_casecmp>::iterator, bool> ins;
+		std::vector<string> words;
 		string str2, tt;
 		Xapian::TermIterator tb = qq.get_terms_begin();
 		Xapian::TermIterator te = qq.get_terms_end();
@@ -1515,10 +1948,8 @@ static int zcmd_task_get_query(XS_CONN *conn)
 				if (ins.second == true)
 					str += tt + " ";
 			} else {
-				Xapian::TermIterator ub = zarg->qp->unstem_begin(tt);
-				Xapian::TermIterator ue = zarg->qp->unstem_end(tt);
-
-				if (ub == ue) {
+				get_unstem_words(zarg, tt, words);
+				if (words.empty()) {
 					int i = 0;
 					while (tt[i] >= 'A' && tt[i] <= 'Z') i++;
 					if (i > 0) tt = tt.substr(i);
@@ -1526,18 +1957,16 @@ static int zcmd_task_get_query(XS_CONN *conn)
 					if (ins.second == true)
 						str += tt + " ";
 				} else {
-					bool first = true;
-					while (ub != ue) {
-						tt = *ub++;
+					for (int i = 0; i < words.size(); i++) {
+						tt = words[i];
 						ins = terms.insert(tt);
 						if (ins.second == true) {
-							if (first) {
+							if (i == 0) {
 								str += tt + " ";
 							} else {
 								str2 += tt + " ";
 							}
 						}
-						first = false;
 					}
 				}
 			}
@@ -1950,12 +2379,574 @@ static int zcmd_task_get_expanded(XS_CONN *conn)
 	return CONN_RES_OK2(RESULT_END, qq.get_description().data());
 }
 
+/**
+ * Sub searches (batch search & tagged request), every search runs on an independent
+ * sub connection with output captured, the owner of connection sends result blocks
+ * in order of completion
+ */
+#define	BATCH_WAIT		0
+#define	BATCH_RUNNING	1
+#define	BATCH_DONE		2
+
+struct batch_sub
+{
+	XS_CONN conn; // sub connection (CONN_FLAG_CAPTURE)
+	struct batch_ctx *ctx;
+	int tag; // index of search or request id
+	int state; // BATCH_xxx
+	int refs; // queued task + owner
+	pthread_t tid; // thread running the search
+	struct batch_sub *next; // done list
+	struct batch_sub *link; // all searches of context
+};
+
+struct batch_ctx
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t parent; // owner thread of the connection
+	int refs, num, sent, aborted;
+	int res_cmd; // respond command of result block
+	int wake[2]; // pipe to notify completion (tagged request only)
+	struct batch_sub *subs; // all searches
+	struct batch_sub *done, *done_tail; // finished searches
+};
+
+static int task_init_zarg(XS_CONN *conn, struct search_zarg *zarg);
+static int task_exec_cmds(XS_CONN *conn);
+
+/**
+ * Check if the command can be used in sub search
+ */
+static inline bool is_batch_cmd(int cmd)
+{
+	switch (cmd) {
+		case CMD_SEARCH_DB_TOTAL:
+		case CMD_SEARCH_GET_TOTAL:
+		case CMD_SEARCH_GET_RESULT:
+		case CMD_SEARCH_GET_SYNONYMS:
+		case CMD_QUERY_GET_STRING:
+		case CMD_QUERY_GET_TERMS:
+		case CMD_QUERY_GET_CORRECTED:
+		case CMD_QUERY_GET_EXPANDED:
+		case CMD_SEARCH_SET_DB:
+		case CMD_SEARCH_ADD_DB:
+		case CMD_SEARCH_SET_SHARDS:
+		case CMD_SEARCH_SET_SORT:
+		case CMD_SEARCH_SET_CUT:
+		case CMD_SEARCH_SET_NUMERIC:
+		case CMD_SEARCH_SET_COLLAPSE:
+		case CMD_SEARCH_SET_FACETS:
+		case CMD_SEARCH_SET_CUTOFF:
+		case CMD_SEARCH_SET_MISC:
+		case CMD_QUERY_INIT:
+		case CMD_QUERY_PARSE:
+		case CMD_QUERY_TERM:
+		case CMD_QUERY_TERMS:
+		case CMD_QUERY_RANGEPROC:
+		case CMD_QUERY_RANGE:
+		case CMD_QUERY_VALCMP:
+		case CMD_QUERY_PREFIX:
+		case CMD_QUERY_PARSEFLAG:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/**
+ * Create context of sub searches, referenced by owner
+ * @param res_cmd respond command of result block
+ * @return context pointer or NULL on failure
+ */
+static struct batch_ctx *batch_ctx_new(int res_cmd)
+{
+	struct batch_ctx *ctx;
+
+	debug_malloc(ctx, sizeof(struct batch_ctx), struct batch_ctx);
+	if (ctx != NULL) {
+		memset(ctx, 0, sizeof(struct batch_ctx));
+		pthread_mutex_init(&ctx->mutex, NULL);
+		pthread_cond_init(&ctx->cond, NULL);
+		ctx->parent = pthread_self();
+		ctx->refs = 1;
+		ctx->res_cmd = res_cmd;
+		ctx->wake[0] = ctx->wake[1] = -1;
+	}
+	return ctx;
+}
+
+/**
+ * Free the sub search (ctx locked)
+ */
+static void batch_sub_free(struct batch_sub *sub)
+{
+	struct batch_sub **pp;
+
+	for (pp = &sub->ctx->subs; *pp != NULL; pp = &(*pp)->link) {
+		if (*pp == sub) {
+			*pp = sub->link;
+			break;
+		}
+	}
+	conn_free_cmds(&sub->conn);
+	conn_free_iobufs(&sub->conn);
+	debug_free(sub);
+}
+
+/**
+ * Release reference of sub search
+ */
+static void batch_sub_unref(struct batch_sub *sub)
+{
+	struct batch_ctx *ctx = sub->ctx;
+
+	pthread_mutex_lock(&ctx->mutex);
+	if (--sub->refs == 0) {
+		batch_sub_free(sub);
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+/**
+ * Release reference of context, free it on last one
+ */
+static void batch_unref(struct batch_ctx *ctx)
+{
+	int refs;
+
+	pthread_mutex_lock(&ctx->mutex);
+	refs = --ctx->refs;
+	pthread_mutex_unlock(&ctx->mutex);
+	if (refs == 0) {
+		while (ctx->subs != NULL) {
+			batch_sub_free(ctx->subs);
+		}
+		if (ctx->wake[0] >= 0) {
+			close(ctx->wake[0]);
+			close(ctx->wake[1]);
+		}
+		pthread_cond_destroy(&ctx->cond);
+		pthread_mutex_destroy(&ctx->mutex);
+		debug_free(ctx);
+	}
+}
+
+/**
+ * Abort the context by owner, pending searches will be skipped
+ */
+static void batch_abort(struct batch_ctx *ctx)
+{
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->aborted = 1;
+	pthread_mutex_unlock(&ctx->mutex);
+	batch_unref(ctx);
+}
+
+/**
+ * Create sub search with a copy of connection
+ * @param ctx
+ * @param conn parent connection
+ * @param tag
+ * @return sub search pointer or NULL on failure
+ */
+static struct batch_sub *batch_sub_new(struct batch_ctx *ctx, XS_CONN *conn, int tag)
+{
+	struct batch_sub *sub;
+
+	debug_malloc(sub, sizeof(struct batch_sub), struct batch_sub);
+	if (sub != NULL) {
+		memcpy(&sub->conn, conn, sizeof(XS_CONN));
+		sub->conn.rcv_size = sub->conn.snd_size = 0;
+		sub->conn.flag = CONN_FLAG_CAPTURE;
+		sub->conn.zcmd_left = 0;
+		sub->conn.zcmd = NULL;
+		sub->conn.zhead = sub->conn.ztail = NULL;
+		sub->conn.zarg = NULL;
+		sub->conn.io_head = sub->conn.io_tail = NULL;
+		sub->ctx = ctx;
+		sub->tag = tag;
+		sub->state = BATCH_WAIT;
+		sub->refs = 1;
+		sub->next = NULL;
+		pthread_mutex_lock(&ctx->mutex);
+		sub->link = ctx->subs;
+		ctx->subs = sub;
+		pthread_mutex_unlock(&ctx->mutex);
+	}
+	return sub;
+}
+
+/**
+ * Append a copy of command into cmds list of sub search
+ * @return 0 on success, -1 on failure
+ */
+static int batch_sub_add_cmd(struct batch_sub *sub, const char *buf, int size)
+{
+	XS_CMD *cmd;
+	XS_CMDS *cmds;
+
+	debug_malloc(cmd, size, XS_CMD);
+	if (cmd == NULL) {
+		return -1;
+	}
+	debug_malloc(cmds, sizeof(XS_CMDS), XS_CMDS);
+	if (cmds == NULL) {
+		debug_free(cmd);
+		return -1;
+	}
+	memcpy(cmd, buf, size);
+	cmds->cmd = cmd;
+	cmds->next = NULL;
+	if (sub->conn.ztail == NULL) {
+		sub->conn.zhead = cmds;
+	} else {
+		sub->conn.ztail->next = cmds;
+	}
+	sub->conn.ztail = cmds;
+	return 0;
+}
+
+/**
+ * Put the finished search into done list, and wake up the owner
+ */
+static void batch_sub_done(struct batch_sub *sub)
+{
+	struct batch_ctx *ctx = sub->ctx;
+
+	pthread_mutex_lock(&ctx->mutex);
+	sub->state = BATCH_DONE;
+	sub->next = NULL;
+	if (ctx->done_tail == NULL) {
+		ctx->done = sub;
+	} else {
+		ctx->done_tail->next = sub;
+	}
+	ctx->done_tail = sub;
+	// EAGAIN: pipe is full, the owner will be woken up anyway
+	if (ctx->wake[1] >= 0 && write(ctx->wake[1], "", 1) < 0 && errno != EAGAIN) {
+		log_notice("failed to wake up batch owner (ERROR:%s)", strerror(errno));
+	}
+	pthread_cond_signal(&ctx->cond);
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+/**
+ * Run single sub search in current thread
+ */
+static void batch_run_sub(struct batch_sub *sub)
+{
+	int rc;
+	struct search_zarg zarg;
+	XS_CONN *conn = &sub->conn;
+
+	log_debug_conn("sub search begin (TAG:%d)", sub->tag);
+	if ((rc = task_init_zarg(conn, &zarg)) == CMD_RES_CONT) {
+		rc = task_exec_cmds(conn);
+	}
+	CONN_FLUSH();
+	zarg_cleanup(&zarg);
+	conn->zarg = NULL;
+	conn_free_cmds(conn);
+	log_debug_conn("sub search end (TAG:%d, RC:%d)", sub->tag, rc);
+
+	batch_sub_done(sub);
+}
+
+/**
+ * Task start pointer of sub search in thread pool
+ * @param arg batch_sub
+ */
+static void task_exec_batch(void *arg)
+{
+	struct batch_sub *sub = (struct batch_sub *) arg;
+	struct batch_ctx *ctx = sub->ctx;
+
+	// maybe it has been taken by owner
+	pthread_mutex_lock(&ctx->mutex);
+	if (ctx->aborted || sub->state != BATCH_WAIT) {
+		pthread_mutex_unlock(&ctx->mutex);
+	} else {
+		sub->state = BATCH_RUNNING;
+		sub->tid = pthread_self();
+		pthread_mutex_unlock(&ctx->mutex);
+		batch_run_sub(sub);
+	}
+	batch_sub_unref(sub);
+	batch_unref(ctx);
+}
+
+/**
+ * Cleanup function of sub search when thread canceled
+ * NOTE: references of owner are released in zarg_cleanup() of the owner
+ * @param arg batch_sub
+ */
+static void task_cancel_batch(void *arg)
+{
+	bool owner, parent;
+	struct batch_sub *sub = (struct batch_sub *) arg;
+	struct batch_ctx *ctx = sub->ctx;
+	XS_CONN *conn = &sub->conn;
+
+	pthread_mutex_lock(&ctx->mutex);
+	owner = sub->state == BATCH_RUNNING && pthread_equal(sub->tid, pthread_self());
+	parent = pthread_equal(ctx->parent, pthread_self());
+	pthread_mutex_unlock(&ctx->mutex);
+
+	if (owner) {
+		log_notice_conn("sub search canceld, run cleanup (TAG:%d, ZARG:%p)", sub->tag, conn->zarg);
+		if (conn->zarg != NULL) {
+			zarg_cleanup((struct search_zarg *) conn->zarg);
+			conn->zarg = NULL;
+		}
+#ifdef HAVE_MEMORY_CACHE
+		if (conn->flag & CONN_FLAG_CACHE_LOCKED) {
+			C_UNLOCK_CACHE();
+		}
+#endif
+		conn_free_cmds(conn);
+		CONN_RES_ERR(TASK_CANCELED);
+		CONN_FLUSH();
+		batch_sub_done(sub);
+	}
+	if (!parent) {
+		batch_sub_unref(sub);
+		batch_unref(ctx);
+	}
+}
+
+/**
+ * Cleanup function when owner canceled during waiting
+ * @param arg batch_ctx (locked)
+ */
+static void batch_wait_cleanup(void *arg)
+{
+	struct batch_ctx *ctx = (struct batch_ctx *) arg;
+
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+/**
+ * Submit the sub search to thread pool
+ */
+static void batch_submit(struct batch_ctx *ctx, struct batch_sub *sub)
+{
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->refs++;
+	ctx->num++;
+	sub->refs++;
+	pthread_mutex_unlock(&ctx->mutex);
+	tpool_exec(&thr_pool, task_exec_batch, task_cancel_batch, sub);
+}
+
+/**
+ * Send finished searches (ctx locked, and keep locked on return)
+ * @return CMD_RES_CONT | CMD_RES_IOERR
+ */
+static int batch_send_done(XS_CONN *conn, struct batch_ctx *ctx)
+{
+	int rc = CMD_RES_CONT;
+	struct batch_sub *sub;
+
+	while (rc == CMD_RES_CONT && (sub = ctx->done) != NULL) {
+		if ((ctx->done = sub->next) == NULL) {
+			ctx->done_tail = NULL;
+		}
+		ctx->sent++;
+		pthread_mutex_unlock(&ctx->mutex);
+		rc = conn_respond_captured(conn, ctx->res_cmd, sub->tag, &sub->conn);
+		batch_sub_unref(sub);
+		pthread_mutex_lock(&ctx->mutex);
+	}
+	return rc;
+}
+
+/**
+ * Send result blocks until all of submitted searches finished,
+ * run waiting searches by self if thread pool is busy
+ * @return CMD_RES_CONT | CMD_RES_IOERR
+ */
+static int batch_wait(XS_CONN *conn, struct batch_ctx *ctx)
+{
+	int rc = CMD_RES_CONT;
+	struct batch_sub *sub;
+
+	pthread_mutex_lock(&ctx->mutex);
+	while (ctx->sent < ctx->num) {
+		if (ctx->done != NULL) {
+			if ((rc = batch_send_done(conn, ctx)) != CMD_RES_CONT) {
+				break;
+			}
+			continue;
+		}
+		for (sub = ctx->subs; sub != NULL && sub->state != BATCH_WAIT; sub = sub->link);
+		if (sub != NULL) {
+			sub->state = BATCH_RUNNING;
+			sub->tid = pthread_self();
+			pthread_mutex_unlock(&ctx->mutex);
+			pthread_cleanup_push(task_cancel_batch, sub);
+			batch_run_sub(sub);
+			pthread_cleanup_pop(0);
+			pthread_mutex_lock(&ctx->mutex);
+			continue;
+		}
+		pthread_cleanup_push(batch_wait_cleanup, ctx);
+		pthread_cond_wait(&ctx->cond, &ctx->mutex);
+		pthread_cleanup_pop(0);
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+
+	return rc;
+}
+
+/**
+ * Run multiple searches concurrently
+ * @param conn
+ * @return CMD_RES_CONT
+ */
+static int zcmd_task_batch(XS_CONN *conn)
+{
+	int num, off, size, rc;
+	bool ended = true;
+	XS_CMD *cmd = conn->zcmd;
+	XS_CMD hdr;
+	struct search_zarg *zarg = (struct search_zarg *) conn->zarg;
+	struct batch_ctx *ctx;
+	struct batch_sub *sub = NULL;
+
+	// check the cmds list
+	for (num = off = 0; off < XS_CMD_BLEN(cmd); off += size) {
+		if ((XS_CMD_BLEN(cmd) - off) < (int) sizeof(XS_CMD)) {
+			return CONN_RES_ERR(WRONGFORMAT);
+		}
+		memcpy(&hdr, XS_CMD_BUF(cmd) + off, sizeof(XS_CMD));
+		size = XS_CMD_SIZE(&hdr);
+		if (size > (XS_CMD_BLEN(cmd) - off) || !is_batch_cmd(hdr.cmd)) {
+			return CONN_RES_ERR(WRONGFORMAT);
+		}
+		ended = hdr.cmd == CMD_SEARCH_GET_RESULT || hdr.cmd == CMD_SEARCH_GET_TOTAL;
+		if (ended) {
+			num++;
+		}
+	}
+	if (num == 0 || !ended) {
+		return CONN_RES_ERR(WRONGFORMAT);
+	}
+	if (num > MAX_SEARCH_BATCH) {
+		return CONN_RES_ERR(TOOLONG);
+	}
+	if ((ctx = batch_ctx_new(CMD_SEARCH_RESULT_BATCH)) == NULL) {
+		return CONN_RES_ERR(NOMEM);
+	}
+
+	// split into sub searches, submit to thread pool when ended
+	conn_server_add_num_task(1);
+	log_info_conn("batch search (NUM:%d)", num);
+	if ((rc = CONN_RES_OK3(RESULT_BEGIN, (char *) &num, sizeof(int))) != CMD_RES_CONT) {
+		batch_abort(ctx);
+		return rc;
+	}
+	zarg->batch = ctx;
+	for (num = off = 0; off < XS_CMD_BLEN(cmd); off += size) {
+		memcpy(&hdr, XS_CMD_BUF(cmd) + off, sizeof(XS_CMD));
+		size = XS_CMD_SIZE(&hdr);
+		if ((sub == NULL && (sub = batch_sub_new(ctx, conn, num)) == NULL)
+				|| batch_sub_add_cmd(sub, XS_CMD_BUF(cmd) + off, size) != 0) {
+			// searches submitted already should be waited
+			log_error_conn("failed to allocate memory for batch search (TAG:%d)", num);
+			if (sub != NULL) {
+				batch_sub_unref(sub);
+			}
+			break;
+		}
+		if (hdr.cmd == CMD_SEARCH_GET_RESULT || hdr.cmd == CMD_SEARCH_GET_TOTAL) {
+			batch_submit(ctx, sub);
+			sub = NULL;
+			num++;
+		}
+	}
+
+	// send result blocks
+	rc = batch_wait(conn, ctx);
+	zarg->batch = NULL;
+	batch_abort(ctx);
+
+	if (rc != CMD_RES_CONT) {
+		return rc;
+	}
+	return off < XS_CMD_BLEN(cmd) ? CONN_RES_ERR(NOMEM) : CONN_RES_OK(RESULT_END);
+}
+
+/**
+ * Tagged request (CMD_PROTOCOL_TAGGED), run as a sub search asynchronously
+ * The respond will be sent by task_exec_other() or at the end of task
+ * @param conn
+ * @return CMD_RES_CONT
+ */
+static int zcmd_task_request(XS_CONN *conn)
+{
+	int off, size;
+	XS_CMD *cmd = conn->zcmd;
+	XS_CMD hdr;
+	struct search_zarg *zarg = (struct search_zarg *) conn->zarg;
+	struct batch_ctx *ctx;
+	struct batch_sub *sub;
+
+	// check the cmds list
+	if (XS_CMD_BLEN(cmd) == 0) {
+		return CONN_RES_ERR(EMPTY);
+	}
+	for (off = 0; off < XS_CMD_BLEN(cmd); off += size) {
+		if ((XS_CMD_BLEN(cmd) - off) < (int) sizeof(XS_CMD)) {
+			return CONN_RES_ERR(WRONGFORMAT);
+		}
+		memcpy(&hdr, XS_CMD_BUF(cmd) + off, sizeof(XS_CMD));
+		size = XS_CMD_SIZE(&hdr);
+		if (size > (XS_CMD_BLEN(cmd) - off) || !is_batch_cmd(hdr.cmd)) {
+			return CONN_RES_ERR(WRONGFORMAT);
+		}
+	}
+
+	// context of tagged requests, keep until the task end
+	if ((ctx = zarg->rq) == NULL) {
+		if ((ctx = batch_ctx_new(CMD_RESPOND_TAGGED)) == NULL) {
+			return CONN_RES_ERR(NOMEM);
+		}
+		if (pipe(ctx->wake) != 0) {
+			log_error_conn("failed to create pipe for tagged request (ERROR:%s)", strerror(errno));
+			ctx->wake[0] = ctx->wake[1] = -1;
+			batch_abort(ctx);
+			return CONN_RES_ERR(UNKNOWN);
+		}
+		fcntl(ctx->wake[0], F_SETFL, O_NONBLOCK);
+		fcntl(ctx->wake[1], F_SETFL, O_NONBLOCK);
+		zarg->rq = ctx;
+	}
+	if ((sub = batch_sub_new(ctx, conn, XS_CMD_ARG(cmd))) == NULL) {
+		return CONN_RES_ERR(NOMEM);
+	}
+	for (off = 0; off < XS_CMD_BLEN(cmd); off += size) {
+		memcpy(&hdr, XS_CMD_BUF(cmd) + off, sizeof(XS_CMD));
+		size = XS_CMD_SIZE(&hdr);
+		if (batch_sub_add_cmd(sub, XS_CMD_BUF(cmd) + off, size) != 0) {
+			batch_sub_unref(sub);
+			return CONN_RES_ERR(NOMEM);
+		}
+	}
+	conn_server_add_num_task(1);
+	log_debug_conn("tagged request submitted (ID:%d)", sub->tag);
+	batch_submit(ctx, sub);
+
+	return CMD_RES_CONT;
+}
+
 /**
  * Task command table
  */
 static zcmd_exec_tab zcmd_task_tab[] = {
 	{CMD_SEARCH_SET_DB, zcmd_task_set_db},
 	{CMD_SEARCH_ADD_DB, zcmd_task_set_db},
+	{CMD_SEARCH_SET_SHARDS, zcmd_task_set_shards},
 	{CMD_SEARCH_GET_TOTAL, zcmd_task_get_total},
 	{CMD_SEARCH_GET_RESULT, zcmd_task_get_result},
 	{CMD_SEARCH_GET_SYNONYMS, zcmd_task_get_synonyms},
@@ -1968,6 +2959,8 @@ static zcmd_exec_tab zcmd_task_tab[] = {
 	{CMD_QUERY_GET_TERMS, zcmd_task_get_query},
 	{CMD_QUERY_GET_CORRECTED, zcmd_task_get_corrected},
 	{CMD_QUERY_GET_EXPANDED, zcmd_task_get_expanded},
+	{CMD_SEARCH_BATCH, zcmd_task_batch},
+	{CMD_REQUEST, zcmd_task_request},
 	{CMD_DEFAULT, zcmd_task_default}
 };
 
@@ -2163,13 +3156,17 @@ static int zcmd_exec_task(XS_CONN * conn)
  */
 static int task_exec_other(XS_CONN * conn)
 {
-	int rc;
-	struct pollfd fdarr[1];
+	int rc, pending = 0;
+	struct pollfd fdarr[2];
+	struct batch_ctx *rq;
 
 	// check to read new incoming data via poll()
 	fdarr[0].fd = CONN_FD();
 	fdarr[0].events = POLLIN;
 	fdarr[0].revents = 0;
+	fdarr[1].fd = -1;
+	fdarr[1].events = POLLIN;
+	fdarr[1].revents = 0;
 
 	// loop to parse cmd
 	log_debug_conn("check to run left cmds in task");
@@ -2178,9 +3175,29 @@ static int task_exec_other(XS_CONN * conn)
 		if ((rc = conn_cmds_parse(conn, zcmd_exec_task)) != CMD_RES_CONT) {
 			break;
 		}
+		// send responds of finished tagged requests
+		rq = (conn->flag & CONN_FLAG_ON_SCWS) ? NULL : ((struct search_zarg *) conn->zarg)->rq;
+		if (rq != NULL) {
+			pthread_mutex_lock(&rq->mutex);
+			rc = batch_send_done(conn, rq);
+			pending = rq->sent < rq->num;
+			pthread_mutex_unlock(&rq->mutex);
+			if (rc != CMD_RES_CONT || CONN_FLUSH() != 0) {
+				rc = CMD_RES_IOERR;
+				break;
+			}
+			fdarr[1].fd = rq->wake[0];
+		}
 		// try to poll data (only 1 second)
 		rc = conn->tv.tv_sec > 0 ? conn->tv.tv_sec * 1000 : -1;
-		if ((rc = poll(fdarr, 1, rc)) > 0) {
+		if ((rc = poll(fdarr, 2, rc)) > 0) {
+			if (fdarr[1].revents & POLLIN) {
+				char buf[64];
+				while (read(fdarr[1].fd, buf, sizeof(buf)) > 0);
+			}
+			if (!(fdarr[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+				continue;
+			}
 			rc = CONN_RECV();
 			log_debug_conn("data received in task (SIZE:%d)", rc);
 			if (rc <= 0) {
@@ -2188,6 +3205,10 @@ static int task_exec_other(XS_CONN * conn)
 				break;
 			}
 		} else {
+			if (rc == 0 && rq != NULL && pending) {
+				// waiting for tagged requests
+				continue;
+			}
 			if (rc == 0) {
 				rc = CMD_RES_TIMEOUT;
 			} else {
@@ -2315,41 +3336,34 @@ void task_cancel(void *arg)
 }
 
 /**
- * Task start pointer in thread pool
- * @param arg connection
+ * Init search zarg of connection: queryparser, default database and enquire
+ * @param conn connection
+ * @param zarg zarg to be initialized, it should be cleaned by zarg_cleanup() later
+ * @return CMD_RES_CONT on success, CMD_RES_ERROR on failure
  */
-void task_exec(void *arg)
+static int task_init_zarg(XS_CONN *conn, struct search_zarg *zarg)
 {
-	int rc;
-	XS_CMDS *cmds;
-	struct search_zarg zarg;
-	XS_CONN *conn = (XS_CONN *) arg;
-
-	// task scws
-	if (conn->flag & CONN_FLAG_ON_SCWS)
-		return task_do_scws(conn);
-
-	// init the zarg
-	log_debug_conn("init search zarg");
-	memset(&zarg, 0, sizeof(zarg));
-	conn->zarg = &zarg;
+	memset(zarg, 0, sizeof(struct search_zarg));
+	conn->zarg = zarg;
 	try {
 		scws_t s;
 		Xapian::Database *db;
 
-		zarg.qq = new Xapian::Query();
-		zarg.qp = get_queryparser();
-		zarg.qp->set_stemmer(stemmer);
-		zarg.qp->set_stopper(stopper);
-		zarg.qp->set_stemming_strategy(Xapian::QueryParser::STEM_SOME);
+		zarg->qq = new Xapian::Query();
+		zarg->qp_sign = new string();
+		zarg->scws_multi = DEFAULT_SCWS_MULTI;
+		zarg->qp = get_queryparser();
+		zarg->qp->set_stemmer(stemmer);
+		zarg->qp->set_stopper(stopper);
+		zarg->qp->set_stemming_strategy(Xapian::QueryParser::STEM_SOME);
 		// scws object
 		pthread_mutex_lock(&qp_mutex);
 		s = scws_fork(_scws);
-		zarg.qp->set_scws(s);
+		zarg->qp->set_scws(s);
 		pthread_mutex_unlock(&qp_mutex);
 
 		// load default database, try to init queryparser, enquire
-		conn->flag &= ~(CONN_FLAG_CH_DB | CONN_FLAG_CH_SORT | CONN_FLAG_CH_COLLAPSE);
+		conn->flag &= ~(CONN_FLAG_CH_DB | CONN_FLAG_CH_SORT | CONN_FLAG_CH_COLLAPSE | CONN_FLAG_CH_CUTOFF);
 		try {
 			char fpath[256];
 			sprintf(fpath, "%s/" CUSTOM_DICT_FILE, conn->user->home);
@@ -2363,16 +3377,18 @@ void task_exec(void *arg)
 				delete wdb;
 				db = fetch_conn_database(conn, DEFAULT_DB_NAME);
 			}
-			zarg.db = new Xapian::Database();
+			zarg->db = new Xapian::Database();
+			Xapian::Database *dba = NULL;
 			try {
-				Xapian::Database *dba = fetch_conn_database(conn, DEFAULT_DB_NAME "_a");
-				zarg.db->add_database(*dba);
+				dba = fetch_conn_database(conn, ARCHIVE_DB_NAME);
+				zarg->db->add_database(*dba);
 			} catch (...) {
 			}
-			zarg.db->add_database(*db);
-			zarg.qp->set_database(*zarg.db);
-			zarg.eq = new Xapian::Enquire(*zarg.db);
-			zarg.db_total = zarg.db->get_doccount();
+			zarg->db->add_database(*db);
+			add_delta_database(conn, dba, db);
+			zarg->qp->set_database(*zarg->db);
+			zarg->eq = new Xapian::Enquire(*zarg->db);
+			zarg->db_total = zarg->db->get_doccount();
 		} catch (const Xapian::Error &e) {
 			log_notice_conn("failed to open default db (ERROR:%s)", e.get_msg().data());
 		}
@@ -2380,17 +3396,24 @@ void task_exec(void *arg)
 		string msg = e.get_msg();
 		log_error_conn("xapian exception (ERROR:%s)", msg.data());
 		CONN_RES_ERR3(XAPIAN, msg.data(), msg.size());
-		rc = CMD_RES_ERROR;
-		goto task_end;
+		return CMD_RES_ERROR;
 	} catch (...) {
 		CONN_RES_ERR(UNKNOWN);
-		rc = CMD_RES_ERROR;
-		goto task_end;
+		return CMD_RES_ERROR;
 	}
+	return CMD_RES_CONT;
+}
+
+/**
+ * Execute saved cmds list of connection one by one
+ * @param conn connection
+ * @return CMD_RES_CONT if all of cmds executed, or CMD_RES_xxx
+ */
+static int task_exec_cmds(XS_CONN *conn)
+{
+	int rc = CMD_RES_CONT;
+	XS_CMDS *cmds;
 
-	// begin the task, parse & execute cmds list
-	// TODO: is need to check conn->zhead, conn->ztail should not be NULL
-	log_info_conn("task begin (HEAD:%d, TAIL:%d)", conn->zhead->cmd->cmd, conn->ztail->cmd->cmd);
 	while ((cmds = conn->zhead) != NULL) {
 		// run as zcmd
 		conn->zcmd = cmds->cmd;
@@ -2402,9 +3425,38 @@ void task_exec(void *arg)
 
 		// execute the zcmd (CMD_RES_CONT accepted only)
 		if ((rc = conn_zcmd_exec(conn, zcmd_exec_task)) != CMD_RES_CONT) {
-			goto task_end;
+			break;
 		}
 	}
+	return rc;
+}
+
+/**
+ * Task start pointer in thread pool
+ * @param arg connection
+ */
+void task_exec(void *arg)
+{
+	int rc;
+	struct search_zarg zarg;
+	XS_CONN *conn = (XS_CONN *) arg;
+
+	// task scws
+	if (conn->flag & CONN_FLAG_ON_SCWS)
+		return task_do_scws(conn);
+
+	// init the zarg
+	log_debug_conn("init search zarg");
+	if ((rc = task_init_zarg(conn, &zarg)) != CMD_RES_CONT) {
+		goto task_end;
+	}
+
+	// begin the task, parse & execute cmds list
+	// TODO: is need to check conn->zhead, conn->ztail should not be NULL
+	log_info_conn("task begin (HEAD:%d, TAIL:%d)", conn->zhead->cmd->cmd, conn->ztail->cmd->cmd);
+	if ((rc = task_exec_cmds(conn)) != CMD_RES_CONT) {
+		goto task_end;
+	}
 	// flush output cache
 	conn->ztail = NULL;
 	if (CONN_FLUSH() != 0) {
@@ -2418,6 +3470,10 @@ void task_exec(void *arg)
 	// end the task normal
 task_end:
 	log_info_conn("task end (RC:%d, CONN:%p)", rc, conn);
+	// send responds of pending tagged requests before pushing back
+	if (zarg.rq != NULL && rc == CMD_RES_PAUSE && batch_wait(conn, zarg.rq) != CMD_RES_CONT) {
+		rc = CMD_RES_IOERR;
+	}
 	// BUG: if thread cancled HERE, may cause some unspecified problems
 	// free objects of zarg
 	zarg_cleanup(&zarg);
@@ -2449,6 +3505,8 @@ void task_init()
 	// init qp_mutex
 	pthread_mutex_init(&qp_mutex, NULL);
 	qp_base = NULL;
+	// init cached query
+	pthread_mutex_init(&cq_mutex, NULL);
 }
 
 /**
@@ -2468,6 +3526,13 @@ void task_deinit()
 	pthread_mutex_unlock(&qp_mutex);
 	pthread_mutex_destroy(&qp_mutex);
 
+	// free cached query
+	pthread_mutex_lock(&cq_mutex);
+	cq_map.clear();
+	cq_lru.clear();
+	pthread_mutex_unlock(&cq_mutex);
+	pthread_mutex_destroy(&cq_mutex);
+
 	// unload scws base
 	if (_scws != NULL) {
 		scws_free(_scws);
@@ -26,6 +26,23 @@
  */
 #define	MAX_QUERY_LENGTH		192
 
+/**
+ * max number of parsed query cached in each worker process
+ */
+#define	MAX_QUERY_CACHE			1024
+
+/**
+ * max number of searches in a batch request
+ */
+#define	MAX_SEARCH_BATCH		32
+
+/**
+ * max number of remote shards of a project, and timeouts (msec) to access them
+ */
+#define	MAX_SEARCH_SHARDS		16
+#define	SHARD_TIMEOUT			10000
+#define	SHARD_CONNECT_TIMEOUT	3000
+
 int task_add_search_log(XS_CONN *conn);	// add search log
 void task_cancel(void *arg); // called on canceling task
 void task_exec(void *arg); // called on executing task
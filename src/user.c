@@ -8,6 +8,7 @@
 #    include "config.h"
 #endif
 
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
@@ -31,6 +32,9 @@ static inline void xs_user_free(XS_USER *user)
 
 	while ((db = user->db) != NULL) {
 		user->db = db->next;
+		if (db->wbuf != NULL) {
+			free(db->wbuf);
+		}
 		DEBUG_G_FREE(db);
 	}
 	DEBUG_G_FREE(user);
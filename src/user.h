@@ -24,7 +24,13 @@ extern "C" {
 #define	XS_DBF_REBUILD_END		0x10	// index rebuild end
 #define	XS_DBF_REBUILD_WAIT		0x20	// index rebuild begin during import running
 #define	XS_DBF_REBUILD_STOP		0x40	// index rebuild forced to stop
-#define	XS_DBF_REBUILD_MASK		0x78
+#define	XS_DBF_REBUILD_MASK		0x178
+#define	XS_DBF_RCV_RAW			0x80	// rcvfile saved as raw commands (import file version 0)
+#define	XS_DBF_REBUILD_MERGE	0x100	// index rebuild end, merging sub-databases
+#define	XS_DBF_DELTA_RESET		0x200	// delta db to be removed after delta import exit
+#define	XS_DBF_ARCHIVE_MERGE	0x400	// merging segments of archive db
+#define	XS_DBF_OPTIMIZE			0x800	// optimizing the db online
+#define	XS_DBF_SNAPSHOT			0x1000	// taking a snapshot of the db
 
 #define	XS_MAX_NAME_LEN			32		// max name len
 
@@ -43,6 +49,16 @@ typedef struct xs_db
 	int lcount; // last count of record point
 	pid_t pid; // pid of import process (0 -> not writing)
 	time_t ltime; // last commit time
+	time_t itime; // start time of running import
+	int icount; // count of documents in running import (0 -> unknown)
+	time_t atime; // modified time of archive stub file checked for merging
+	pid_t dpid; // pid of delta import process (near-real-time)
+	int dcount; // count of documents not imported into delta db
+	time_t dtime; // last delta import time
+	char *wbuf; // group commit buffer of rcvfile (indexd)
+	int wlen, wsize; // used & allocated size of wbuf
+	int wcount; // count of documents in wbuf
+	void *waits; // connections waiting for the group commit
 
 	struct xs_db *next;
 } XS_DB;
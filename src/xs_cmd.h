@@ -38,7 +38,25 @@ struct xs_import_hdr
 {
 	int proc_num; // num for commands processed (used to skip?)
 	off_t eff_size; // effective number of commands
-	char reserved[60 - SIZEOF_OFF_T];
+	off_t proc_off; // offset of record to resume import (version 1)
+	int proc_skip; // num of documents processed in the record at proc_off
+	int version; // 0: raw commands, 1: checksummed records (XS_IMPORT_VERSION)
+	char reserved[52 - SIZEOF_OFF_T - SIZEOF_OFF_T];
+};
+
+/**
+ * Record of import file (version 1)
+ * Each record is one saved request, followed by size bytes of raw commands,
+ * magic is used as sync marker to scan forward after the broken record
+ */
+#define	XS_IMPORT_VERSION		1
+#define	XS_IMPORT_REC_MAGIC		0x43525358	// "XSRC"
+
+struct xs_import_rec
+{
+	unsigned int magic; // XS_IMPORT_REC_MAGIC
+	unsigned int size; // size of commands
+	unsigned int crc; // CRC32C of commands
 };
 
 /* Macros to get buffer size of the command */
@@ -92,6 +110,19 @@ struct xs_import_hdr
  */
 #define	CMD_QUIT			4
 
+/**
+ * Negotiate protocol revision of current connection
+ * arg:CMD_PROTOCOL_xxx, respond: OK(PROTOCOL_SET) with buf:int(CMD_PROTOCOL)
+ */
+#define	CMD_SET_PROTOCOL	5
+
+/**
+ * Tagged request, available for CMD_PROTOCOL_TAGGED only
+ * arg:request_id, blen:cmds_len, buf:packed XS_CMD list
+ * Respond: RESPOND_TAGGED with the same request_id, maybe out of order on searchd
+ */
+#define	CMD_REQUEST			6
+
 /**
  * ------------------------------------------------
  * Commands of index server & import command: 32~63
@@ -118,8 +149,9 @@ struct xs_import_hdr
 #define	CMD_INDEX_SUBMIT	34
 
 /**
- * Remove document from current database by a term(word).
- * arg2:vno, blen:term_len, buf:term
+ * Remove document from current database by a term(word), or by range of value.
+ * arg1:CMD_INDEX_REMOVE_xxx, arg2:vno, blen:term_len, buf:term
+ * for range: arg1:CMD_INDEX_REMOVE_RANGE|numeric(0x80), buf:from, buf1:to (empty means unlimited)
  */
 #define	CMD_INDEX_REMOVE	35
 
@@ -174,6 +206,20 @@ struct xs_import_hdr
  */
 #define	CMD_INDEX_USER_DICT	43
 
+/**
+ * Optimize current database online
+ * Compacted in background, importing is paused until finished, but requests are still accepted
+ */
+#define	CMD_INDEX_OPTIMIZE	44
+
+/**
+ * Take a snapshot of current database, with archive & logging db, under snapshot/<name> of project home
+ * Copied by replication in background, importing is never paused
+ * buf:name, default to YYYYmmddHHMMSS if empty, respond OK_DB_SNAPSHOT with buf:name once started
+ * arg1=1: query status of the snapshot buf:name, respond OK_DB_SNAPSHOT if finished, ERR_RUNNING or ERR_SNAPSHOT
+ */
+#define	CMD_INDEX_SNAPSHOT	45
+
 /**
  * ----------------------------------------
  * Commands of search server: 64~95
@@ -188,13 +234,14 @@ struct xs_import_hdr
 /**
  * Get the number of matched documents, cache enabled
  * NOTE: If you have to read the search results, use CMD_SEARCH_GET_RESULT instead.
- * arg2:default_op, blen:query_len, buf:query
+ * arg1:count_mode, arg2:default_op, blen:query_len, buf:query
+ * blen1:4/0, buf1:int(check_at_least)/null
  */
 #define	CMD_SEARCH_GET_TOTAL	65
 
 /**
- * Get matched search results
- * arg2:default_op, blen:query_len, buf:query
+ * Get matched search results, with count & facets in one match pass
+ * arg1:count_mode, arg2:default_op, blen:query_len, buf:query
  * blen1:8, buf1:int(offset)+int(limit)
  */
 #define	CMD_SEARCH_GET_RESULT	66
@@ -245,6 +292,28 @@ struct xs_import_hdr
  */
 #define	CMD_SEARCH_SCWS_GET		73
 
+/**
+ * Run multiple searches concurrently, each one is a full query description
+ * blen:cmds_len, buf:packed XS_CMD list, every search ends with GET_RESULT/GET_TOTAL
+ * Respond: OK(RESULT_BEGIN, int(num)) + RESULT_BATCH... + OK(RESULT_END)
+ * NOTE: searches are independent, settings of current connection are not inherited
+ */
+#define	CMD_SEARCH_BATCH		74
+
+/**
+ * Get replication lag of current project in seconds, for replica of index server
+ * Respond: OK(REPLICA_LAG) with buf:int(lag), -1 if the project is not replicated
+ */
+#define	CMD_SEARCH_REPLICA_LAG	75
+
+/**
+ * Search across remote shards of the project, instead of local databases
+ * Each shard is a Xapian remote server of the project databases, e.g: xapian-tcpsrv --port 8386 db db_a
+ * Top-k, facets & counts are merged with statistics of all shards, undone by CMD_SEARCH_SET_DB
+ * blen:list_len, buf:list of <host:port> separated by ';'
+ */
+#define	CMD_SEARCH_SET_SHARDS	76
+
 /**
  * ----------------------------------------
  * Commands of search query: 96~127
@@ -297,6 +366,12 @@ struct xs_import_hdr
  */
 #define	CMD_ERR					129
 
+/**
+ * Respond of tagged request
+ * arg:request_id, blen:respond_len, buf:respond commands of the request
+ */
+#define	CMD_RESPOND_TAGGED		130
+
 /**
  * Result document start
  * blen:sizeof(struct result_doc)=20, buf:(struct result_doc)
@@ -321,6 +396,12 @@ struct xs_import_hdr
  */
 #define	CMD_SEARCH_RESULT_MATCHED	143
 
+/**
+ * Result block of batch search (sent in order of completion)
+ * arg:index of search, blen:block_len, buf:respond commands of the search
+ */
+#define	CMD_SEARCH_RESULT_BATCH	144
+
 /**
  * -----------------------------------------
  * Request commands without respond: 160~255
@@ -550,6 +631,7 @@ struct xs_import_hdr
 // 9. request type
 #define	CMD_INDEX_REQUEST_ADD		0
 #define	CMD_INDEX_REQUEST_UPDATE	1
+#define	CMD_INDEX_REQUEST_PATCH		2	// patch values only by CMD_DOC_VALUE, terms are not changed
 
 // 10. synonyms op
 #define	CMD_INDEX_SYNONYMS_ADD		0
@@ -560,6 +642,18 @@ struct xs_import_hdr
 #define CMD_SEARCH_MISC_MATCHED_TERM	2
 #define CMD_SEARCH_MISC_WEIGHT_SCHEME	3
 
+// 12. count mode
+#define	CMD_COUNT_ESTIMATED			0
+#define	CMD_COUNT_EXACT				1
+
+// 13. protocol revision
+#define	CMD_PROTOCOL_BASIC			0
+#define	CMD_PROTOCOL_TAGGED			1
+
+// 14. remove type
+#define	CMD_INDEX_REMOVE_TERM		0
+#define	CMD_INDEX_REMOVE_RANGE		1
+
 /**
  * ----------------------------------
  * Constant defined for scws set/get
@@ -616,6 +710,9 @@ struct xs_import_hdr
 #define	CMD_ERR_OPEN_FILE		513
 #define	CMD_ERR_TASK_CANCELED	514
 #define	CMD_ERR_XAPIAN			515
+#define	CMD_ERR_EXISTS			516
+#define	CMD_ERR_SNAPSHOT		517
+#define	CMD_ERR_DISCARDED		518
 
 // err string
 #define	CMD_ERR_600				"Unknown internal error"
@@ -646,6 +743,9 @@ struct xs_import_hdr
 #define	CMD_ERR_513				"Failed to open file"
 #define	CMD_ERR_514				"Task is canceled due to timeout/error"
 #define	CMD_ERR_515				"Xapian ERROR"
+#define	CMD_ERR_516				"File or directory already exists"
+#define	CMD_ERR_517				"Snapshot failed or not found"
+#define	CMD_ERR_518				"Uncommitted data is discarded"
 
 // respond OK code
 #define	CMD_OK_INFO				200
@@ -661,6 +761,7 @@ struct xs_import_hdr
 #define	CMD_OK_TIMEOUT_SET		208
 #define	CMD_OK_FINISHED			209
 #define	CMD_OK_LOGGED			210
+#define	CMD_OK_PROTOCOL_SET		211
 
 // for indexd
 #define	CMD_OK_RQST_FINISHED	250
@@ -673,10 +774,13 @@ struct xs_import_hdr
 #define	CMD_OK_DB_REBUILD		257
 #define	CMD_OK_LOG_FLUSHED		258
 #define	CMD_OK_DICT_SAVED		259
+#define	CMD_OK_DB_OPTIMIZE		260
+#define	CMD_OK_DB_SNAPSHOT		261
 
 // for searchd
 // Each record per line, split by '\t'
 #define	CMD_OK_RESULT_SYNONYMS	280
+#define	CMD_OK_REPLICA_LAG		281
 
 // for scws
 // int(off|times)/char4(attr)/char[](word)
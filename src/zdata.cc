@@ -0,0 +1,212 @@
+/**
+ * Compressed document data (zstd with trained dictionary)
+ *
+ * $Id$
+ */
+
+#ifdef HAVE_CONFIG_H
+#    include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <map>
+
+#include "zdata.h"
+#include "global.h"
+
+using std::string;
+
+#ifdef HAVE_ZSTD
+#include <zdict.h>
+
+static pthread_mutex_t zdict_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<string, ZSTD_DDict *> zdict_cache; // key: <dir>zdict_<id>.dat
+static pthread_key_t zdctx_key;
+static pthread_once_t zdctx_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Read whole content of dictionary file
+ */
+static bool zdict_read(const string &path, string &buf)
+{
+	FILE *fp;
+	char tmp[8192];
+	size_t n;
+
+	if ((fp = fopen(path.data(), "r")) == NULL) {
+		return false;
+	}
+	buf.resize(0);
+	while ((n = fread(tmp, 1, sizeof(tmp), fp)) > 0) {
+		buf.append(tmp, n);
+	}
+	fclose(fp);
+	return buf.size() > 0;
+}
+
+/**
+ * Train dictionary by samples, save it & make it current one of the project
+ * @param dir directory of project, ends with '/'
+ * @param samples content of samples
+ * @param sizes size of each sample
+ * @return id of the dictionary, 0 on failure
+ */
+unsigned int zdict_train(const string &dir, const string &samples, const std::vector<size_t> &sizes)
+{
+	char path[256], tmp[256];
+	size_t size;
+	unsigned int id;
+	FILE *fp;
+	string dict(ZDICT_SIZE, '\0');
+
+	size = ZDICT_trainFromBuffer(&dict[0], dict.size(), samples.data(), &sizes[0], sizes.size());
+	if (ZDICT_isError(size) || (id = ZDICT_getDictID(dict.data(), size)) == 0) {
+		return 0;
+	}
+	sprintf(path, "%szdict_%u.dat", dir.data(), id);
+	if ((fp = fopen(path, "w")) == NULL) {
+		return 0;
+	}
+	if (fwrite(dict.data(), 1, size, fp) != size) {
+		fclose(fp);
+		unlink(path);
+		return 0;
+	}
+	fclose(fp);
+
+	// switch the link
+	sprintf(path, "zdict_%u.dat", id);
+	sprintf(tmp, "%s" ZDICT_FILE ".tmp", dir.data());
+	unlink(tmp);
+	if (symlink(path, tmp) != 0) {
+		return 0;
+	}
+	sprintf(path, "%s" ZDICT_FILE, dir.data());
+	if (rename(tmp, path) != 0) {
+		unlink(tmp);
+		return 0;
+	}
+	return id;
+}
+
+/**
+ * Load current dictionary of the project to compress
+ * @param dir directory of project, ends with '/'
+ * @param id id of the dictionary
+ * @return NULL if compression is not enabled
+ */
+ZSTD_CDict *zdict_load(const string &dir, unsigned int *id)
+{
+	string buf;
+
+	if (!zdict_read(dir + ZDICT_FILE, buf)) {
+		return NULL;
+	}
+	*id = ZDICT_getDictID(buf.data(), buf.size());
+	return ZSTD_createCDict(buf.data(), buf.size(), ZDATA_LEVEL);
+}
+
+/**
+ * Compress string with dictionary
+ * @param cctx context owned by the thread, created if it is NULL
+ * @param cdict
+ * @param src
+ * @param dst marked compressed string
+ * @return bool false if it is not smaller than src
+ */
+bool zdata_compress(ZSTD_CCtx **cctx, const ZSTD_CDict *cdict, const string &src, string &dst)
+{
+	size_t size;
+
+	if (*cctx == NULL && (*cctx = ZSTD_createCCtx()) == NULL) {
+		return false;
+	}
+	dst.resize(ZDATA_MAGIC_LEN + ZSTD_compressBound(src.size()));
+	memcpy(&dst[0], ZDATA_MAGIC, ZDATA_MAGIC_LEN);
+	size = ZSTD_compress_usingCDict(*cctx, &dst[ZDATA_MAGIC_LEN], dst.size() - ZDATA_MAGIC_LEN,
+			src.data(), src.size(), cdict);
+	if (ZSTD_isError(size) || (size + ZDATA_MAGIC_LEN) >= src.size()) {
+		return false;
+	}
+	dst.resize(size + ZDATA_MAGIC_LEN);
+	return true;
+}
+
+static void zdctx_free(void *ptr)
+{
+	ZSTD_freeDCtx((ZSTD_DCtx *) ptr);
+}
+
+static void zdctx_init()
+{
+	pthread_key_create(&zdctx_key, zdctx_free);
+}
+
+/**
+ * Get dictionary to decompress from cache, loaded on demand
+ */
+static ZSTD_DDict *zdict_get(const string &dir, unsigned int id)
+{
+	char name[32];
+	string path, buf;
+	ZSTD_DDict *ddict = NULL;
+	std::map<string, ZSTD_DDict *>::iterator it;
+
+	sprintf(name, "zdict_%u.dat", id);
+	path = dir + name;
+	pthread_mutex_lock(&zdict_mutex);
+	if ((it = zdict_cache.find(path)) != zdict_cache.end()) {
+		ddict = it->second;
+	} else if (zdict_cache.size() < ZDICT_CACHE_MAX && zdict_read(path, buf)) {
+		ddict = ZSTD_createDDict(buf.data(), buf.size());
+		if (ddict != NULL) {
+			zdict_cache[path] = ddict;
+		}
+	}
+	pthread_mutex_unlock(&zdict_mutex);
+	return ddict;
+}
+#endif
+
+/**
+ * Decompress marked string in place, dictionary is found by id of the frame
+ * @param dir directory of project, ends with '/'
+ * @param data
+ * @return bool false if failed, data is not changed
+ */
+bool zdata_decompress(const string &dir, string &data)
+{
+#ifdef HAVE_ZSTD
+	const char *src = data.data() + ZDATA_MAGIC_LEN;
+	size_t size = data.size() - ZDATA_MAGIC_LEN;
+	unsigned long long len = ZSTD_getFrameContentSize(src, size);
+	ZSTD_DDict *ddict;
+	ZSTD_DCtx *dctx;
+	string dst;
+
+	if (len == ZSTD_CONTENTSIZE_UNKNOWN || len == ZSTD_CONTENTSIZE_ERROR
+			|| (ddict = zdict_get(dir, ZSTD_getDictID_fromFrame(src, size))) == NULL) {
+		return false;
+	}
+	pthread_once(&zdctx_once, zdctx_init);
+	if ((dctx = (ZSTD_DCtx *) pthread_getspecific(zdctx_key)) == NULL) {
+		if ((dctx = ZSTD_createDCtx()) == NULL) {
+			return false;
+		}
+		pthread_setspecific(zdctx_key, dctx);
+	}
+	dst.resize(len);
+	size = ZSTD_decompress_usingDDict(dctx, &dst[0], dst.size(), src, size, ddict);
+	if (ZSTD_isError(size) || size != len) {
+		return false;
+	}
+	data.swap(dst);
+	return true;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,35 @@
+/**
+ * Compressed document data (zstd with trained dictionary)
+ * Compressed string is marked with ZDATA_MAGIC, dictionaries of project are saved
+ * as <home>/zdict_<id>.dat and never removed, <home>/zdict links to the current one.
+ * Values are never compressed, they are read by matcher to sort, filter & count facets.
+ *
+ * $Id$
+ */
+
+#ifndef __XS_ZDATA_20261019_H__
+#define	__XS_ZDATA_20261019_H__
+
+#include <string>
+#include <vector>
+
+#define	ZDATA_MAGIC			"\0Z"	// leading bytes of compressed string
+#define	ZDATA_MAGIC_LEN		2
+#define	ZDATA_MIN_DATA		32		// min size of document data to compress
+#define	ZDATA_LEVEL			3		// compression level
+#define	ZDICT_SIZE			32768	// max size of trained dictionary
+#define	ZDICT_SAMPLES		20000	// max number of documents sampled to train dictionary
+#define	ZDICT_CACHE_MAX		64		// max number of dictionaries loaded for decompressing
+
+#define	ZDATA_COMPRESSED(s)	((s).size() > ZDATA_MAGIC_LEN && !memcmp((s).data(), ZDATA_MAGIC, ZDATA_MAGIC_LEN))
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+
+unsigned int zdict_train(const std::string &dir, const std::string &samples, const std::vector<size_t> &sizes);
+ZSTD_CDict *zdict_load(const std::string &dir, unsigned int *id);
+bool zdata_compress(ZSTD_CCtx **cctx, const ZSTD_CDict *cdict, const std::string &src, std::string &dst);
+#endif
+bool zdata_decompress(const std::string &dir, std::string &data);
+
+#endif	/* __XS_ZDATA_20261019_H__ */